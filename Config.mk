@@ -83,6 +83,13 @@ FLUIDSYNTHHOME=$(realpath external/fluidsynth)
 FLUIDSYNTHBUILDDIR=build-fluidsynth
 FLUIDSYNTHLIB=$(FLUIDSYNTHBUILDDIR)/src/libfluidsynth.a
 
+# Native builds of the synth libraries for the host-side render tool
+MT32EMUHOSTBUILDDIR=build-host-munt
+MT32EMUHOSTLIB=$(MT32EMUHOSTBUILDDIR)/libmt32emu.a
+
+FLUIDSYNTHHOSTBUILDDIR=build-host-fluidsynth
+FLUIDSYNTHHOSTLIB=$(FLUIDSYNTHHOSTBUILDDIR)/src/libfluidsynth.a
+
 INIHHOME=$(realpath external/inih)
 
 -include $(CIRCLE_STDLIB_CONFIG)
@@ -0,0 +1,97 @@
+#
+# Build host-side offline render tool, MIDI parser, ring buffer and sample conversion benchmarks
+#
+# The render tool links against native builds of mt32emu and FluidSynth made from the submodules; build it with
+# "make host" from the top-level Makefile, which builds those into build-host-munt and build-host-fluidsynth first
+# The benchmarks need neither, e.g. "make -f Host.mk mt32-pi-parsebench"
+#
+
+include Config.mk
+
+HOSTBUILDDIR	:=	build-host
+HOSTTARGET		:=	mt32-pi-render
+HOSTBENCHTARGET	:=	mt32-pi-parsebench
+HOSTRINGTARGET	:=	mt32-pi-ringbench
+HOSTCONVTARGET	:=	mt32-pi-convbench
+
+HOSTOBJS	:=	host/src/circle.o \
+				host/src/fatfs.o \
+				host/src/midifile.o \
+				host/src/render.o \
+				src/audio/audiostats.o \
+				src/config.o \
+				src/coreworker.o \
+				src/lcd/synthlcd.o \
+				src/midiparser.o \
+				src/rommanager.o \
+				src/soundfontmanager.o \
+				src/synth/channelactivity.o \
+				src/synth/midicommandqueue.o \
+				src/synth/mt32synth.o \
+				src/synth/soundfontsynth.o \
+				src/zoneallocator.o
+
+HOSTOBJS	:=	$(addprefix $(HOSTBUILDDIR)/,$(HOSTOBJS)) \
+				$(HOSTBUILDDIR)/inih/ini.o
+
+HOSTBENCHOBJS	:=	host/src/circle.o \
+					host/src/parsebench.o \
+					src/midiparser.o \
+					src/synth/midicommandqueue.o
+
+HOSTBENCHOBJS	:=	$(addprefix $(HOSTBUILDDIR)/,$(HOSTBENCHOBJS))
+
+HOSTRINGOBJS	:=	$(HOSTBUILDDIR)/host/src/ringbench.o
+
+# Checks the NEON conversion against the scalar one; build with an ARM HOSTCXX (and run on ARM) to exercise it
+HOSTCONVOBJS	:=	$(HOSTBUILDDIR)/host/src/convbench.o
+
+HOSTCC		?=	cc
+HOSTCXX		?=	c++
+
+HOSTFLAGS	:=	-O2 -g -Wall -Wextra -Wno-unused-parameter -MMD \
+				-D MT32_PI_HOST \
+				-I host/include \
+				-I include \
+				-I $(INIHHOME) \
+				-I $(MT32EMUHOSTBUILDDIR)/include \
+				-I $(FLUIDSYNTHHOSTBUILDDIR)/include \
+				-I $(FLUIDSYNTHHOME)/include
+
+HOSTCFLAGS		:=	$(HOSTFLAGS)
+HOSTCXXFLAGS	:=	$(HOSTFLAGS) -std=gnu++14 -fno-exceptions -fno-rtti
+
+HOSTLIBS	:=	$(MT32EMUHOSTLIB) \
+				$(FLUIDSYNTHHOSTLIB) \
+				-lpthread \
+				-lm
+
+all: $(HOSTTARGET) $(HOSTBENCHTARGET) $(HOSTRINGTARGET) $(HOSTCONVTARGET)
+
+$(HOSTTARGET): $(MT32EMUHOSTLIB) $(FLUIDSYNTHHOSTLIB) $(HOSTOBJS)
+	$(HOSTCXX) -o $@ $(HOSTOBJS) $(HOSTLIBS)
+
+$(MT32EMUHOSTLIB) $(FLUIDSYNTHHOSTLIB):
+	$(error $@ has not been built; run "make host" to build it from the submodules)
+
+$(HOSTBENCHTARGET): $(HOSTBENCHOBJS)
+	$(HOSTCXX) -o $@ $^
+
+$(HOSTRINGTARGET): $(HOSTRINGOBJS)
+	$(HOSTCXX) -o $@ $^ -lpthread
+
+$(HOSTCONVTARGET): $(HOSTCONVOBJS)
+	$(HOSTCXX) -o $@ $^ -lm
+
+$(HOSTBUILDDIR)/%.o: %.cpp
+	@mkdir -p $(dir $@)
+	$(HOSTCXX) $(HOSTCXXFLAGS) -c -o $@ $<
+
+$(HOSTBUILDDIR)/inih/ini.o: $(INIHHOME)/ini.c
+	@mkdir -p $(dir $@)
+	$(HOSTCC) $(HOSTCFLAGS) -c -o $@ $<
+
+clean:
+	$(RM) -r $(HOSTBUILDDIR) $(HOSTTARGET) $(HOSTBENCHTARGET) $(HOSTRINGTARGET) $(HOSTCONVTARGET)
+
+-include $(HOSTOBJS:.o=.d) $(HOSTBENCHOBJS:.o=.d) $(HOSTRINGOBJS:.o=.d) $(HOSTCONVOBJS:.o=.d)
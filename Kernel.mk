@@ -4,12 +4,17 @@
 
 include Config.mk
 
-OBJS		:=	src/config.o \
+OBJS		:=	src/audio/audiocalibrator.o \
+				src/audio/audiocapture.o \
+				src/audio/audioscheduler.o \
+				src/audio/audiostats.o \
+				src/config.o \
 				src/control/control.o \
 				src/control/mister.o \
 				src/control/rotaryencoder.o \
 				src/control/simplebuttons.o \
 				src/control/simpleencoder.o \
+				src/coreworker.o \
 				src/kernel.o \
 				src/lcd/hd44780.o \
 				src/lcd/hd44780fourbit.o \
@@ -18,17 +23,24 @@ OBJS		:=	src/config.o \
 				src/lcd/ssd1306.o \
 				src/lcd/synthlcd.o \
 				src/main.o \
+				src/midioutput.o \
 				src/midiparser.o \
+				src/midiplayer.o \
 				src/mt32pi.o \
 				src/pisound.o \
 				src/power.o \
 				src/rommanager.o \
 				src/soundfontmanager.o \
+				src/synth/channelactivity.o \
+				src/synth/midicoalescer.o \
+				src/synth/midicommandqueue.o \
 				src/synth/mt32synth.o \
+				src/synth/rolanddt1splitter.o \
 				src/synth/soundfontsynth.o \
 				src/zoneallocator.o
 
 EXTRACLEAN	+=	src/*.d src/*.o \
+				src/audio/*.d src/audio/*.o \
 				src/control/*.d src/control/*.o \
 				src/lcd/*.d src/lcd/*.o \
 				src/synth/*.d src/synth/*.o
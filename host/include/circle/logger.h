@@ -0,0 +1,54 @@
+//
+// logger.h - host build stand-in for Circle's <circle/logger.h>
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _circle_logger_h
+#define _circle_logger_h
+
+#include <circle/types.h>
+
+enum TLogSeverity
+{
+	LogPanic,
+	LogError,
+	LogWarning,
+	LogNotice,
+	LogDebug
+};
+
+// Writes to stderr; messages less severe than the given level are suppressed
+class CLogger
+{
+public:
+	CLogger(TLogSeverity MaxSeverity = LogNotice);
+
+	void Write(const char* pSource, TLogSeverity Severity, const char* pMessage, ...);
+
+	static CLogger* Get() { return s_pThis; }
+
+private:
+	TLogSeverity m_MaxSeverity;
+
+	static CLogger* s_pThis;
+};
+
+#endif
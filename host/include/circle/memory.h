@@ -0,0 +1,52 @@
+//
+// memory.h - host build stand-in for Circle's <circle/memory.h>
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _circle_memory_h
+#define _circle_memory_h
+
+#include <circle/types.h>
+
+#define HEAP_LOW  0
+#define HEAP_HIGH 1
+
+#define MEGABYTE 0x100000
+
+// Only what CZoneAllocator needs; the zone heap comes from the host's allocator
+class CMemorySystem
+{
+public:
+	size_t GetHeapFreeSpace(int nType) const { return HostHeapSize; }
+	void* HeapAllocate(size_t nSize, int nType) { return aligned_alloc(16, (nSize + 15) & ~15); }
+
+	static CMemorySystem* Get()
+	{
+		static CMemorySystem MemorySystem;
+		return &MemorySystem;
+	}
+
+private:
+	// CZoneAllocator keeps 32MB of this back for the rest of the system
+	static constexpr size_t HostHeapSize = 544 * MEGABYTE;
+};
+
+#endif
@@ -0,0 +1,60 @@
+//
+// string.h - host build stand-in for Circle's <circle/string.h>
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _circle_string_h
+#define _circle_string_h
+
+#include <circle/types.h>
+#include <circle/util.h>
+
+class CString
+{
+public:
+	CString() : m_pBuffer(nullptr) {}
+	CString(const char* pString) : m_pBuffer(pString ? strdup(pString) : nullptr) {}
+	CString(const CString& String) : CString(String.m_pBuffer) {}
+	~CString() { free(m_pBuffer); }
+
+	operator const char*() const { return m_pBuffer ? m_pBuffer : ""; }
+
+	const char* operator=(const char* pString)
+	{
+		char* pNewBuffer = pString ? strdup(pString) : nullptr;
+		free(m_pBuffer);
+		m_pBuffer = pNewBuffer;
+		return *this;
+	}
+
+	CString& operator=(const CString& String)
+	{
+		*this = String.m_pBuffer;
+		return *this;
+	}
+
+	size_t GetLength() const { return m_pBuffer ? strlen(m_pBuffer) : 0; }
+
+private:
+	char* m_pBuffer;
+};
+
+#endif
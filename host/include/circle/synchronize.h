@@ -0,0 +1,44 @@
+//
+// synchronize.h - host build stand-in for Circle's <circle/synchronize.h>
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _circle_synchronize_h
+#define _circle_synchronize_h
+
+#include <sched.h>
+
+#include <circle/types.h>
+
+#define TASK_LEVEL 0
+#define IRQ_LEVEL  1
+
+#define DataSyncBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define DataMemBarrier()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+// Threads poll instead of sleeping until an event
+#define WaitForEvent() sched_yield()
+#define SendEvent()    ((void)0)
+
+// As in Circle, users of CSpinLock may rely on this header alone
+#include <circle/spinlock.h>
+
+#endif
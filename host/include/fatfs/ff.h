@@ -0,0 +1,109 @@
+//
+// ff.h - host build stand-in for FatFs, backed by the host file system
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _fatfs_ff_h
+#define _fatfs_ff_h
+
+#include <cstdio>
+
+#include <circle/types.h>
+
+typedef unsigned int UINT;
+typedef u8 BYTE;
+typedef u16 WORD;
+typedef u32 DWORD;
+typedef u64 FSIZE_t;
+typedef char TCHAR;
+
+#define FF_LFN_BUF 255
+
+typedef enum
+{
+	FR_OK = 0,
+	FR_DISK_ERR,
+	FR_INT_ERR,
+	FR_NOT_READY,
+	FR_NO_FILE,
+	FR_NO_PATH,
+	FR_INVALID_NAME,
+	FR_DENIED,
+	FR_EXIST,
+} FRESULT;
+
+#define FA_READ          0x01
+#define FA_WRITE         0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW    0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS   0x10
+
+#define AM_RDO 0x01
+#define AM_HID 0x02
+#define AM_SYS 0x04
+#define AM_DIR 0x10
+#define AM_ARC 0x20
+
+struct FIL
+{
+	FILE* pFile;
+	FSIZE_t fptr;
+	FSIZE_t obj_size;
+};
+
+struct DIR
+{
+	void* pDir;
+	const TCHAR* pPath;
+	const TCHAR* pPattern;
+};
+
+struct FILINFO
+{
+	FSIZE_t fsize;
+	BYTE fattrib;
+	TCHAR fname[FF_LFN_BUF + 1];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode);
+FRESULT f_close(FIL* fp);
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br);
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw);
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs);
+FRESULT f_stat(const TCHAR* path, FILINFO* fno);
+FRESULT f_findfirst(DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern);
+FRESULT f_findnext(DIR* dp, FILINFO* fno);
+FRESULT f_closedir(DIR* dp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define f_tell(fp) ((fp)->fptr)
+#define f_size(fp) ((fp)->obj_size)
+#define f_eof(fp)  ((int)((fp)->fptr == (fp)->obj_size))
+
+#endif
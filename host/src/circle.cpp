@@ -0,0 +1,65 @@
+//
+// circle.cpp - host build implementations of the Circle stand-ins
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstdarg>
+#include <cstdio>
+#include <time.h>
+#include <unistd.h>
+
+#include <circle/logger.h>
+#include <circle/timer.h>
+
+CLogger* CLogger::s_pThis = nullptr;
+
+static const char* const SeverityNames[] = { "!", "E", "W", "N", "D" };
+
+CLogger::CLogger(TLogSeverity MaxSeverity)
+	: m_MaxSeverity(MaxSeverity)
+{
+	s_pThis = this;
+}
+
+void CLogger::Write(const char* pSource, TLogSeverity Severity, const char* pMessage, ...)
+{
+	if (Severity > m_MaxSeverity)
+		return;
+
+	va_list Args;
+	va_start(Args, pMessage);
+	fprintf(stderr, "%s %s: ", SeverityNames[Severity], pSource);
+	vfprintf(stderr, pMessage, Args);
+	fputc('\n', stderr);
+	va_end(Args);
+}
+
+unsigned CTimer::GetClockTicks()
+{
+	timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return static_cast<unsigned>(static_cast<u64>(Time.tv_sec) * CLOCKHZ + Time.tv_nsec / 1000);
+}
+
+void CTimer::SimpleMsDelay(unsigned nMilliSeconds)
+{
+	usleep(nMilliSeconds * 1000);
+}
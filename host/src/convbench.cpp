@@ -0,0 +1,184 @@
+//
+// convbench.cpp - checks and times the float to PCM sample conversion
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <time.h>
+#include <vector>
+
+#include "audio/sampleconverter.h"
+
+#ifdef SAMPLECONVERTER_NEON
+constexpr const char* ConverterName = "NEON";
+#else
+constexpr const char* ConverterName = "generic";
+#endif
+
+// Gains the synths and mixer use, including ones that push full-scale input past the clamp
+constexpr float Gains[] = { 1.0f, 0.5f, 0.70710678f, 2.0f };
+
+// Longer than the vector width many times over, so every tail length is covered at every alignment
+constexpr size_t MaxTestSamples = 67;
+
+// Audio block timed for throughput, and how many times it is converted
+constexpr size_t BenchSamples = 1024;
+constexpr unsigned BenchIterations = 100000;
+
+static u64 GetWallNanos()
+{
+	timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return static_cast<u64>(Time.tv_sec) * 1000000000 + Time.tv_nsec;
+}
+
+// Samples either side of every clamp edge and rounding boundary, padded out with random full-scale audio
+static std::vector<float> MakeTestSamples()
+{
+	std::vector<float> Samples;
+	const float Edges[] = {
+		0.0f,
+		1.0f,
+		1.0f / SampleConverter::Sample16BitMax,
+		0.5f / SampleConverter::Sample16BitMax,
+		1.0f / SampleConverter::Sample24BitMax,
+		0.5f / SampleConverter::Sample24BitMax,
+		0.5f,
+		1.5f,
+		1e9f,
+		std::numeric_limits<float>::denorm_min(),
+		std::numeric_limits<float>::infinity(),
+	};
+
+	for (float nEdge : Edges)
+	{
+		for (float nSample : { nEdge, std::nextafter(nEdge, 0.0f), std::nextafter(nEdge, 2.0f * nEdge + 1.0f) })
+		{
+			Samples.push_back(nSample);
+			Samples.push_back(-nSample);
+		}
+	}
+
+	srand(1);
+	while (Samples.size() % MaxTestSamples || Samples.size() < MaxTestSamples * 8)
+		Samples.push_back(static_cast<float>(rand()) / RAND_MAX * 2.5f - 1.25f);
+
+	return Samples;
+}
+
+// Every length up to MaxTestSamples at every offset into the test samples; the scalar path is the reference
+template <class T>
+static bool CheckFormat(const char* pName, const std::vector<float>& Samples)
+{
+	T Vector[MaxTestSamples], Scalar[MaxTestSamples];
+	size_t nMismatches = 0;
+
+	for (float nGain : Gains)
+	{
+		const float nScale = nGain * SampleConverter::TFormat<T>::Max;
+
+		for (size_t nOffset = 0; nOffset + MaxTestSamples <= Samples.size(); ++nOffset)
+		{
+			for (size_t nSamples = 0; nSamples <= MaxTestSamples; ++nSamples)
+			{
+				SampleConverter::FloatToPCM(Vector, Samples.data() + nOffset, nSamples, nGain);
+				SampleConverter::FloatToPCMScalar(Scalar, Samples.data() + nOffset, nSamples, nScale);
+
+				if (memcmp(Vector, Scalar, nSamples * sizeof(T)) == 0)
+					continue;
+
+				for (size_t i = 0; i < nSamples; ++i)
+				{
+					if (Vector[i] != Scalar[i] && nMismatches++ < 10)
+						fprintf(stderr, "%s: gain %g, input %.9g: %s %ld, scalar %ld\n", pName, nGain, Samples[nOffset + i], ConverterName, static_cast<long>(Vector[i]), static_cast<long>(Scalar[i]));
+				}
+			}
+		}
+	}
+
+	printf("%-4s %s conversion %s the scalar reference\n", pName, ConverterName, nMismatches ? "DIFFERS from" : "is bit-identical to");
+	return nMismatches == 0;
+}
+
+template <class T>
+static void TimeFormat(const char* pName, const std::vector<float>& Samples)
+{
+	T* pOutBuffer = new T[BenchSamples];
+	const float nScale = SampleConverter::TFormat<T>::Max;
+
+	// Keep the output live so that neither loop can be optimized away
+	u64 nChecksum = 0;
+
+	u64 nStart = GetWallNanos();
+	for (unsigned i = 0; i < BenchIterations; ++i)
+	{
+		SampleConverter::FloatToPCM(pOutBuffer, Samples.data(), BenchSamples);
+		nChecksum += pOutBuffer[i % BenchSamples];
+	}
+	const u64 nVectorNanos = GetWallNanos() - nStart;
+
+	nStart = GetWallNanos();
+	for (unsigned i = 0; i < BenchIterations; ++i)
+	{
+		SampleConverter::FloatToPCMScalar(pOutBuffer, Samples.data(), BenchSamples, nScale);
+		nChecksum += pOutBuffer[i % BenchSamples];
+	}
+	const u64 nScalarNanos = GetWallNanos() - nStart;
+
+	const double nSamples = static_cast<double>(BenchSamples) * BenchIterations;
+	printf("%-4s %s %6.1f Msamples/s, scalar %6.1f Msamples/s (%.2fx) [%llu]\n", pName, ConverterName, nSamples * 1000 / nVectorNanos, nSamples * 1000 / nScalarNanos,
+		static_cast<double>(nScalarNanos) / nVectorNanos, static_cast<unsigned long long>(nChecksum & 0xFF));
+
+	delete[] pOutBuffer;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+	{
+		fprintf(stderr,
+			"Usage: %s\n"
+			"\n"
+			"Checks that the vectorized float to 16 and 24-bit PCM conversion matches the scalar\n"
+			"reference bit for bit across the clamp edges and every tail length, then times both.\n"
+			"The NEON path is only built for ARM hosts; elsewhere the generic path is checked.\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const std::vector<float> TestSamples = MakeTestSamples();
+	bool bResult = CheckFormat<s16>("s16", TestSamples);
+	bResult &= CheckFormat<s32>("s24", TestSamples);
+
+	// Typical audio for timing: mostly in range, with some clipping
+	std::vector<float> AudioSamples(BenchSamples);
+	for (size_t i = 0; i < AudioSamples.size(); ++i)
+		AudioSamples[i] = 1.1f * sinf(i * 0.05f);
+
+	TimeFormat<s16>("s16", AudioSamples);
+	TimeFormat<s32>("s24", AudioSamples);
+
+	return bResult ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,165 @@
+//
+// fatfs.cpp - host build implementation of the FatFs subset used by mt32-pi
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+// FatFs' DIR clashes with the one from <dirent.h>; the API has C linkage, so the tag name doesn't matter
+typedef DIR TPOSIXDir;
+#define DIR TFatFsDir
+#include <fatfs/ff.h>
+
+FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode)
+{
+	const char* pMode;
+	if (mode & FA_CREATE_ALWAYS)
+		pMode = (mode & FA_READ) ? "w+b" : "wb";
+	else if (mode & FA_WRITE)
+		pMode = "r+b";
+	else
+		pMode = "rb";
+
+	fp->pFile = fopen(path, pMode);
+	if (!fp->pFile)
+		return FR_NO_FILE;
+
+	fseek(fp->pFile, 0, SEEK_END);
+	fp->obj_size = ftell(fp->pFile);
+	fseek(fp->pFile, 0, SEEK_SET);
+	fp->fptr = 0;
+
+	return FR_OK;
+}
+
+FRESULT f_close(FIL* fp)
+{
+	if (!fp->pFile)
+		return FR_INT_ERR;
+
+	const int nResult = fclose(fp->pFile);
+	fp->pFile = nullptr;
+
+	return nResult == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+	*br = fread(buff, 1, btr, fp->pFile);
+	fp->fptr += *br;
+
+	return ferror(fp->pFile) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw)
+{
+	*bw = fwrite(buff, 1, btw, fp->pFile);
+	fp->fptr += *bw;
+	if (fp->fptr > fp->obj_size)
+		fp->obj_size = fp->fptr;
+
+	return ferror(fp->pFile) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
+{
+	if (fseek(fp->pFile, ofs, SEEK_SET) != 0)
+		return FR_DISK_ERR;
+
+	fp->fptr = ofs;
+	return FR_OK;
+}
+
+FRESULT f_stat(const TCHAR* path, FILINFO* fno)
+{
+	struct stat Stat;
+	if (stat(path, &Stat) != 0)
+		return FR_NO_FILE;
+
+	if (fno)
+	{
+		const char* pName = strrchr(path, '/');
+		strncpy(fno->fname, pName ? pName + 1 : path, FF_LFN_BUF);
+		fno->fname[FF_LFN_BUF] = '\0';
+		fno->fsize   = Stat.st_size;
+		fno->fattrib = S_ISDIR(Stat.st_mode) ? AM_DIR : 0;
+	}
+
+	return FR_OK;
+}
+
+FRESULT f_findfirst(DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern)
+{
+	dp->pDir     = opendir(path);
+	dp->pPath    = path;
+	dp->pPattern = pattern;
+
+	if (!dp->pDir)
+		return FR_NO_PATH;
+
+	return f_findnext(dp, fno);
+}
+
+// Like FatFs, an empty file name marks the end of the directory
+FRESULT f_findnext(DIR* dp, FILINFO* fno)
+{
+	fno->fname[0] = '\0';
+
+	if (!dp->pDir)
+		return FR_OK;
+
+	while (const dirent* pEntry = readdir(static_cast<TPOSIXDir*>(dp->pDir)))
+	{
+		if (fnmatch(dp->pPattern, pEntry->d_name, 0) != 0)
+			continue;
+
+		char Path[PATH_MAX];
+		snprintf(Path, sizeof(Path), "%s/%s", dp->pPath, pEntry->d_name);
+
+		struct stat Stat;
+		if (stat(Path, &Stat) != 0)
+			continue;
+
+		strncpy(fno->fname, pEntry->d_name, FF_LFN_BUF);
+		fno->fname[FF_LFN_BUF] = '\0';
+		fno->fsize   = Stat.st_size;
+		fno->fattrib = (S_ISDIR(Stat.st_mode) ? AM_DIR : 0) | (pEntry->d_name[0] == '.' ? AM_HID : 0);
+
+		return FR_OK;
+	}
+
+	return f_closedir(dp);
+}
+
+FRESULT f_closedir(DIR* dp)
+{
+	if (dp->pDir)
+	{
+		closedir(static_cast<TPOSIXDir*>(dp->pDir));
+		dp->pDir = nullptr;
+	}
+
+	return FR_OK;
+}
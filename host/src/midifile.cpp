@@ -0,0 +1,254 @@
+//
+// midifile.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <circle/logger.h>
+
+#include "midifile.h"
+
+const char MIDIFileName[] = "midifile";
+
+// Microseconds per quarter note until the first tempo event
+constexpr u32 DefaultTempo = 500000;
+
+// Tempo changes are stored in the merged list with no MIDI data
+constexpr u32 NoTempo = 0;
+
+static u32 ReadBE(const u8* pData, size_t nBytes)
+{
+	u32 nValue = 0;
+	for (size_t i = 0; i < nBytes; ++i)
+		nValue = (nValue << 8) | pData[i];
+	return nValue;
+}
+
+static bool ReadVarLen(const u8*& pData, const u8* pEnd, u32& nValue)
+{
+	nValue = 0;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		if (pData >= pEnd)
+			return false;
+
+		const u8 nByte = *pData++;
+		nValue = (nValue << 7) | (nByte & 0x7F);
+		if (!(nByte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+bool CMIDIFile::ReadFile(const char* pPath, std::vector<u8>& Buffer)
+{
+	FILE* pFile = fopen(pPath, "rb");
+	if (!pFile)
+	{
+		CLogger::Get()->Write(MIDIFileName, LogError, "Couldn't open '%s' for reading", pPath);
+		return false;
+	}
+
+	fseek(pFile, 0, SEEK_END);
+	Buffer.resize(ftell(pFile));
+	fseek(pFile, 0, SEEK_SET);
+
+	const bool bResult = fread(Buffer.data(), 1, Buffer.size(), pFile) == Buffer.size();
+	fclose(pFile);
+
+	return bResult;
+}
+
+bool CMIDIFile::LoadRaw(const char* pPath)
+{
+	if (!ReadFile(pPath, m_Data))
+		return false;
+
+	m_Events.clear();
+	for (size_t i = 0; i < m_Data.size(); ++i)
+		m_Events.push_back({i * RawByteMicros, i, 1});
+
+	return true;
+}
+
+bool CMIDIFile::LoadSMF(const char* pPath)
+{
+	std::vector<u8> File;
+	if (!ReadFile(pPath, File))
+		return false;
+
+	CLogger* const pLogger = CLogger::Get();
+	if (File.size() < 14 || memcmp(File.data(), "MThd", 4) != 0)
+	{
+		pLogger->Write(MIDIFileName, LogError, "'%s' is not a Standard MIDI File", pPath);
+		return false;
+	}
+
+	const u32 nHeaderSize = ReadBE(&File[4], 4);
+	const u16 nFormat     = ReadBE(&File[8], 2);
+	const u16 nTracks     = ReadBE(&File[10], 2);
+	const u16 nDivision   = ReadBE(&File[12], 2);
+
+	if (nFormat == 2)
+		pLogger->Write(MIDIFileName, LogWarning, "Format 2 file; tracks will be played simultaneously");
+
+	// Parse all tracks, then merge them in time order; the sort is stable so same-tick events keep track order
+	std::vector<TTrackEvent> TrackEvents;
+	size_t nOffset = 8 + nHeaderSize;
+	m_Data.clear();
+
+	for (u16 nTrack = 0; nTrack < nTracks; ++nTrack)
+	{
+		if (nOffset + 8 > File.size() || memcmp(&File[nOffset], "MTrk", 4) != 0)
+		{
+			pLogger->Write(MIDIFileName, LogError, "Track %u header not found", nTrack);
+			return false;
+		}
+
+		const size_t nTrackSize = std::min<size_t>(ReadBE(&File[nOffset + 4], 4), File.size() - nOffset - 8);
+		if (!ParseTrack(&File[nOffset + 8], nTrackSize, TrackEvents))
+			pLogger->Write(MIDIFileName, LogWarning, "Track %u is truncated or corrupt", nTrack);
+
+		nOffset += 8 + nTrackSize;
+	}
+
+	std::stable_sort(TrackEvents.begin(), TrackEvents.end(), [](const TTrackEvent& A, const TTrackEvent& B) { return A.nTick < B.nTick; });
+
+	// Convert ticks to microseconds; SMPTE divisions have a fixed tick length
+	const bool bSMPTE = nDivision & 0x8000;
+	const u64 nTicksPerSecond = bSMPTE ? static_cast<u64>(-static_cast<s8>(nDivision >> 8)) * (nDivision & 0xFF) : 0;
+	const u64 nTicksPerQuarter = bSMPTE ? 0 : nDivision;
+
+	if (!nTicksPerSecond && !nTicksPerQuarter)
+	{
+		pLogger->Write(MIDIFileName, LogError, "Invalid time division");
+		return false;
+	}
+
+	u32 nTempo = DefaultTempo;
+	u64 nTempoTick = 0;
+	u64 nTempoMicros = 0;
+
+	m_Events.clear();
+	for (const TTrackEvent& Event : TrackEvents)
+	{
+		const u64 nDeltaTicks = Event.nTick - nTempoTick;
+		const u64 nTimeMicros = bSMPTE ? Event.nTick * 1000000 / nTicksPerSecond : nTempoMicros + nDeltaTicks * nTempo / nTicksPerQuarter;
+
+		if (Event.nTempo != NoTempo)
+		{
+			nTempo       = Event.nTempo;
+			nTempoTick   = Event.nTick;
+			nTempoMicros = nTimeMicros;
+			continue;
+		}
+
+		m_Events.push_back({nTimeMicros, Event.nOffset, Event.nSize});
+	}
+
+	return true;
+}
+
+bool CMIDIFile::ParseTrack(const u8* pData, size_t nSize, std::vector<TTrackEvent>& Events)
+{
+	const u8* const pEnd = pData + nSize;
+	u64 nTick = 0;
+	u8 nRunningStatus = 0;
+
+	while (pData < pEnd)
+	{
+		u32 nDelta;
+		if (!ReadVarLen(pData, pEnd, nDelta) || pData >= pEnd)
+			return false;
+
+		nTick += nDelta;
+
+		u8 nStatus = *pData;
+		if (nStatus & 0x80)
+			++pData;
+		else if (nRunningStatus)
+			nStatus = nRunningStatus;
+		else
+			return false;
+
+		// Meta event
+		if (nStatus == 0xFF)
+		{
+			if (pData >= pEnd)
+				return false;
+
+			const u8 nType = *pData++;
+			u32 nLength;
+			if (!ReadVarLen(pData, pEnd, nLength) || nLength > static_cast<size_t>(pEnd - pData))
+				return false;
+
+			// End of track
+			if (nType == 0x2F)
+				return true;
+
+			if (nType == 0x51 && nLength == 3)
+				Events.push_back({nTick, ReadBE(pData, 3), 0, 0});
+
+			pData += nLength;
+			continue;
+		}
+
+		// SysEx; F0 events omit the leading F0, F7 "escapes" carry any bytes verbatim
+		if (nStatus == 0xF0 || nStatus == 0xF7)
+		{
+			nRunningStatus = 0;
+
+			u32 nLength;
+			if (!ReadVarLen(pData, pEnd, nLength) || nLength > static_cast<size_t>(pEnd - pData))
+				return false;
+
+			const size_t nOffset = m_Data.size();
+			if (nStatus == 0xF0)
+				m_Data.push_back(0xF0);
+			m_Data.insert(m_Data.end(), pData, pData + nLength);
+			Events.push_back({nTick, NoTempo, nOffset, m_Data.size() - nOffset});
+
+			pData += nLength;
+			continue;
+		}
+
+		// Channel message; always stored with its status byte so running status isn't needed on playback
+		const size_t nDataBytes = (nStatus & 0xE0) == 0xC0 ? 1 : 2;
+		if (nDataBytes > static_cast<size_t>(pEnd - pData))
+			return false;
+
+		nRunningStatus = nStatus;
+
+		const size_t nOffset = m_Data.size();
+		m_Data.push_back(nStatus);
+		m_Data.insert(m_Data.end(), pData, pData + nDataBytes);
+		Events.push_back({nTick, NoTempo, nOffset, nDataBytes + 1});
+
+		pData += nDataBytes;
+	}
+
+	// Missing end of track; tolerated
+	return true;
+}
@@ -0,0 +1,68 @@
+//
+// midifile.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _midifile_h
+#define _midifile_h
+
+#include <vector>
+
+#include <circle/types.h>
+
+// Loads a Standard MIDI File or raw MIDI byte stream into a single list of timestamped events
+class CMIDIFile
+{
+public:
+	struct TEvent
+	{
+		u64 nTimeMicros;
+		size_t nOffset;
+		size_t nSize;
+	};
+
+	// Raw streams are timed as if received over a 31250 baud MIDI cable
+	static constexpr u64 RawByteMicros = 320;
+
+	bool LoadSMF(const char* pPath);
+	bool LoadRaw(const char* pPath);
+
+	const std::vector<TEvent>& GetEvents() const { return m_Events; }
+	const u8* GetEventData(const TEvent& Event) const { return m_Data.data() + Event.nOffset; }
+	u64 GetLengthMicros() const { return m_Events.empty() ? 0 : m_Events.back().nTimeMicros; }
+
+private:
+	struct TTrackEvent
+	{
+		u64 nTick;
+		u32 nTempo;
+		size_t nOffset;
+		size_t nSize;
+	};
+
+	static bool ReadFile(const char* pPath, std::vector<u8>& Buffer);
+	bool ParseTrack(const u8* pData, size_t nSize, std::vector<TTrackEvent>& Events);
+
+	std::vector<u8> m_Data;
+	std::vector<TEvent> m_Events;
+};
+
+#endif
@@ -0,0 +1,203 @@
+//
+// parsebench.cpp - compares batched and per-message MIDI parsing
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+#include <vector>
+
+#include <circle/logger.h>
+
+#include "midiparser.h"
+#include "synth/midicommandqueue.h"
+#include "utility.h"
+
+// Bytes handed to the parser at a time, as the MIDI core reads them from an input
+constexpr size_t ChunkSize = 256;
+
+// Each stream is timed this many times and the fastest run is kept
+constexpr unsigned Runs = 5;
+
+static u64 GetWallNanos()
+{
+	timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return static_cast<u64>(Time.tv_sec) * 1000000000 + Time.tv_nsec;
+}
+
+// The per-message path: every message is a virtual call and a queue operation of its own
+class CCallbackParser final : public CMIDIParser
+{
+public:
+	CCallbackParser(CMIDICommandQueue& Queue) : m_Queue(Queue), m_nTimestamp(0) {}
+
+	void Parse(const u8* pData, size_t nSize, u32 nTimestamp)
+	{
+		m_nTimestamp = nTimestamp;
+		ParseMIDIBytes(pData, nSize);
+	}
+
+protected:
+	virtual void OnShortMessage(u32 nMessage) override { m_Queue.EnqueueShortMessage(nMessage, m_nTimestamp); }
+	virtual void OnSysExMessage(const u8* pData, size_t nSize) override { m_Queue.EnqueueSysExMessage(pData, nSize, m_nTimestamp); }
+
+private:
+	CMIDICommandQueue& m_Queue;
+	u32 m_nTimestamp;
+};
+
+// The batched path; the test streams have no SysEx, so each batch is one run of short messages
+class CBatchParser final : public CMIDIParser
+{
+public:
+	CBatchParser(CMIDICommandQueue& Queue) : m_Queue(Queue) {}
+
+	void Parse(const u8* pData, size_t nSize, u32 nTimestamp)
+	{
+		while (nSize)
+		{
+			const size_t nParsed = ParseMIDIBytes(pData, nSize, nTimestamp, m_Batch);
+			pData += nParsed;
+			nSize -= nParsed;
+
+			m_Queue.EnqueueShortMessages(m_Batch.Messages, m_Batch.Timestamps, m_Batch.nMessages);
+			m_Batch.Clear();
+		}
+	}
+
+private:
+	CMIDICommandQueue& m_Queue;
+	TBatch m_Batch;
+};
+
+// Controller sweeps on all 16 channels, using running status within each channel
+static std::vector<u8> MakeControllerStream(size_t nMessages)
+{
+	std::vector<u8> Stream;
+	for (size_t i = 0; i < nMessages; ++i)
+	{
+		if (i % 64 == 0)
+			Stream.push_back(0xB0 | (i / 64) % 16);
+
+		Stream.push_back(1 + i % 8);
+		Stream.push_back(i % 128);
+	}
+
+	return Stream;
+}
+
+// A pitch bend sweep on one channel, all under one running status
+static std::vector<u8> MakePitchBendStream(size_t nMessages)
+{
+	std::vector<u8> Stream{ 0xE0 };
+	for (size_t i = 0; i < nMessages; ++i)
+	{
+		const u16 nBend = (i * 37) & 0x3FFF;
+		Stream.push_back(nBend & 0x7F);
+		Stream.push_back(nBend >> 7);
+	}
+
+	return Stream;
+}
+
+// Parses the stream a chunk at a time, draining the queue in between like the audio core; only parsing and queueing is timed
+template <class T>
+static u64 TimeParser(const std::vector<u8>& Stream, u32& nChecksum)
+{
+	CMIDICommandQueue* pQueue = new CMIDICommandQueue();
+	T* pParser = new T(*pQueue);
+	u8 SysExBuffer[CMIDICommandQueue::MaxSysExSize];
+	u64 nNanos = 0;
+
+	nChecksum = 0;
+	for (size_t nOffset = 0; nOffset < Stream.size(); nOffset += ChunkSize)
+	{
+		const size_t nSize = Utility::Min(ChunkSize, Stream.size() - nOffset);
+		const u32 nTimestamp = nOffset;
+
+		const u64 nStart = GetWallNanos();
+		pParser->Parse(Stream.data() + nOffset, nSize, nTimestamp);
+		nNanos += GetWallNanos() - nStart;
+
+		CMIDICommandQueue::TCommand Command;
+		while (pQueue->Peek(Command, SysExBuffer))
+		{
+			nChecksum = nChecksum * 31 + (Command.nMessage ^ Command.nTimestamp);
+			pQueue->Pop();
+		}
+	}
+
+	delete pParser;
+	delete pQueue;
+	return nNanos;
+}
+
+static bool RunBenchmark(const char* pName, const std::vector<u8>& Stream, size_t nMessages)
+{
+	u64 nCallbackNanos = ~0ull, nBatchNanos = ~0ull;
+	u32 nCallbackChecksum = 0, nBatchChecksum = 0;
+
+	// Alternate the two so that neither gets a warmer cache or clock
+	for (unsigned i = 0; i < Runs; ++i)
+	{
+		nCallbackNanos = Utility::Min(nCallbackNanos, TimeParser<CCallbackParser>(Stream, nCallbackChecksum));
+		nBatchNanos    = Utility::Min(nBatchNanos, TimeParser<CBatchParser>(Stream, nBatchChecksum));
+	}
+
+	const double nCallbackPerMessage = static_cast<double>(nCallbackNanos) / nMessages;
+	const double nBatchPerMessage    = static_cast<double>(nBatchNanos) / nMessages;
+
+	printf("%-12s callback %6.2f ns/msg, batched %6.2f ns/msg (%.2fx)\n", pName, nCallbackPerMessage, nBatchPerMessage, nCallbackPerMessage / nBatchPerMessage);
+
+	if (nCallbackChecksum != nBatchChecksum)
+	{
+		fprintf(stderr, "%s: batched output differs from per-message output\n", pName);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 2)
+	{
+		fprintf(stderr,
+			"Usage: %s [messages]\n"
+			"\n"
+			"Compares the batched MIDI parser API against per-message callbacks on dense\n"
+			"controller and pitch bend streams, queueing into the synth MIDI queue (default: 1000000 messages).\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	CLogger Logger(LogNotice);
+
+	const size_t nMessages = argc == 2 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	if (!nMessages)
+		return EXIT_FAILURE;
+
+	bool bResult = RunBenchmark("Controllers", MakeControllerStream(nMessages), nMessages);
+	bResult &= RunBenchmark("Pitch bend", MakePitchBendStream(nMessages), nMessages);
+
+	return bResult ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,460 @@
+//
+// render.cpp - offline renderer and profiler for the mt32-pi synths
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#include <circle/logger.h>
+#include <circle/timer.h>
+
+#include "audio/audiostats.h"
+#include "config.h"
+#include "coreworker.h"
+#include "midifile.h"
+#include "midiparser.h"
+#include "synth/mt32synth.h"
+#include "synth/soundfontsynth.h"
+#include "zoneallocator.h"
+
+const char RenderName[] = "render";
+
+// Rendering continues for this long after the last event so that release tails and reverb are captured
+constexpr unsigned TailMillis = 2000;
+
+static u64 GetWallMicros()
+{
+	timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return static_cast<u64>(Time.tv_sec) * 1000000 + Time.tv_nsec / 1000;
+}
+
+// Writes interleaved stereo PCM to a WAV file; 24-bit samples are packed to 3 bytes
+class CWAVWriter
+{
+public:
+	CWAVWriter() : m_pFile(nullptr), m_nSampleRate(0), m_nSampleBytes(0), m_nDataBytes(0) {}
+	~CWAVWriter() { Close(); }
+
+	bool Open(const char* pPath)
+	{
+		m_pFile = fopen(pPath, "wb");
+		if (!m_pFile)
+			return false;
+
+		// Space for the header, which is written with the final sizes on Close()
+		return fseek(m_pFile, HeaderSize, SEEK_SET) == 0;
+	}
+
+	void SetFormat(unsigned int nSampleRate, size_t nSampleBytes)
+	{
+		m_nSampleRate  = nSampleRate;
+		m_nSampleBytes = nSampleBytes;
+	}
+
+	void Write(const s16* pSamples, size_t nFrames)
+	{
+		if (m_pFile)
+			m_nDataBytes += fwrite(pSamples, sizeof(s16), nFrames * 2, m_pFile) * sizeof(s16);
+	}
+
+	void Write(const s32* pSamples, size_t nFrames)
+	{
+		if (!m_pFile)
+			return;
+
+		for (size_t i = 0; i < nFrames * 2; ++i)
+		{
+			const u8 Packed[] = { static_cast<u8>(pSamples[i]), static_cast<u8>(pSamples[i] >> 8), static_cast<u8>(pSamples[i] >> 16) };
+			m_nDataBytes += fwrite(Packed, 1, sizeof(Packed), m_pFile);
+		}
+	}
+
+	void Close()
+	{
+		if (!m_pFile)
+			return;
+
+		fseek(m_pFile, 0, SEEK_SET);
+		WriteHeader();
+		fclose(m_pFile);
+		m_pFile = nullptr;
+	}
+
+private:
+	static constexpr size_t HeaderSize = 44;
+
+	void WriteHeader()
+	{
+		const u16 nBlockAlign = 2 * m_nSampleBytes;
+		const u32 nHeader[] = {
+			0x46464952,                 // "RIFF"
+			36 + m_nDataBytes,
+			0x45564157,                 // "WAVE"
+			0x20746d66,                 // "fmt "
+			16,
+			1 | (2 << 16),              // PCM, 2 channels
+			m_nSampleRate,
+			m_nSampleRate * nBlockAlign,
+			nBlockAlign | (static_cast<u32>(m_nSampleBytes * 8) << 16),
+			0x61746164,                 // "data"
+			m_nDataBytes
+		};
+
+		static_assert(sizeof(nHeader) == HeaderSize, "Wrong WAV header size");
+		fwrite(nHeader, sizeof(nHeader), 1, m_pFile);
+	}
+
+	FILE* m_pFile;
+	unsigned int m_nSampleRate;
+	size_t m_nSampleBytes;
+	u32 m_nDataBytes;
+};
+
+// Feeds MIDI to a synth the way the MIDI core does, and renders blocks the way the audio core does
+class CRenderer final : public CMIDIParser
+{
+public:
+	static constexpr size_t MaxBlockFrames = 8192;
+
+	CRenderer(CSynthBase& Synth, CWAVWriter& Writer, unsigned int nSampleRate, size_t nBlockFrames, bool b24Bit)
+		: m_Synth(Synth),
+		  m_Writer(Writer),
+		  m_nSampleRate(nSampleRate),
+		  m_nBlockFrames(nBlockFrames),
+		  m_b24Bit(b24Bit),
+		  m_nFrames(0),
+		  m_nStalledFrames(0),
+		  m_nPeakVoices(0),
+		  m_nRenderMicros(0)
+	{
+		m_Stats.Initialize(nBlockFrames, nSampleRate);
+	}
+
+	void Render(const CMIDIFile& MIDIFile)
+	{
+		const auto& Events = MIDIFile.GetEvents();
+		const u64 nEndFrame = (MIDIFile.GetLengthMicros() + TailMillis * 1000) * m_nSampleRate / 1000000;
+		size_t nEvent = 0;
+
+		const u64 nStartMicros = GetWallMicros();
+
+		while (m_nFrames < nEndFrame)
+		{
+			// Events that arrived while the previous block was rendering are applied to this one
+			const u64 nBlockMicros = m_nFrames * 1000000 / m_nSampleRate;
+			while (nEvent < Events.size() && Events[nEvent].nTimeMicros <= nBlockMicros)
+			{
+				QueueMIDIBytes(MIDIFile.GetEventData(Events[nEvent]), Events[nEvent].nSize);
+				++nEvent;
+			}
+
+			RenderBlock();
+		}
+
+		m_nRenderMicros = GetWallMicros() - nStartMicros;
+	}
+
+	void Report() const
+	{
+		CAudioStats::TSnapshot Stats;
+		m_Stats.GetSnapshot(Stats);
+
+		const double nAudioSeconds = static_cast<double>(m_nFrames) / m_nSampleRate;
+		const double nWallSeconds  = m_nRenderMicros / 1000000.0;
+
+		printf("Rendered %.2fs of audio in %.2fs (%.1fx realtime)\n", nAudioSeconds, nWallSeconds, nWallSeconds > 0 ? nAudioSeconds / nWallSeconds : 0.0);
+		printf("Blocks: %u x %zu frames, deadline %uus\n", Stats.nBlocks, m_nBlockFrames, Stats.nDeadlineMicros);
+		printf("Block render time: min %uus, avg %uus, max %uus (%u%% headroom at max)\n", Stats.nMinMicros, Stats.nAvgMicros, Stats.nMaxMicros, Stats.nHeadroomPercent);
+
+		printf("Block render time histogram (%% of deadline):\n");
+		for (size_t i = 0; i < CAudioStats::HistogramBuckets; ++i)
+		{
+			if (i < CAudioStats::HistogramBuckets - 1)
+				printf("  %3zu-%3zu%%: %u\n", i * 10, i * 10 + 10, Stats.Histogram[i]);
+			else
+				printf("    >100%%: %u\n", Stats.Histogram[i]);
+		}
+
+		printf("Peak voices: %u\n", m_nPeakVoices);
+		if (m_nStalledFrames)
+			printf("MIDI queue stalls: %u frames rendered early to drain the queue\n", m_nStalledFrames);
+	}
+
+private:
+	// Parses into a batch and queues each run of short messages at once, like the MIDI core
+	// Blocks are rendered without BeginBlock(), so queued MIDI isn't scheduled and needs no timestamp
+	void QueueMIDIBytes(const u8* pData, size_t nSize)
+	{
+		while (nSize)
+		{
+			const size_t nParsed = ParseMIDIBytes(pData, nSize, 0, m_Batch);
+			pData += nParsed;
+			nSize -= nParsed;
+
+			size_t i = 0;
+			while (i < m_Batch.nMessages)
+			{
+				if (m_Batch.IsSysEx(i))
+				{
+					while (!m_Synth.QueueMIDISysExMessage(m_Batch.GetSysExData(i), m_Batch.GetSysExSize(i), 0))
+						RenderStall();
+					++i;
+					continue;
+				}
+
+				size_t nRunEnd = i + 1;
+				while (nRunEnd < m_Batch.nMessages && !m_Batch.IsSysEx(nRunEnd))
+					++nRunEnd;
+
+				const size_t nQueued = m_Synth.QueueMIDIShortMessages(m_Batch.Messages + i, m_Batch.Timestamps + i, nRunEnd - i);
+				if (!nQueued)
+					RenderStall();
+				i += nQueued;
+			}
+
+			m_Batch.Clear();
+		}
+	}
+
+	void RenderBlock()
+	{
+		const u32 nStartTicks = CTimer::GetClockTicks();
+
+		if (m_b24Bit)
+			m_Synth.Render(m_Buffer24, m_nBlockFrames);
+		else
+			m_Synth.Render(m_Buffer16, m_nBlockFrames);
+
+		m_Stats.OnBlockRendered(CTimer::GetClockTicks() - nStartTicks);
+
+		if (m_b24Bit)
+			m_Writer.Write(m_Buffer24, m_nBlockFrames);
+		else
+			m_Writer.Write(m_Buffer16, m_nBlockFrames);
+
+		m_nFrames += m_nBlockFrames;
+		m_nPeakVoices = Utility::Max(m_nPeakVoices, m_Synth.GetActiveVoiceCount());
+	}
+
+	// The queue is full; render a single frame so the synth drains it, as the audio core would eventually
+	void RenderStall()
+	{
+		if (m_b24Bit)
+		{
+			m_Synth.Render(m_Buffer24, 1);
+			m_Writer.Write(m_Buffer24, 1);
+		}
+		else
+		{
+			m_Synth.Render(m_Buffer16, 1);
+			m_Writer.Write(m_Buffer16, 1);
+		}
+
+		++m_nFrames;
+		++m_nStalledFrames;
+	}
+
+	CSynthBase& m_Synth;
+	CWAVWriter& m_Writer;
+	CAudioStats m_Stats;
+	TBatch m_Batch;
+
+	unsigned int m_nSampleRate;
+	size_t m_nBlockFrames;
+	bool m_b24Bit;
+
+	u64 m_nFrames;
+	u32 m_nStalledFrames;
+	u32 m_nPeakVoices;
+	u64 m_nRenderMicros;
+
+	s16 m_Buffer16[MaxBlockFrames * 2];
+	s32 m_Buffer24[MaxBlockFrames * 2];
+};
+
+static void PrintUsage(const char* pProgram)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <input.mid> [output.wav]\n"
+		"\n"
+		"Renders a Standard MIDI File (or raw MIDI stream) offline and reports render performance.\n"
+		"\n"
+		"Options:\n"
+		"  -s, --synth mt32|soundfont  Synth to render with (default: mt32)\n"
+		"  -d, --sdcard DIR            Directory laid out like the SD card (default: sdcard)\n"
+		"  -b, --block FRAMES          Frames per block (default: chunk_size from mt32-pi.cfg)\n"
+		"  -r, --raw                   Input is a raw MIDI byte stream, timed at the MIDI baud rate\n"
+		"  -2, --24bit                 Render and write 24-bit samples (default for I2S output)\n"
+		"  -c, --cores N               FluidSynth render cores, 1 or 2 (default: 2)\n"
+		"  -v, --verbose               Show debug log messages\n",
+		pProgram);
+}
+
+int main(int argc, char* argv[])
+{
+	const option Options[] = {
+		{ "synth",   required_argument, nullptr, 's' },
+		{ "sdcard",  required_argument, nullptr, 'd' },
+		{ "block",   required_argument, nullptr, 'b' },
+		{ "raw",     no_argument,       nullptr, 'r' },
+		{ "24bit",   no_argument,       nullptr, '2' },
+		{ "cores",   required_argument, nullptr, 'c' },
+		{ "verbose", no_argument,       nullptr, 'v' },
+		{ "help",    no_argument,       nullptr, 'h' },
+		{ nullptr,   0,                 nullptr, 0   },
+	};
+
+	const char* pSynthName = "mt32";
+	const char* pSDCardPath = "sdcard";
+	size_t nBlockFrames = 0;
+	bool bRaw = false;
+	bool b24Bit = false;
+	unsigned int nCores = 2;
+	bool bVerbose = false;
+
+	int nOption;
+	while ((nOption = getopt_long(argc, argv, "s:d:b:r2c:vh", Options, nullptr)) != -1)
+	{
+		switch (nOption)
+		{
+			case 's': pSynthName = optarg; break;
+			case 'd': pSDCardPath = optarg; break;
+			case 'b': nBlockFrames = strtoul(optarg, nullptr, 10); break;
+			case 'r': bRaw = true; break;
+			case '2': b24Bit = true; break;
+			case 'c': nCores = strtoul(optarg, nullptr, 10); break;
+			case 'v': bVerbose = true; break;
+			default:
+				PrintUsage(argv[0]);
+				return nOption == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	const bool bSoundFont = !strcmp(pSynthName, "soundfont");
+	if ((!bSoundFont && strcmp(pSynthName, "mt32")) || nCores < 1 || nCores > 2 || optind >= argc || argc - optind > 2)
+	{
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	CLogger Logger(bVerbose ? LogDebug : LogNotice);
+
+	// Input and output are opened before changing into the SD card directory, so relative paths behave
+	CMIDIFile MIDIFile;
+	if (!(bRaw ? MIDIFile.LoadRaw(argv[optind]) : MIDIFile.LoadSMF(argv[optind])))
+		return EXIT_FAILURE;
+
+	CWAVWriter Writer;
+	if (argc - optind == 2 && !Writer.Open(argv[optind + 1]))
+	{
+		Logger.Write(RenderName, LogError, "Couldn't open '%s' for writing", argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+
+	if (chdir(pSDCardPath) != 0)
+	{
+		Logger.Write(RenderName, LogError, "Couldn't change into SD card directory '%s'", pSDCardPath);
+		return EXIT_FAILURE;
+	}
+
+	CConfig Config;
+	if (!Config.Initialize("mt32-pi.cfg"))
+		Logger.Write(RenderName, LogWarning, "Using default configuration");
+
+	// Same power-of-two block size and sample format the audio core would use
+	if (!nBlockFrames)
+	{
+		nBlockFrames = 1;
+		while (nBlockFrames * 4 <= static_cast<size_t>(Config.AudioChunkSize))
+			nBlockFrames *= 2;
+	}
+
+	b24Bit |= Config.AudioOutputDevice == CConfig::TAudioOutputDevice::I2SDAC;
+	Writer.SetFormat(Config.AudioSampleRate, b24Bit ? 3 : 2);
+
+	if (nBlockFrames < 1 || nBlockFrames > CRenderer::MaxBlockFrames)
+	{
+		Logger.Write(RenderName, LogError, "Block size must be between 1 and %zu frames", CRenderer::MaxBlockFrames);
+		return EXIT_FAILURE;
+	}
+
+	CZoneAllocator ZoneAllocator;
+	if (!ZoneAllocator.Initialize())
+		return EXIT_FAILURE;
+
+	// Stands in for the spare core that runs FluidSynth's extra render thread
+	CCoreWorker CoreWorker;
+	std::thread WorkerThread;
+	if (bSoundFont && nCores > 1)
+		WorkerThread = std::thread(&CCoreWorker::Run, &CoreWorker);
+
+	CSynthBase* pSynth;
+	if (bSoundFont)
+	{
+		pSynth = new CSoundFontSynth(Config.AudioSampleRate, Config.FluidSynthGain, Config.FluidSynthPolyphony, nCores, Config.FluidSynthPolyphonyGovernor);
+	}
+	else
+	{
+		CMT32Synth* pMT32Synth = new CMT32Synth(Config.AudioSampleRate, Config.MT32EmuResamplerQuality, Config.MT32EmuResamplerGovernor);
+		pSynth = pMT32Synth;
+	}
+
+	int nResult = EXIT_FAILURE;
+	if (pSynth->Initialize())
+	{
+		if (!bSoundFont && Config.MT32EmuMIDIChannels == CMT32Synth::TMIDIChannels::Alternate)
+			static_cast<CMT32Synth*>(pSynth)->SetMIDIChannels(Config.MT32EmuMIDIChannels);
+
+		CRenderer* pRenderer = new CRenderer(*pSynth, Writer, Config.AudioSampleRate, nBlockFrames, b24Bit);
+		pRenderer->Render(MIDIFile);
+		pRenderer->Report();
+		delete pRenderer;
+
+		if (bSoundFont)
+		{
+			const CSoundFontSynth* pSoundFontSynth = static_cast<CSoundFontSynth*>(pSynth);
+			printf("Voice cap: %u, culled voices: %u\n", pSoundFontSynth->GetVoiceCap(), pSoundFontSynth->GetCulledVoiceCount());
+		}
+
+		pSynth->ReportStatus();
+		Writer.Close();
+		nResult = EXIT_SUCCESS;
+	}
+	else
+		Logger.Write(RenderName, LogError, "Synth init failed; no %s present?", bSoundFont ? "SoundFonts" : "ROMs");
+
+	delete pSynth;
+
+	if (WorkerThread.joinable())
+	{
+		CoreWorker.Stop();
+		WorkerThread.join();
+	}
+
+	return nResult;
+}
@@ -0,0 +1,194 @@
+//
+// ringbench.cpp - throughput and latency of the lock-free ring buffers against the spinlocked original
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "ringbuffer.h"
+#include "spinlockringbuffer.h"
+
+// Items carry the producer number in the top byte and a sequence number below it
+constexpr u32 ProducerShift = 24;
+
+static u64 GetWallNanos()
+{
+	timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return static_cast<u64>(Time.tv_sec) * 1000000000 + Time.tv_nsec;
+}
+
+struct TItem
+{
+	u32 nSequence;
+	u32 nTimestamp; // Low bits of the enqueue time in nanoseconds
+};
+
+struct TResult
+{
+	u64 nNanos;
+	u64 nTotalLatency;
+	u32 nMaxLatency;
+	bool bInOrder;
+};
+
+// Producers enqueue nItems each, nChunk at a time; the consumer checks each producer's items arrive in order
+template <class TRing>
+static TResult RunRing(TRing& Ring, unsigned nProducers, u32 nItems, size_t nChunk)
+{
+	TResult Result = { 0, 0, 0, true };
+	std::atomic<bool> bStart(false);
+	std::vector<std::thread> Producers;
+
+	for (unsigned nProducer = 0; nProducer < nProducers; ++nProducer)
+	{
+		Producers.emplace_back([&, nProducer]
+		{
+			while (!bStart)
+				std::this_thread::yield();
+
+			TItem Items[64];
+			for (u32 nSent = 0; nSent < nItems;)
+			{
+				const size_t nCount = Utility::Min(nChunk, static_cast<size_t>(nItems - nSent));
+				const u32 nTimestamp = GetWallNanos();
+				for (size_t i = 0; i < nCount; ++i)
+					Items[i] = { nProducer << ProducerShift | (nSent + static_cast<u32>(i)), nTimestamp };
+
+				const size_t nQueued = Ring.Enqueue(Items, nCount);
+				if (!nQueued)
+					std::this_thread::yield();
+				nSent += nQueued;
+			}
+		});
+	}
+
+	std::vector<u32> NextSequence(nProducers, 0);
+	const u64 nTotal = static_cast<u64>(nProducers) * nItems;
+	u64 nReceived = 0;
+
+	const u64 nStart = GetWallNanos();
+	bStart = true;
+
+	TItem Items[64];
+	while (nReceived < nTotal)
+	{
+		const size_t nCount = Ring.Dequeue(Items, Utility::ArraySize(Items));
+		if (!nCount)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		const u32 nNow = GetWallNanos();
+		for (size_t i = 0; i < nCount; ++i)
+		{
+			const u32 nProducer = Items[i].nSequence >> ProducerShift;
+			const u32 nSequence = Items[i].nSequence & ((1 << ProducerShift) - 1);
+			Result.bInOrder &= nProducer < nProducers && nSequence == NextSequence[nProducer]++;
+
+			const u32 nLatency = nNow - Items[i].nTimestamp;
+			Result.nTotalLatency += nLatency;
+			Result.nMaxLatency = Utility::Max(Result.nMaxLatency, nLatency);
+		}
+
+		nReceived += nCount;
+	}
+
+	Result.nNanos = GetWallNanos() - nStart;
+
+	for (std::thread& Producer : Producers)
+		Producer.join();
+
+	return Result;
+}
+
+static bool Report(const char* pName, const char* pRingName, const TResult& Result, u64 nItems)
+{
+	printf("%-32s %-10s %7.2f Mitems/s, latency avg %8.1f us, max %8.1f us%s\n",
+		pName,
+		pRingName,
+		nItems * 1000.0 / Result.nNanos,
+		Result.nTotalLatency / 1000.0 / nItems,
+		Result.nMaxLatency / 1000.0,
+		Result.bInOrder ? "" : "  ** ITEMS LOST OR OUT OF ORDER **");
+
+	return Result.bInOrder;
+}
+
+// Runs the same test on a lock-free ring and on the spinlocked baseline of the same size, and reports both
+template <class TRing, class TBaselineRing>
+static bool Compare(const char* pName, TRing& Ring, TBaselineRing& BaselineRing, unsigned nProducers, u32 nItems, size_t nChunk)
+{
+	const u64 nTotal = static_cast<u64>(nProducers) * nItems;
+	const TResult Result = RunRing(Ring, nProducers, nItems, nChunk);
+	const TResult BaselineResult = RunRing(BaselineRing, nProducers, nItems, nChunk);
+
+	bool bResult = Report(pName, "lock-free", Result, nTotal);
+	bResult &= Report("", "spinlock", BaselineResult, nTotal);
+	printf("%-32s %-10s %7.2fx throughput\n", "", "", static_cast<double>(BaselineResult.nNanos) / Result.nNanos);
+
+	return bResult;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 2)
+	{
+		fprintf(stderr,
+			"Usage: %s [items]\n"
+			"\n"
+			"Measures throughput and enqueue-to-dequeue latency of the SPSC and MPSC ring buffers against the\n"
+			"spinlocked ring buffer they replaced, checking that every item arrives in order\n"
+			"(default: 2000000 items per producer).\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const u32 nItems = argc == 2 ? strtoul(argv[1], nullptr, 10) : 2000000;
+	if (!nItems || nItems >= 1 << ProducerShift)
+		return EXIT_FAILURE;
+
+	// Sized like the MIDI receive buffer and the event queue
+	auto* pSPSCRing = new CRingBuffer<TItem, 2048>();
+	auto* pMPSCRing = new CMPSCRingBuffer<TItem, 32>();
+	auto* pSPSCBaselineRing = new CSpinLockRingBuffer<TItem, 2048>();
+	auto* pMPSCBaselineRing = new CSpinLockRingBuffer<TItem, 32>();
+
+	bool bResult = true;
+	bResult &= Compare("SPSC, single items", *pSPSCRing, *pSPSCBaselineRing, 1, nItems, 1);
+	bResult &= Compare("SPSC, 64 items at a time", *pSPSCRing, *pSPSCBaselineRing, 1, nItems, 64);
+	bResult &= Compare("MPSC, 1 producer", *pMPSCRing, *pMPSCBaselineRing, 1, nItems, 1);
+	bResult &= Compare("MPSC, 3 producers", *pMPSCRing, *pMPSCBaselineRing, 3, nItems, 1);
+	bResult &= Compare("MPSC, 3 producers, 3 at a time", *pMPSCRing, *pMPSCBaselineRing, 3, nItems, 3);
+
+	delete pMPSCBaselineRing;
+	delete pSPSCBaselineRing;
+	delete pMPSCRing;
+	delete pSPSCRing;
+
+	return bResult ? EXIT_SUCCESS : EXIT_FAILURE;
+}
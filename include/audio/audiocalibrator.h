@@ -0,0 +1,69 @@
+//
+// audiocalibrator.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _audiocalibrator_h
+#define _audiocalibrator_h
+
+#include <circle/types.h>
+
+#include "synth/synthbase.h"
+
+// Measures worst-case render times at boot and picks the smallest block size that leaves enough headroom
+class CAudioCalibrator
+{
+public:
+	struct TResult
+	{
+		size_t nBlockFrames;
+		size_t nPeriods;
+	};
+
+	CAudioCalibrator(unsigned int nSampleRate, unsigned int nClockRate);
+
+	// Plays nLoadNotes notes across all channels and times the slowest block at each candidate block size
+	void Measure(CSynthBase& Synth, const char* pName, size_t nLoadNotes, bool b24Bit);
+	TResult GetResult() const;
+
+	// Results are saved along with a signature of the setup they were measured with
+	static bool Load(const char* pPath, u32 nSignature, TResult& Result);
+	static bool Save(const char* pPath, u32 nSignature, const TResult& Result);
+
+private:
+	static constexpr size_t MinBlockFrames = 32;
+	static constexpr size_t MaxBlockFrames = 1024;
+	static constexpr size_t Candidates = 6;
+
+	template <class T>
+	void Measure(CSynthBase& Synth, const char* pName, size_t nLoadNotes);
+
+	u32 GetDeadlineCycles(size_t nBlockFrames) const;
+
+	unsigned int m_nSampleRate;
+	unsigned int m_nClockRate;
+
+	// Slowest block seen at each candidate size, across all measured synths
+	u32 m_PeakCycles[Candidates];
+
+	s32 m_Buffer[MaxBlockFrames * 2];
+};
+
+#endif
@@ -0,0 +1,90 @@
+//
+// audiocapture.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _audiocapture_h
+#define _audiocapture_h
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+// Records the final output stream to a WAV file on the SD card
+// The audio core copies each block into a ring buffer which is written out by another core
+class CAudioCapture
+{
+public:
+	CAudioCapture();
+	~CAudioCapture();
+
+	// nSampleBytes is 2 for signed 16-bit samples, or 4 for signed 24-bit samples in 32-bit words
+	void Initialize(unsigned int nSampleRate, size_t nSampleBytes);
+
+	// Any core; the file is opened and closed by the next Update()
+	void Start() { __atomic_store_n(&m_bRequested, true, __ATOMIC_RELEASE); }
+	void Stop() { __atomic_store_n(&m_bRequested, false, __ATOMIC_RELEASE); }
+	bool IsRequested() const { return __atomic_load_n(&m_bRequested, __ATOMIC_ACQUIRE); }
+
+	// Audio core; never blocks, and drops capture data (not playback) if the ring buffer is full
+	void Capture(const void* pData, size_t nBytes)
+	{
+		if (__atomic_load_n(&m_bCapturing, __ATOMIC_ACQUIRE))
+			Write(pData, nBytes);
+	}
+
+	// Writer core, inside a CFileAccessGate; opens/closes the file as requested and writes out buffered audio
+	void Update();
+	void Finish();
+
+private:
+	static constexpr size_t RingBytes  = 2 * 1024 * 1024;
+	static constexpr size_t ChunkBytes = 32 * 1024;
+	static_assert(ChunkBytes / 4 * 3 % 512 == 0, "Chunks must be whole sectors once packed to 24 bits");
+
+	void Write(const void* pData, size_t nBytes);
+
+	bool Open();
+	void Close();
+	bool Drain(bool bFlush);
+	bool WriteHeader();
+
+	unsigned int m_nSampleRate;
+	size_t m_nSampleBytes;
+
+	volatile bool m_bRequested;
+	volatile bool m_bCapturing;
+
+	// Free-running indices; only the low bits address the ring
+	u8* m_pRing;
+	u32 m_nWriteIndex;
+	u32 m_nReadIndex;
+	volatile u32 m_nDroppedFrames;
+	u32 m_nDroppedFramesAtStart;
+
+	// Writer core only
+	bool m_bFileOpen;
+	FIL m_File;
+	char m_FileName[16];
+	u32 m_nDataBytes;
+	u8* m_pConvertBuffer;
+};
+
+#endif
@@ -0,0 +1,62 @@
+//
+// audioscheduler.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _audioscheduler_h
+#define _audioscheduler_h
+
+#include <circle/soundbasedevice.h>
+#include <circle/types.h>
+
+// Paces the audio core in fixed-size blocks; the core sleeps (WFE) until the sound
+// device's DMA completion interrupt signals that there is room for another block
+class CAudioScheduler
+{
+public:
+	CAudioScheduler(CSoundBaseDevice* pSound, size_t nBlockFrames, size_t nPeriods);
+
+	bool Initialize();
+
+	// Blocks until there is room for one block in the queue; returns false when woken by Stop()
+	bool WaitForBlock();
+	void Stop();
+
+	// Whether the device has drained the queue completely since it was first filled
+	bool IsUnderrun() const { return m_bPrimed && m_pSound->GetQueueFramesAvail() == 0; }
+
+	size_t GetBlockFrames() const { return m_nBlockFrames; }
+	size_t GetPeriods() const { return m_nPeriods; }
+
+	// Largest power-of-two number of frames that fits in a chunk of the given size (in samples)
+	static size_t GetBlockFramesForChunkSize(size_t nChunkSize);
+
+private:
+	static void NeedDataCallback(void* pParam);
+
+	CSoundBaseDevice* m_pSound;
+	size_t m_nBlockFrames;
+	size_t m_nPeriods;
+	bool m_bPrimed;
+
+	volatile bool m_bStopped;
+};
+
+#endif
@@ -0,0 +1,99 @@
+//
+// audiostats.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _audiostats_h
+#define _audiostats_h
+
+#include <circle/types.h>
+
+#if defined(MT32_PI_HOST)
+#include <time.h>
+#endif
+
+// Render timing and error counters; written by the audio core only, read from any core
+// Render times are wall-clock microseconds, so that load and deadline misses stay correct if the CPU clock is throttled
+class CAudioStats
+{
+public:
+	// Render time in 10% steps of the block deadline, plus one bucket for blocks that missed it
+	static constexpr size_t HistogramBuckets = 11;
+
+	struct TSnapshot
+	{
+		u32 nBlocks;
+		u32 nXruns;
+		u32 nShortWrites;
+		u32 nDeadlineMicros;
+		u32 nMinMicros;
+		u32 nAvgMicros;
+		u32 nMaxMicros;
+		u32 nLastMicros;
+		u32 nHeadroomPercent;
+		u32 Histogram[HistogramBuckets];
+	};
+
+	CAudioStats();
+
+	void Initialize(size_t nBlockFrames, unsigned int nSampleRate);
+
+	void OnBlockRendered(u32 nMicros);
+	void OnXrun() { ++m_nXruns; }
+	void OnShortWrite() { ++m_nShortWrites; }
+
+	void GetSnapshot(TSnapshot& Snapshot) const;
+
+	// Used by the audio calibrator, which runs at a known clock rate
+	// The cycle counter is per-core; must be enabled on each core that uses it
+	// Host builds count nanoseconds instead, with a nominal 1GHz clock rate
+	static void EnableCycleCounter();
+	static u32 GetCycleCount()
+	{
+		u64 nCycles;
+#if defined(MT32_PI_HOST)
+		timespec Time;
+		clock_gettime(CLOCK_MONOTONIC, &Time);
+		nCycles = static_cast<u64>(Time.tv_sec) * 1000000000 + Time.tv_nsec;
+#elif AARCH == 32
+		u32 nValue;
+		asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(nValue));
+		nCycles = nValue;
+#else
+		asm volatile("mrs %0, pmccntr_el0" : "=r"(nCycles));
+#endif
+		return static_cast<u32>(nCycles);
+	}
+
+private:
+	u32 m_nDeadlineMicros;
+	u64 m_nTotalMicros;
+
+	volatile u32 m_nBlocks;
+	volatile u32 m_nXruns;
+	volatile u32 m_nShortWrites;
+	volatile u32 m_nMinMicros;
+	volatile u32 m_nMaxMicros;
+	volatile u32 m_nAvgMicros;
+	volatile u32 m_nLastMicros;
+	volatile u32 m_Histogram[HistogramBuckets];
+};
+
+#endif
@@ -0,0 +1,231 @@
+//
+// sampleconverter.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _sampleconverter_h
+#define _sampleconverter_h
+
+#include <circle/types.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SAMPLECONVERTER_NEON
+#endif
+
+#include "utility.h"
+
+namespace SampleConverter
+{
+	constexpr float Sample16BitMax = (1 << (16 - 1)) - 1;
+	constexpr float Sample24BitMax = (1 << (24 - 1)) - 1;
+
+	// Output format traits; signed 24-bit samples are stored in the lower bits of a 32-bit word
+	template <class T>
+	struct TFormat;
+
+	// SilenceThreshold is the largest magnitude treated as silence; it covers FluidSynth's dither noise
+	template <>
+	struct TFormat<s16>
+	{
+		static constexpr float Max = Sample16BitMax;
+		static constexpr s16 SilenceThreshold = 2;
+	};
+
+	template <>
+	struct TFormat<s32>
+	{
+		static constexpr float Max = Sample24BitMax;
+		static constexpr s32 SilenceThreshold = 2 << 8;
+	};
+
+	// Scalar conversion; used for tails and on cores without NEON
+	template <class T>
+	inline void FloatToPCMScalar(T* pOutBuffer, const float* pInBuffer, size_t nSamples, float nScale)
+	{
+		constexpr float Max = TFormat<T>::Max;
+
+		for (size_t i = 0; i < nSamples; ++i)
+			pOutBuffer[i] = Utility::Clamp(pInBuffer[i] * nScale, -Max, Max);
+	}
+
+#ifdef SAMPLECONVERTER_NEON
+	// Scale, clamp and truncate 4 samples; identical results to the scalar path
+	inline int32x4_t FloatToS32x4(float32x4_t Samples, float32x4_t Scale, float32x4_t Min, float32x4_t Max)
+	{
+		Samples = vmulq_f32(Samples, Scale);
+		Samples = vmaxq_f32(vminq_f32(Samples, Max), Min);
+		return vcvtq_s32_f32(Samples);
+	}
+#endif
+
+	// Converts normalized float samples to signed integer PCM with the given gain folded into the scale factor
+	template <class T>
+	void FloatToPCM(T* pOutBuffer, const float* pInBuffer, size_t nSamples, float nGain = 1.0f);
+
+	template <>
+	inline void FloatToPCM<s16>(s16* pOutBuffer, const float* pInBuffer, size_t nSamples, float nGain)
+	{
+		const float nScale = nGain * Sample16BitMax;
+		size_t i = 0;
+
+#ifdef SAMPLECONVERTER_NEON
+		const float32x4_t Scale = vdupq_n_f32(nScale);
+		const float32x4_t Min   = vdupq_n_f32(-Sample16BitMax);
+		const float32x4_t Max   = vdupq_n_f32(Sample16BitMax);
+
+		for (; i + 8 <= nSamples; i += 8)
+		{
+			const int32x4_t Low  = FloatToS32x4(vld1q_f32(pInBuffer + i), Scale, Min, Max);
+			const int32x4_t High = FloatToS32x4(vld1q_f32(pInBuffer + i + 4), Scale, Min, Max);
+
+			// Saturating narrow to 16 bits
+			vst1q_s16(pOutBuffer + i, vcombine_s16(vqmovn_s32(Low), vqmovn_s32(High)));
+		}
+#endif
+
+		FloatToPCMScalar(pOutBuffer + i, pInBuffer + i, nSamples - i, nScale);
+	}
+
+	template <>
+	inline void FloatToPCM<s32>(s32* pOutBuffer, const float* pInBuffer, size_t nSamples, float nGain)
+	{
+		const float nScale = nGain * Sample24BitMax;
+		size_t i = 0;
+
+#ifdef SAMPLECONVERTER_NEON
+		const float32x4_t Scale = vdupq_n_f32(nScale);
+		const float32x4_t Min   = vdupq_n_f32(-Sample24BitMax);
+		const float32x4_t Max   = vdupq_n_f32(Sample24BitMax);
+
+		for (; i + 8 <= nSamples; i += 8)
+		{
+			vst1q_s32(pOutBuffer + i, FloatToS32x4(vld1q_f32(pInBuffer + i), Scale, Min, Max));
+			vst1q_s32(pOutBuffer + i + 4, FloatToS32x4(vld1q_f32(pInBuffer + i + 4), Scale, Min, Max));
+		}
+#endif
+
+		FloatToPCMScalar(pOutBuffer + i, pInBuffer + i, nSamples - i, nScale);
+	}
+
+	// Mixes pInBuffer into pOutBuffer, saturating to the output format's range
+	template <class T>
+	void MixInPlace(T* pOutBuffer, const T* pInBuffer, size_t nSamples);
+
+	template <>
+	inline void MixInPlace<s16>(s16* pOutBuffer, const s16* pInBuffer, size_t nSamples)
+	{
+		size_t i = 0;
+
+#ifdef SAMPLECONVERTER_NEON
+		for (; i + 8 <= nSamples; i += 8)
+			vst1q_s16(pOutBuffer + i, vqaddq_s16(vld1q_s16(pOutBuffer + i), vld1q_s16(pInBuffer + i)));
+#endif
+
+		for (; i < nSamples; ++i)
+			pOutBuffer[i] = Utility::Clamp(pOutBuffer[i] + pInBuffer[i], -0x8000, 0x7FFF);
+	}
+
+	template <>
+	inline void MixInPlace<s32>(s32* pOutBuffer, const s32* pInBuffer, size_t nSamples)
+	{
+		// 24-bit samples can't overflow a 32-bit sum, so just add and clamp
+		constexpr s32 Max = static_cast<s32>(Sample24BitMax);
+		size_t i = 0;
+
+#ifdef SAMPLECONVERTER_NEON
+		const int32x4_t MinVector = vdupq_n_s32(-Max);
+		const int32x4_t MaxVector = vdupq_n_s32(Max);
+
+		for (; i + 4 <= nSamples; i += 4)
+		{
+			const int32x4_t Sum = vaddq_s32(vld1q_s32(pOutBuffer + i), vld1q_s32(pInBuffer + i));
+			vst1q_s32(pOutBuffer + i, vmaxq_s32(vminq_s32(Sum, MaxVector), MinVector));
+		}
+#endif
+
+		for (; i < nSamples; ++i)
+			pOutBuffer[i] = Utility::Clamp(pOutBuffer[i] + pInBuffer[i], -Max, Max);
+	}
+
+	// Whether no sample's magnitude exceeds the output format's silence threshold
+	template <class T>
+	bool IsSilent(const T* pBuffer, size_t nSamples);
+
+	template <>
+	inline bool IsSilent<s16>(const s16* pBuffer, size_t nSamples)
+	{
+		constexpr s16 Threshold = TFormat<s16>::SilenceThreshold;
+		size_t i = 0;
+
+#ifdef SAMPLECONVERTER_NEON
+		int16x8_t Peak = vdupq_n_s16(0);
+		for (; i + 8 <= nSamples; i += 8)
+			Peak = vmaxq_s16(Peak, vqabsq_s16(vld1q_s16(pBuffer + i)));
+
+		s16 Lanes[8];
+		vst1q_s16(Lanes, Peak);
+		for (s16 nLane : Lanes)
+		{
+			if (nLane > Threshold)
+				return false;
+		}
+#endif
+
+		for (; i < nSamples; ++i)
+		{
+			if (pBuffer[i] > Threshold || pBuffer[i] < -Threshold)
+				return false;
+		}
+
+		return true;
+	}
+
+	template <>
+	inline bool IsSilent<s32>(const s32* pBuffer, size_t nSamples)
+	{
+		constexpr s32 Threshold = TFormat<s32>::SilenceThreshold;
+		size_t i = 0;
+
+#ifdef SAMPLECONVERTER_NEON
+		int32x4_t Peak = vdupq_n_s32(0);
+		for (; i + 4 <= nSamples; i += 4)
+			Peak = vmaxq_s32(Peak, vqabsq_s32(vld1q_s32(pBuffer + i)));
+
+		s32 Lanes[4];
+		vst1q_s32(Lanes, Peak);
+		for (s32 nLane : Lanes)
+		{
+			if (nLane > Threshold)
+				return false;
+		}
+#endif
+
+		for (; i < nSamples; ++i)
+		{
+			if (pBuffer[i] > Threshold || pBuffer[i] < -Threshold)
+				return false;
+		}
+
+		return true;
+	}
+}
+
+#endif
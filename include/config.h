@@ -36,6 +36,21 @@ public:
 		ENUM(MT32, mt32)                  \
 		ENUM(SoundFont, soundfont)
 
+	#define ENUM_MIDIROUTE(ENUM)       \
+		ENUM(Default, default)         \
+		ENUM(MT32, mt32)               \
+		ENUM(SoundFont, soundfont)     \
+		ENUM(SoundFont2, soundfont2)   \
+		ENUM(SoundFont3, soundfont3)   \
+		ENUM(SoundFont4, soundfont4)
+
+	// Values double as a bitmask of outputs
+	#define ENUM_MIDITHRU(ENUM) \
+		ENUM(Off, off)          \
+		ENUM(GPIO, gpio)        \
+		ENUM(USB, usb)          \
+		ENUM(All, all)
+
 	#define ENUM_AUDIOOUTPUTDEVICE(ENUM) \
 		ENUM(PWM, pwm)                   \
 		ENUM(I2SDAC, i2s)
@@ -44,6 +59,11 @@ public:
 		ENUM(None, none)               \
 		ENUM(PCM51xx, pcm51xx)
 
+	#define ENUM_AUDIOCALIBRATION(ENUM) \
+		ENUM(Off, off)                  \
+		ENUM(Boot, boot)                \
+		ENUM(Saved, saved)
+
 	#define ENUM_CONTROLSCHEME(ENUM)        \
 		ENUM(None, none)                    \
 		ENUM(SimpleButtons, simple_buttons) \
@@ -65,8 +85,11 @@ public:
 		ENUM(SSD1306I2C, ssd1306_i2c)
 
 	CONFIG_ENUM(TSystemDefaultSynth, ENUM_SYSTEMDEFAULTSYNTH);
+	CONFIG_ENUM(TMIDIRoute, ENUM_MIDIROUTE);
+	CONFIG_ENUM(TMIDIThru, ENUM_MIDITHRU);
 	CONFIG_ENUM(TAudioOutputDevice, ENUM_AUDIOOUTPUTDEVICE);
 	CONFIG_ENUM(TAudioI2CDACInit, ENUM_AUDIOI2CDACINIT);
+	CONFIG_ENUM(TAudioCalibration, ENUM_AUDIOCALIBRATION);
 	CONFIG_ENUM(TControlScheme, ENUM_CONTROLSCHEME);
 	CONFIG_ENUM(TLCDType, ENUM_LCDTYPE);
 
@@ -87,8 +110,11 @@ private:
 	static bool ParseOption(const char* pString, int* pOut, bool bHex = false);
 	static bool ParseOption(const char* pString, float* pOutFloat);
 	static bool ParseOption(const char* pString, TSystemDefaultSynth* pOut);
+	static bool ParseOption(const char* pString, TMIDIRoute* pOut);
+	static bool ParseOption(const char* pString, TMIDIThru* pOut, bool bAcceptOnOff = false);
 	static bool ParseOption(const char* pString, TAudioOutputDevice* pOut);
 	static bool ParseOption(const char* pString, TAudioI2CDACInit* pOut);
+	static bool ParseOption(const char* pString, TAudioCalibration* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuResamplerQuality* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuMIDIChannels* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuROMSet* pOut);
@@ -0,0 +1,56 @@
+//
+// coreworker.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _coreworker_h
+#define _coreworker_h
+
+#include <circle/types.h>
+
+// Runs one long-lived job at a time on an otherwise idle CPU core
+class CCoreWorker
+{
+public:
+	using TJobFunction = void (*)(void* pParam);
+
+	CCoreWorker();
+
+	// Called on the worker core; returns once stopped
+	void Run();
+	void Stop();
+
+	// Returns false if a job is already pending or running
+	bool Submit(TJobFunction pFunction, void* pParam);
+
+	// Blocks until the current job (if any) has returned
+	void Join();
+
+	static CCoreWorker* Get() { return s_pThis; }
+
+private:
+	TJobFunction m_pFunction;
+	void* m_pParam;
+	bool m_bRunning;
+
+	static CCoreWorker* s_pThis;
+};
+
+#endif
@@ -93,6 +93,6 @@ struct TEvent
 };
 
 constexpr size_t EventQueueSize = 32;
-using TEventQueue               = CRingBuffer<TEvent, EventQueueSize>;
+using TEventQueue               = CMPSCRingBuffer<TEvent, EventQueueSize>;
 
 #endif
@@ -0,0 +1,64 @@
+//
+// fileaccessgate.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _fileaccessgate_h
+#define _fileaccessgate_h
+
+#include <circle/types.h>
+
+// FatFs isn't reentrant; lets a background core use the file system while another core occasionally needs it exclusively
+class CFileAccessGate
+{
+public:
+	CFileAccessGate() : m_bSuspended(false), m_bBusy(false) {}
+
+	// Foreground core; waits for the background core to leave FatFs and keeps it out until resumed
+	void Suspend()
+	{
+		__atomic_store_n(&m_bSuspended, true, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&m_bBusy, __ATOMIC_SEQ_CST))
+			;
+	}
+
+	void Resume() { __atomic_store_n(&m_bSuspended, false, __ATOMIC_SEQ_CST); }
+
+	// Background core; file access is only allowed between a successful Enter() and Leave()
+	bool Enter()
+	{
+		// Together with the order of stores in Suspend(), guarantees that only one core is inside FatFs
+		__atomic_store_n(&m_bBusy, true, __ATOMIC_SEQ_CST);
+		if (!__atomic_load_n(&m_bSuspended, __ATOMIC_SEQ_CST))
+			return true;
+
+		Leave();
+		return false;
+	}
+
+	void Leave() { __atomic_store_n(&m_bBusy, false, __ATOMIC_SEQ_CST); }
+
+private:
+	volatile bool m_bSuspended;
+	volatile bool m_bBusy;
+};
+
+#endif
@@ -75,8 +75,8 @@ public:
 
 protected:
 	void UpdateSystem(unsigned int nTicks);
-	void UpdatePartStateText(const CMT32Synth& Synth);
-	void UpdateChannelLevels(CSynthBase& Synth);
+	void UpdatePartStateText();
+	void UpdateChannelLevels();
 	void UpdateChannelPeakLevels();
 
 	static constexpr size_t MIDIChannelCount = 16;
@@ -120,8 +120,8 @@ protected:
 	char m_SC55TextBuffer[SC55TextBufferSize];
 	u8 m_SC55PixelBuffer[SC55PixelBufferSize];
 
-	// Channel levels for all synths
-	u8 m_ChannelVelocities[MIDIChannelCount];
+	// Synth state as of the last update, and channel levels for all synths
+	TSynthState m_SynthState;
 	float m_ChannelLevels[MIDIChannelCount];
 	float m_ChannelPeakLevels[MIDIChannelCount];
 	u8 m_ChannelPeakTimes[MIDIChannelCount];
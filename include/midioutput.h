@@ -0,0 +1,127 @@
+//
+// midioutput.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _midioutput_h
+#define _midioutput_h
+
+#include <circle/serial.h>
+#include <circle/types.h>
+#include <circle/usb/usbmidi.h>
+
+#include "midiparser.h"
+#include "ringbuffer.h"
+
+// Queues complete MIDI messages for an output port without blocking; Update() later moves them to the device
+// Each message is queued whole or not at all, so messages from different sources are never interleaved
+class CMIDIOutput
+{
+public:
+	using TSysExFragment = CMIDIParser::TSysExFragment;
+
+	CMIDIOutput();
+	virtual ~CMIDIOutput() = default;
+
+	bool SendShortMessage(u32 nMessage);
+	bool SendSysExMessage(const u8* pData, size_t nSize);
+
+	// SysEx too long to queue whole is streamed a piece at a time; until its last piece, messages from other sources
+	// are refused (except System Real-Time), and if a piece doesn't fit, the message is cut short with an EOX
+	bool SendSysExFragment(const void* pSource, const u8* pData, size_t nSize, TSysExFragment Fragment);
+
+	virtual void Update() = 0;
+
+protected:
+	virtual bool QueueShortMessage(u32 nMessage) = 0;
+	virtual bool QueueSysExMessage(const u8* pData, size_t nSize) = 0;
+
+	// Must leave room for TerminateSysEx() unless bEnd is set
+	virtual bool QueueSysExFragment(const u8* pData, size_t nSize, bool bEnd) = 0;
+	virtual void TerminateSysEx() = 0;
+
+private:
+	const void* m_pStreamSource;
+	bool m_bStreamQueued;
+	bool m_bStreamFailed;
+};
+
+// GPIO MIDI output; uses running status, and feeds the serial driver's interrupt-driven transmit buffer
+class CSerialMIDIOutput : public CMIDIOutput
+{
+public:
+	CSerialMIDIOutput(CSerialDevice* pSerialDevice);
+
+	virtual void Update() override;
+
+protected:
+	virtual bool QueueShortMessage(u32 nMessage) override;
+	virtual bool QueueSysExMessage(const u8* pData, size_t nSize) override;
+	virtual bool QueueSysExFragment(const u8* pData, size_t nSize, bool bEnd) override;
+	virtual void TerminateSysEx() override;
+
+private:
+	static constexpr size_t TxBufferSize = 4096;
+
+	CSerialDevice* m_pSerialDevice;
+	u8 m_nRunningStatus;
+	CRingBuffer<u8, TxBufferSize> m_TxBuffer;
+
+	// Bytes dequeued but not yet accepted by the serial driver
+	u8 m_PendingBytes[256];
+	size_t m_nPendingOffset;
+	size_t m_nPendingSize;
+};
+
+// USB MIDI output; messages are encoded into USB-MIDI event packets as they are queued
+class CUSBMIDIOutput : public CMIDIOutput
+{
+public:
+	CUSBMIDIOutput();
+
+	virtual void Update() override;
+
+	// Must be called from the same task as Update(); queued packets are dropped while no device is set
+	void SetDevice(CUSBMIDIDevice* pDevice) { m_pDevice = pDevice; }
+
+protected:
+	virtual bool QueueShortMessage(u32 nMessage) override;
+	virtual bool QueueSysExMessage(const u8* pData, size_t nSize) override;
+	virtual bool QueueSysExFragment(const u8* pData, size_t nSize, bool bEnd) override;
+	virtual void TerminateSysEx() override;
+
+private:
+	static constexpr size_t TxBufferSize = 1024;
+
+	// USB transfers are synchronous, so send at most one full-speed bulk packet per update
+	static constexpr size_t MaxPacketsPerTransfer = 16;
+
+	void QueueSysExPackets(const u8* pData, size_t nSize, bool bEnd);
+
+	CUSBMIDIDevice* m_pDevice;
+	CRingBuffer<u32, TxBufferSize> m_TxBuffer;
+
+	// Bytes of a streamed SysEx message that didn't fill a packet yet
+	u8 m_SysExCarry[2];
+	size_t m_nSysExCarrySize;
+};
+
+#endif
@@ -28,13 +28,77 @@
 class CMIDIParser
 {
 public:
+	// Pieces of a SysEx message too long for the parser's buffer
+	enum class TSysExFragment
+	{
+		Start,
+		Continue,
+		End,
+		Abort
+	};
+
+	// Matches mt32emu's SysEx buffer size
+	static constexpr size_t SysExBufferSize = 1000;
+
+	// Messages parsed from a buffer, as parallel arrays so a consumer can handle them in one pass
+	// SysEx messages are copied into SysExData and appear in Messages as F0 with their span index in bits 8-23
+	struct TBatch
+	{
+		static constexpr size_t MaxMessages = 128;
+		static constexpr size_t MaxSysExBytes = 2 * SysExBufferSize;
+
+		struct TSysExSpan
+		{
+			u16 nOffset;
+			u16 nSize;
+		};
+
+		TBatch() : nMessages(0), nSysExSpans(0), nSysExBytes(0) {}
+
+		void Clear() { nMessages = nSysExSpans = nSysExBytes = 0; }
+		bool IsEmpty() const { return nMessages == 0; }
+
+		// Full when the next byte might not fit: each byte completes at most one message
+		bool IsFull() const { return nMessages == MaxMessages || MaxSysExBytes - nSysExBytes < SysExBufferSize; }
+
+		bool IsSysEx(size_t nIndex) const { return (Messages[nIndex] & 0xFF) == 0xF0; }
+		const u8* GetSysExData(size_t nIndex) const { return SysExData + SysExSpans[Messages[nIndex] >> 8].nOffset; }
+		size_t GetSysExSize(size_t nIndex) const { return SysExSpans[Messages[nIndex] >> 8].nSize; }
+
+		bool AddShortMessage(u32 nMessage, u32 nTimestamp);
+		bool AddSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp);
+
+		size_t nMessages;
+		u32 Messages[MaxMessages];
+		u32 Timestamps[MaxMessages];
+
+		size_t nSysExSpans;
+		TSysExSpan SysExSpans[MaxMessages];
+
+		size_t nSysExBytes;
+		u8 SysExData[MaxSysExBytes];
+	};
+
 	CMIDIParser();
 
 	void ParseMIDIBytes(const u8* pData, size_t nSize);
 
+	// Appends complete messages to a batch, stamped with nTimestamp, instead of calling OnShortMessage()/OnSysExMessage()
+	// Stops early if the batch fills up, and returns the number of bytes consumed
+	size_t ParseMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp, TBatch& Batch);
+
+	// Length of a complete short message starting with this status byte; 0 for SysEx, data and undefined bytes
+	static u8 GetShortMessageLength(u8 nStatus);
+
 protected:
-	virtual void OnShortMessage(u32 nMessage) = 0;
-	virtual void OnSysExMessage(const u8* pData, size_t nSize) = 0;
+	// Complete messages, when not parsing into a batch
+	virtual void OnShortMessage(u32 nMessage) {}
+	virtual void OnSysExMessage(const u8* pData, size_t nSize) {}
+
+	// SysEx longer than the buffer is delivered in pieces instead; the first begins with F0, the last ends with F7,
+	// and Abort means the message was cut short by a status byte; by default it's dropped with OnSysExOverflow()
+	// Fragments are never batched; a batch consumer should handle the messages before them first to keep them in order
+	virtual void OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment);
 
 	virtual void OnUnexpectedStatus();
 	virtual void OnSysExOverflow();
@@ -47,17 +111,23 @@ private:
 		SysExByte
 	};
 
-	// Matches mt32emu's SysEx buffer size
-	static constexpr size_t SysExBufferSize = 1000;
-
+	void ParseMIDIByte(u8 nByte);
 	void ParseStatusByte(u8 nByte);
 	bool CheckCompleteShortMessage();
 	u32 PrepareShortMessage() const;
 	void ResetState(bool bClearStatusByte);
 
+	void EmitShortMessage(u32 nMessage);
+	void EmitSysExMessage();
+
 	TState m_State;
 	u8 m_MessageBuffer[SysExBufferSize];
 	size_t m_nMessageLength;
+	bool m_bSysExFragmented;
+
+	// Set while parsing into a batch
+	TBatch* m_pBatch;
+	u32 m_nBatchTimestamp;
 };
 
 #endif
@@ -0,0 +1,147 @@
+//
+// midiplayer.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _midiplayer_h
+#define _midiplayer_h
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#include "synth/midicommandqueue.h"
+
+// Plays Standard MIDI Files (format 0 and 1) from the SD card
+// A reader core streams the file and merges its tracks into a ring of events timestamped in audio frames;
+// the audio core dispatches them between partial renders, so each event lands on its exact frame
+class CMIDIPlayer
+{
+public:
+	using TShortMessageHandler = void (*)(u32 nMessage);
+	using TSysExMessageHandler = void (*)(const u8* pData, size_t nSize);
+
+	static constexpr size_t MaxSysExSize = CMIDICommandQueue::MaxSysExSize;
+
+	CMIDIPlayer();
+	~CMIDIPlayer();
+
+	void Initialize(unsigned int nSampleRate, TShortMessageHandler pShortMessageHandler, TSysExMessageHandler pSysExMessageHandler);
+
+	// Any core; takes effect on the next Update()
+	// With bContinue set, the following files in the folder are played afterwards, wrapping around at the end
+	void Play(size_t nIndex, bool bContinue = false);
+	void Stop() { __atomic_store_n(&m_nRequest, StopRequest, __ATOMIC_RELEASE); }
+	bool IsPlaying() const { return __atomic_load_n(&m_State, __ATOMIC_ACQUIRE) != TState::Idle; }
+
+	// Reader core, inside a CFileAccessGate; opens files as requested and keeps the event ring topped up
+	// Returns true when a new file has started playing
+	bool Update();
+	void Finish();
+	const char* GetFileName() const { return m_FileName; }
+
+	// Audio core; dispatches the events due at the playback position, then advances it by up to nMaxFrames,
+	// stopping short at the next event; returns the number of frames to render before calling again
+	size_t Advance(size_t nMaxFrames);
+
+private:
+	enum class TState : u8
+	{
+		Idle,
+		Playing,
+		Stopping,
+	};
+
+	// Events are two words; a SysEx event is followed by its data in as many slots as it needs
+	struct TEvent
+	{
+		u32 nFrame;
+		u32 nMessage;
+	};
+
+	struct TTrack
+	{
+		u32 nNextOffset;
+		u32 nEndOffset;
+		u64 nNextTick;
+		u8 nRunningStatus;
+		bool bDone;
+
+		u16 nWindowPosition;
+		u16 nWindowSize;
+		u8 Window[512];
+	};
+
+	static constexpr size_t MaxTracks  = 64;
+	static constexpr size_t RingEvents = 4096;
+	static constexpr size_t MaxSysExEvents = 1 + (MaxSysExSize + sizeof(TEvent) - 1) / sizeof(TEvent);
+
+	static constexpr s32 NoRequest   = -1;
+	static constexpr s32 StopRequest = -2;
+
+	bool Open(size_t nIndex);
+	void Close();
+	void FillRing();
+
+	bool ReadByte(TTrack& Track, u8& nByte);
+	bool ReadVarLen(TTrack& Track, u32& nValue);
+	bool Skip(TTrack& Track, u32 nBytes);
+	void ReadDeltaTime(TTrack& Track);
+	bool ReadEvent(TTrack& Track);
+	u32 TickToFrame(u64 nTick) const;
+	void PushEvent(u32 nFrame, u32 nMessage);
+
+	void SendAllNotesOff();
+
+	unsigned int m_nSampleRate;
+	TShortMessageHandler m_pShortMessageHandler;
+	TSysExMessageHandler m_pSysExMessageHandler;
+
+	volatile s32 m_nRequest;
+	volatile bool m_bContinue;
+	volatile TState m_State;
+
+	// Free-running indices; only the low bits address the ring
+	TEvent* m_pRing;
+	u32 m_nWriteIndex;
+	u32 m_nReadIndex;
+	volatile bool m_bEndOfFile;
+
+	// Audio core only
+	u32 m_nPlaybackFrame;
+	u8 m_SysExBuffer[MaxSysExSize];
+
+	// Reader core only
+	bool m_bFileOpen;
+	FIL m_File;
+	size_t m_nFileIndex;
+	char m_FileName[FF_LFN_BUF + 1];
+	TTrack* m_pTracks;
+	size_t m_nTracks;
+
+	// Tempo map state; SMPTE files have a fixed tick length instead
+	u16 m_nDivision;
+	u32 m_nTicksPerSecond;
+	u32 m_nTempo;
+	u64 m_nTempoTick;
+	u64 m_nTempoMicros;
+};
+
+#endif
@@ -39,21 +39,31 @@
 #include <circle/usb/usbhcidevice.h>
 #include <circle/usb/usbmidi.h>
 
+#include "audio/audiocalibrator.h"
+#include "audio/audiocapture.h"
+#include "audio/audioscheduler.h"
+#include "audio/audiostats.h"
 #include "config.h"
 #include "control/control.h"
 #include "control/mister.h"
+#include "coreworker.h"
 #include "event.h"
+#include "fileaccessgate.h"
 #include "lcd/synthlcd.h"
+#include "midioutput.h"
 #include "midiparser.h"
+#include "midiplayer.h"
 #include "pisound.h"
 #include "power.h"
 #include "ringbuffer.h"
+#include "synth/midicoalescer.h"
 #include "synth/mt32romset.h"
 #include "synth/mt32synth.h"
+#include "synth/rolanddt1splitter.h"
 #include "synth/soundfontsynth.h"
 #include "synth/synth.h"
 
-class CMT32Pi : public CMultiCoreSupport, CPower, CMIDIParser
+class CMT32Pi : public CMultiCoreSupport, CPower
 {
 public:
 	CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSystem* pInterrupt, CGPIOManager* pGPIOManager, CSerialDevice* pSerialDevice, CUSBHCIDevice* pUSBHCI);
@@ -74,24 +84,103 @@ private:
 
 	static constexpr size_t MIDIRxBufferSize = 2048;
 
+	// Most bytes parsed from one MIDI input before the next input gets a turn
+	static constexpr size_t MIDIInputQuantum = 256;
+
+	// USB MIDI devices attached at once, cables per device, and cables with configurable routing
+	static constexpr size_t MaxUSBMIDIDevices = 4;
+	static constexpr size_t USBMIDICables = 16;
+	static constexpr size_t USBMIDIRoutedCables = 4;
+	static constexpr size_t USBMIDIRxBufferSize = 1024;
+
+	using TMIDIRoute = CConfig::TMIDIRoute;
+	using TMIDIThru = CConfig::TMIDIThru;
+
+	// Each MIDI input has its own parser, so running status and partial SysEx from different inputs never mix
+	class CMIDIInput final : public CMIDIParser
+	{
+	public:
+		CMIDIInput(CMT32Pi& MT32Pi, const char* pName, TMIDIRoute Route = TMIDIRoute::Default);
+
+		// Called from the main task; nTimestamp is when the bytes were received, from CTimer::GetClockTicks()
+		void ParseMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp);
+		void ParseTimestampedBytes(const u32* pData, size_t nSize);
+		void SetThru(TMIDIThru Thru) { m_Thru = Thru; }
+
+		// Packs a byte with the low 24 bits of its timestamp, for input buffered in interrupt context
+		static u32 PackTimestampedByte(u8 nByte, u32 nTimestamp) { return nByte << 24 | (nTimestamp & 0xFFFFFF); }
+
+	protected:
+		// CMIDIParser
+		virtual void OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment) override;
+		virtual void OnUnexpectedStatus() override;
+
+	private:
+		// Parses into the shared batch, dispatching it whenever it fills up
+		void AppendMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp);
+
+		static void SplitSysExHandler(const u8* pData, size_t nSize, void* pUser);
+
+		CMT32Pi& m_MT32Pi;
+		char m_Name[16];
+		TMIDIRoute m_Route;
+		TMIDIThru m_Thru;
+
+		// MT-32 bulk dumps too long for the synth are passed on as several shorter messages
+		CRolandDT1Splitter m_DT1Splitter;
+		u32 m_nTimestamp;
+	};
+
+	// A queued USB MIDI packet: up to 3 MIDI bytes, cable number, byte count, and whether it's a complete short message
+	struct TUSBMIDIPacket
+	{
+		u32 nPacket;
+		u32 nTimestamp;
+	};
+
+	// An attached USB MIDI device; packets are queued with their cable number, and SysEx on each cable is parsed separately
+	struct TUSBMIDIDevice
+	{
+		CUSBMIDIDevice* volatile pDevice;
+		unsigned nNumber;
+		CRingBuffer<TUSBMIDIPacket, USBMIDIRxBufferSize> RxBuffer;
+		CMIDIInput* pCableInputs[USBMIDICables];
+	};
+
 	// CPower
 	virtual void OnEnterPowerSavingMode() override;
 	virtual void OnExitPowerSavingMode() override;
 	virtual void OnThrottleDetected() override;
 	virtual void OnUnderVoltageDetected() override;
 
-	// CMIDIParser
-	virtual void OnShortMessage(u32 nMessage) override;
-	virtual void OnSysExMessage(const u8* pData, size_t nSize) override;
-	virtual void OnUnexpectedStatus() override;
-	virtual void OnSysExOverflow() override;
+	// Complete messages from any MIDI input
+	void OnShortMessage(u32 nMessage, TMIDIRoute Route, u32 nTimestamp);
+	void OnSysExMessage(const u8* pData, size_t nSize, TMIDIRoute Route, u32 nTimestamp);
+	void DispatchMIDIBatch(TMIDIRoute Route, TMIDIThru Thru);
+	static u8 GetRouteBank(TMIDIRoute Route);
+	CSynthBase* GetRouteSynth(TMIDIRoute Route) const;
+	CSynthBase* GetChannelMessageSynth(u32& nMessage, TMIDIRoute Route) const;
+	CMIDICoalescer& GetMIDICoalescer(const CSynthBase* pSynth) { return pSynth == m_pMT32Synth ? m_MT32MIDICoalescer : m_SoundFontMIDICoalescer; }
+	void SendMIDIThru(TMIDIThru Thru, u32 nMessage);
+	void SendMIDIThru(TMIDIThru Thru, const u8* pData, size_t nSize);
+	void SendMIDIThru(TMIDIThru Thru, const void* pSource, const u8* pData, size_t nSize, CMIDIParser::TSysExFragment Fragment);
 
 	// Tasks for specific CPU cores
 	void MainTask();
 	void UITask();
 	void AudioTask();
+	void WaitForAudioReady();
+	template <class T> void AudioTaskLoop();
+	template <class T> void RenderDualSynth(T* pOutBuffer, T* pSoundFontBuffer, size_t nFrames);
+	void PublishSynthStates();
+	bool IsSynthActive() const;
+	bool HasQueuedMIDI() const;
 
 	void UpdateMIDI();
+	bool UpdateUSBMIDI(TUSBMIDIDevice& Device);
+	void AttachUSBMIDIDevices();
+	CUSBMIDIDevice* GetUSBMIDIOutputDevice() const;
+	void UpdateMIDIOutputs();
 	size_t ReceiveSerialMIDI(u8* pOutData, size_t nSize);
 	bool ParseCustomSysEx(const u8* pData, size_t nSize);
 
@@ -105,11 +194,18 @@ private:
 	void SwitchSoundFont(size_t nIndex);
 	void DeferSwitchSoundFont(size_t nIndex);
 	void SetMasterVolume(s32 nVolume);
+	void SetAudioCapture(bool bEnabled);
+	void PlayMIDIFile(u8 nIndex);
+
+	void SendMIDI(const u8* pData, size_t nSize);
+	void SendAudioStats();
+	void UpdateAudioStatsLCD();
 
 	void LEDOn();
 	void LCDLog(TLCDLogType Type, const char* pFormat...);
 
 	bool InitPCM51xx(u8 nAddress);
+	void CalibrateAudio(size_t& nBlockFrames, size_t& nPeriods);
 
 	CTimer* m_pTimer;
 	CActLED* m_pActLED;
@@ -138,9 +234,13 @@ private:
 	// Serial GPIO MIDI
 	bool m_bSerialMIDIAvailable;
 	bool m_bSerialMIDIEnabled;
+	CSerialMIDIOutput m_SerialMIDIOutput;
 
 	// USB MIDI
-	CUSBMIDIDevice* volatile m_pUSBMIDIDevice;
+	TUSBMIDIDevice m_USBMIDIDevices[MaxUSBMIDIDevices];
+	TMIDIRoute m_USBMIDICableRoutes[USBMIDIRoutedCables];
+	TMIDIThru m_USBMIDIThru;
+	CUSBMIDIOutput m_USBMIDIOutput;
 
 	bool m_bActiveSenseFlag;
 	unsigned m_nActiveSenseTime;
@@ -150,8 +250,28 @@ private:
 	bool m_bLEDOn;
 	unsigned m_nLEDOnTime;
 
+	// Bitmask of buttons currently held down, for button combinations; a button used in one does nothing else on release
+	u8 m_nHeldButtons;
+	bool m_bButtonComboPressed;
+
 	// Audio output
 	CSoundBaseDevice* m_pSound;
+	CAudioScheduler* m_pAudioScheduler;
+	volatile bool m_bAudioReady;
+	CAudioStats m_AudioStats;
+	volatile bool m_bShowAudioStats;
+
+	// Output recording; filled by the audio core and written to the SD card by the UI core
+	CAudioCapture m_AudioCapture;
+
+	// MIDI file playback; read from the SD card by the UI core and sequenced by the audio core
+	CMIDIPlayer m_MIDIPlayer;
+
+	// Keeps the UI core's SD card access out of the way of SoundFont loading on the main core
+	CFileAccessGate m_FileAccessGate;
+
+	// Runs FluidSynth's voice rendering thread on core 3, or the whole SoundFont synth in dual synth mode
+	CCoreWorker m_CoreWorker;
 
 	// Extra devices
 	CPisound* m_pPisound;
@@ -162,16 +282,35 @@ private:
 	CMT32Synth* m_pMT32Synth;
 	CSoundFontSynth* m_pSoundFontSynth;
 
-	// MIDI receive buffer
-	CRingBuffer<u8, MIDIRxBufferSize> m_MIDIRxBuffer;
+	// Each synth's MIDI queue is fed through one of these, so bursts are coalesced instead of dropped
+	CMIDICoalescer m_MT32MIDICoalescer;
+	CMIDICoalescer m_SoundFontMIDICoalescer;
+
+	// Dual synth mode; channels with their bit set go to the MT-32, the rest to the SoundFont synth
+	bool m_bDualSynth;
+	u16 m_nMT32ChannelMask;
+
+	// MIDI inputs; all can be used at once, and are merged a complete message at a time
+	CMIDIInput m_SerialMIDIInput;
+	CMIDIInput m_PisoundMIDIInput;
+	size_t m_nNextMIDIInput;
+
+	// Pisound bytes with their receive timestamps; serial data is buffered by the serial driver
+	CRingBuffer<u32, MIDIRxBufferSize> m_PisoundMIDIRxBuffer;
+
+	// Messages parsed from one input, handed to the synths together
+	CMIDIParser::TBatch m_MIDIBatch;
 
 	// Event handling
 	TEventQueue m_EventQueue;
 
 	static void EventHandler(const TEvent& Event);
 	static void USBDeviceRemovedHandler(CDevice* pDevice, void* pContext);
-	static void USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength);
-	static void MIDIReceiveHandler(const u8* pData, size_t nSize);
+	template <size_t N> static void USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength);
+	static TMIDIPacketHandler* const USBMIDIPacketHandlers[MaxUSBMIDIDevices];
+	static void PisoundMIDIReceiveHandler(const u8* pData, size_t nSize);
+	static void MIDIPlayerShortMessageHandler(u32 nMessage);
+	static void MIDIPlayerSysExMessageHandler(const u8* pData, size_t nSize);
 
 	static CMT32Pi* s_pThis;
 };
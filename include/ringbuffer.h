@@ -20,104 +20,158 @@
 // mt32-pi. If not, see <http://www.gnu.org/licenses/>.
 //
 
+
 #ifndef _ringbuffer_h
 #define _ringbuffer_h
 
-#include <circle/spinlock.h>
 #include <circle/types.h>
+#include <circle/util.h>
 
 #include "utility.h"
 
+// Storage shared by the ring buffers below; indices are free-running and only the low bits address the buffer
 template <class T, size_t N>
-class CRingBuffer
+class CRingBufferBase
 {
 public:
-	CRingBuffer()
-		: m_Lock(IRQ_LEVEL),
-		  m_nInPtr(0),
-		  m_nOutPtr(0),
-		  m_Data{0}
+	CRingBufferBase() : m_Data{} {}
+
+protected:
+	static_assert(Utility::IsPowerOfTwo(N), "Ring buffer size must be a power of 2");
+
+	static constexpr u32 BufferMask = N - 1;
+
+	// Copy in at most two segments, split where the buffer wraps around
+	void Write(u32 nIndex, const T* pItems, size_t nCount)
 	{
+		const size_t nOffset = nIndex & BufferMask;
+		const size_t nFirst = Utility::Min(nCount, N - nOffset);
+		memcpy(m_Data + nOffset, pItems, nFirst * sizeof(T));
+		memcpy(m_Data, pItems + nFirst, (nCount - nFirst) * sizeof(T));
 	}
 
-	bool Enqueue(const T& Item)
+	void Read(u32 nIndex, T* pOutItems, size_t nCount) const
 	{
-		bool bSuccess;
-		m_Lock.Acquire();
+		const size_t nOffset = nIndex & BufferMask;
+		const size_t nFirst = Utility::Min(nCount, N - nOffset);
+		memcpy(pOutItems, m_Data + nOffset, nFirst * sizeof(T));
+		memcpy(pOutItems + nFirst, m_Data, (nCount - nFirst) * sizeof(T));
+	}
 
-		bSuccess = EnqueueOne(Item);
+	T m_Data[N];
+};
 
-		m_Lock.Release();
-		return bSuccess;
-	}
+// Lock-free single-producer/single-consumer ring buffer
+// The producer may be an interrupt handler on the consumer's core; neither side ever waits
+template <class T, size_t N>
+class CRingBuffer : public CRingBufferBase<T, N>
+{
+public:
+	CRingBuffer() : m_nWriteIndex(0), m_nReadIndex(0) {}
+
+	// Producer; bulk enqueue returns the number of items that fit
+	bool Enqueue(const T& Item) { return Enqueue(&Item, 1) == 1; }
 
 	size_t Enqueue(const T* pItems, size_t nCount)
 	{
-		size_t nEnqueued = 0;
-		m_Lock.Acquire();
+		const u32 nWriteIndex = m_nWriteIndex;
+		const u32 nReadIndex = __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE);
+		nCount = Utility::Min(nCount, N - (nWriteIndex - nReadIndex));
 
-		for (size_t i = 0; i < nCount; ++i)
-		{
-			if (EnqueueOne(pItems[i]))
-				++nEnqueued;
-		}
+		this->Write(nWriteIndex, pItems, nCount);
+		__atomic_store_n(&m_nWriteIndex, nWriteIndex + nCount, __ATOMIC_RELEASE);
 
-		m_Lock.Release();
-		return nEnqueued;
+		return nCount;
 	}
 
-	bool Dequeue(T& OutItem)
+	// Producer; lets a group of items be enqueued all or nothing
+	size_t GetFreeSpace() const { return N - (m_nWriteIndex - __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE)); }
+
+	// Consumer; bulk dequeue returns the number of items dequeued
+	bool Dequeue(T& OutItem) { return Dequeue(&OutItem, 1) == 1; }
+
+	size_t Dequeue(T* pOutItems, size_t nMaxCount)
 	{
-		bool bSuccess = false;
-		m_Lock.Acquire();
+		const u32 nReadIndex = m_nReadIndex;
+		const u32 nWriteIndex = __atomic_load_n(&m_nWriteIndex, __ATOMIC_ACQUIRE);
+		const size_t nCount = Utility::Min(nMaxCount, static_cast<size_t>(nWriteIndex - nReadIndex));
 
-		if (m_nInPtr != m_nOutPtr)
-		{
-			OutItem = m_Data[m_nOutPtr++];
-			m_nOutPtr &= BufferMask;
-			bSuccess = true;
-		}
+		this->Read(nReadIndex, pOutItems, nCount);
+		__atomic_store_n(&m_nReadIndex, nReadIndex + nCount, __ATOMIC_RELEASE);
 
-		m_Lock.Release();
-		return bSuccess;
+		return nCount;
 	}
 
-	size_t Dequeue(T* pOutBuffer, size_t nMaxCount)
+private:
+	u32 m_nWriteIndex;
+	u32 m_nReadIndex;
+};
+
+// Lock-free multi-producer/single-consumer ring buffer
+// Producers on any core or in interrupt context reserve space with a compare-and-swap, then mark each slot written;
+// the consumer stops at the first slot still being written, so items from one Enqueue() call stay contiguous
+template <class T, size_t N>
+class CMPSCRingBuffer : public CRingBufferBase<T, N>
+{
+public:
+	CMPSCRingBuffer() : m_nReserveIndex(0), m_nReadIndex(0), m_Written{0} {}
+
+	// Producers; bulk enqueue returns the number of items that fit
+	bool Enqueue(const T& Item) { return Enqueue(&Item, 1) == 1; }
+
+	size_t Enqueue(const T* pItems, size_t nCount)
 	{
-		size_t nDequeued = 0;
-		m_Lock.Acquire();
+		const size_t nRequested = nCount;
+		u32 nWriteIndex;
 
-		while (m_nInPtr != m_nOutPtr)
+		while (true)
 		{
-			pOutBuffer[nDequeued++] = m_Data[m_nOutPtr++];
-			m_nOutPtr &= BufferMask;
+			// Load the reserve index first; the read index loaded after it can never be behind it by more than N,
+			// but it can be ahead if the consumer and other producers moved on in between, so retry then
+			nWriteIndex = __atomic_load_n(&m_nReserveIndex, __ATOMIC_ACQUIRE);
+			const u32 nReadIndex = __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE);
+			const u32 nUsed = nWriteIndex - nReadIndex;
+			if (nUsed > N)
+				continue;
+
+			nCount = Utility::Min(nRequested, N - nUsed);
+			if (!nCount)
+				return 0;
+
+			if (__atomic_compare_exchange_n(&m_nReserveIndex, &nWriteIndex, nWriteIndex + nCount, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
 		}
 
-		m_Lock.Release();
-		return nDequeued;
+		this->Write(nWriteIndex, pItems, nCount);
+
+		// Each slot holds the index after the one last written to it
+		for (u32 i = nWriteIndex; i != nWriteIndex + nCount; ++i)
+			__atomic_store_n(&m_Written[i & this->BufferMask], i + 1, __ATOMIC_RELEASE);
+
+		return nCount;
 	}
 
-private:
-	static_assert(Utility::IsPowerOfTwo(N), "Ring buffer size must be a power of 2");
+	// Consumer; bulk dequeue returns the number of items dequeued
+	bool Dequeue(T& OutItem) { return Dequeue(&OutItem, 1) == 1; }
 
-	inline bool EnqueueOne(const T& Item)
+	size_t Dequeue(T* pOutItems, size_t nMaxCount)
 	{
-		if (((m_nInPtr + 1) & BufferMask) != m_nOutPtr)
-		{
-			m_Data[m_nInPtr++] = Item;
-			m_nInPtr &= BufferMask;
-			return true;
-		}
+		const u32 nReadIndex = m_nReadIndex;
+		size_t nCount = 0;
 
-		return false;
-	}
+		while (nCount < nMaxCount && __atomic_load_n(&m_Written[(nReadIndex + nCount) & this->BufferMask], __ATOMIC_ACQUIRE) == nReadIndex + nCount + 1)
+			++nCount;
 
-	static constexpr size_t BufferMask = N - 1;
+		this->Read(nReadIndex, pOutItems, nCount);
+		__atomic_store_n(&m_nReadIndex, nReadIndex + nCount, __ATOMIC_RELEASE);
 
-	CSpinLock m_Lock;
-	volatile size_t m_nInPtr;
-	volatile size_t m_nOutPtr;
-	T m_Data[N];
+		return nCount;
+	}
+
+private:
+	u32 m_nReserveIndex;
+	u32 m_nReadIndex;
+	u32 m_Written[N];
 };
 
 #endif
@@ -0,0 +1,69 @@
+//
+// seqlock.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _seqlock_h
+#define _seqlock_h
+
+#include <circle/types.h>
+#include <circle/util.h>
+
+// Publishes a copy of a small struct from one writer core to any number of reader cores without locking
+// Readers retry if they raced with a write; the writer never waits
+template <class T>
+class CSeqLock
+{
+public:
+	CSeqLock() : m_nSequence(0), m_Value{} {}
+
+	// Single writer only
+	void Write(const T& Value)
+	{
+		const u32 nSequence = m_nSequence;
+
+		// An odd sequence number marks a write in progress
+		__atomic_store_n(&m_nSequence, nSequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memcpy(&m_Value, &Value, sizeof(T));
+		__atomic_store_n(&m_nSequence, nSequence + 2, __ATOMIC_RELEASE);
+	}
+
+	void Read(T& OutValue) const
+	{
+		u32 nSequence;
+
+		do
+		{
+			while ((nSequence = __atomic_load_n(&m_nSequence, __ATOMIC_ACQUIRE)) & 1)
+				;
+
+			memcpy(&OutValue, &m_Value, sizeof(T));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		} while (__atomic_load_n(&m_nSequence, __ATOMIC_RELAXED) != nSequence);
+	}
+
+private:
+	u32 m_nSequence;
+	T m_Value;
+};
+
+#endif
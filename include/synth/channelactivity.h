@@ -0,0 +1,58 @@
+//
+// channelactivity.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _channelactivity_h
+#define _channelactivity_h
+
+#include <circle/types.h>
+
+// Per-channel note state, updated by the audio core as MIDI is applied to a synth
+// Replaces scanning the synth's voices when its state is published
+class CChannelActivity
+{
+public:
+	static constexpr size_t Channels = 16;
+
+	CChannelActivity();
+
+	// Called on the audio core with the synth lock held
+	void ProcessShortMessage(u32 nMessage);
+	void Reset();
+
+	// Highest velocity among held notes on a channel, or 0 if none
+	u8 GetVelocity(u8 nChannel) const { return m_MaxVelocities[nChannel]; }
+
+private:
+	static constexpr size_t Notes = 128;
+
+	void NoteOn(u8 nChannel, u8 nNote, u8 nVelocity);
+	void NoteOff(u8 nChannel, u8 nNote);
+	void AllNotesOff(u8 nChannel);
+
+	// Velocity of each held note (0 when released), and number of held notes per channel
+	u8 m_NoteVelocities[Channels][Notes];
+	u8 m_nHeldNotes[Channels];
+	u8 m_MaxVelocities[Channels];
+};
+
+#endif
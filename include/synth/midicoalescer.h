@@ -0,0 +1,77 @@
+//
+// midicoalescer.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _midicoalescer_h
+#define _midicoalescer_h
+
+#include <circle/types.h>
+
+class CSynthBase;
+
+// Sits in front of a synth's MIDI queue on the MIDI core, so that a flood of MIDI can't overflow it
+// While the queue is nearly full, controller, pitch bend and aftertouch values are held back, and a newer value for the
+// same channel and controller replaces the held one; notes, SysEx and everything else wait up to one audio block for room
+class CMIDICoalescer
+{
+public:
+	CMIDICoalescer();
+
+	void SetSynth(CSynthBase* pSynth) { m_pSynth = pSynth; }
+
+	// The audio core empties the queue once per block, so there's no point waiting longer than one for room
+	void SetMaxWait(unsigned nMaxWaitMicros) { m_nMaxWaitMicros = nMaxWaitMicros; }
+
+	// Return false if the queue had no room for a whole audio block
+	bool QueueShortMessage(u32 nMessage, u32 nTimestamp);
+	bool QueueShortMessages(const u32* pMessages, const u32* pTimestamps, size_t nCount);
+	bool QueueSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp, u8 nBank = 0);
+
+	// Called from the main loop; passes on held values once the queue has room, or they've been held too long
+	void Update();
+	void Discard() { m_nHeldMessages = 0; }
+
+private:
+	static constexpr size_t MaxHeldMessages = 64;
+
+	// About a quarter of the queue, or 170 short messages
+	static constexpr size_t PressureFreeSpace = 2048;
+
+	static constexpr unsigned MaxHoldMicros = 10000;
+
+	static bool IsCoalescible(u32 nMessage);
+	bool IsUnderPressure() const;
+
+	bool Hold(u32 nMessage, u32 nTimestamp);
+	bool FlushHeld(bool bWait);
+	bool KeepWaiting(u32 nStartTicks) const;
+
+	CSynthBase* m_pSynth;
+	unsigned m_nMaxWaitMicros;
+
+	u32 m_HeldMessages[MaxHeldMessages];
+	u32 m_HeldTimestamps[MaxHeldMessages];
+	size_t m_nHeldMessages;
+	u32 m_nHoldStartTicks;
+};
+
+#endif
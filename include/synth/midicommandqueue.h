@@ -0,0 +1,89 @@
+//
+// midicommandqueue.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _midicommandqueue_h
+#define _midicommandqueue_h
+
+#include <circle/types.h>
+#include <circle/util.h>
+
+// Lock-free single-producer/single-consumer queue of MIDI messages
+// Producer is the MIDI (main) core, consumer is the audio core
+class CMIDICommandQueue
+{
+public:
+	static constexpr size_t MaxSysExSize = 1024;
+	static constexpr size_t BufferSize = 8192;
+
+	struct TCommand
+	{
+		u32 nMessage; // For SysEx, only the top byte is used, as for short messages it selects a set of 16 channels
+		u32 nTimestamp; // Microseconds; when the message was received
+		size_t nSysExSize; // Non-zero if this is a SysEx message
+		const u8* pSysExData;
+	};
+
+	CMIDICommandQueue();
+
+	// Producer
+	bool EnqueueShortMessage(u32 nMessage, u32 nTimestamp);
+	bool EnqueueSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp, u8 nBank = 0);
+	size_t EnqueueShortMessages(const u32* pMessages, const u32* pTimestamps, size_t nCount);
+	void Discard();
+	size_t GetFreeSpace() const { return BufferSize - (m_nWriteIndex - __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE)); }
+
+	// Consumer; pSysExBuffer must hold at least MaxSysExSize bytes
+	// Peek() returns the oldest command without removing it, so it can be left for a later block; SysEx that doesn't
+	// wrap around the buffer is read in place, and stays valid until Pop()
+	bool Peek(TCommand& Command, u8* pSysExBuffer);
+	void Pop();
+	bool IsEmpty() const { return __atomic_load_n(&m_nWriteIndex, __ATOMIC_ACQUIRE) == m_nReadIndex; }
+
+private:
+	// Records are an 8-byte header (SysEx size with the channel bank in the top byte, or 0 for a short message,
+	// then the timestamp) followed by a payload padded to 4 bytes
+	static constexpr size_t HeaderSize = 2 * sizeof(u32);
+	static constexpr u32 HeaderSizeMask = 0xFFFFFF;
+
+	bool Enqueue(u32 nSize, u32 nTimestamp, const void* pData, size_t nDataSize);
+	void Write(u32 nIndex, const void* pData, size_t nSize);
+	void WriteWord(u32 nIndex, u32 nWord) { memcpy(m_Buffer + (nIndex & (BufferSize - 1)), &nWord, sizeof(nWord)); }
+	void Read(u32 nIndex, void* pOutData, size_t nSize) const;
+
+	static constexpr u32 GetRecordSize(size_t nPayloadSize) { return HeaderSize + ((nPayloadSize + 3) & ~3); }
+
+	// Free-running indices; only the low bits address the buffer
+	u32 m_nWriteIndex;
+	u32 m_nReadIndex;
+
+	// Size of the record returned by the last Peek(), released to the producer by Pop()
+	u32 m_nPeekedSize;
+
+	// Set by the producer to ask the consumer to drop everything up to m_nDiscardIndex
+	u32 m_nDiscardIndex;
+	u32 m_nDiscardSequence;
+	u32 m_nLastDiscardSequence;
+
+	alignas(4) u8 m_Buffer[BufferSize];
+};
+
+#endif
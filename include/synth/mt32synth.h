@@ -49,19 +49,15 @@ public:
 	CONFIG_ENUM(TResamplerQuality, ENUM_RESAMPLERQUALITY);
 	CONFIG_ENUM(TMIDIChannels, ENUM_MIDICHANNELS);
 
-	CMT32Synth(unsigned nSampleRate, TResamplerQuality ResamplerQuality);
+	CMT32Synth(unsigned nSampleRate, TResamplerQuality ResamplerQuality, bool bResamplerGovernor = false);
 	virtual ~CMT32Synth();
 
 	// CSynthBase
 	virtual bool Initialize() override;
-	virtual void HandleMIDIShortMessage(u32 nMessage) override;
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) override;
 	virtual bool IsActive() override { return m_pSynth->isActive(); }
+	virtual u32 GetActiveVoiceCount() override;
 	virtual void AllSoundOff() override;
 	virtual void SetMasterVolume(u8 nVolume) override;
-	virtual size_t Render(s16* pBuffer, size_t nFrames) override;
-	virtual size_t Render(float* pBuffer, size_t nFrames) override;
-	virtual u8 GetChannelVelocities(u8* pOutVelocities, size_t nMaxChannels) override;
 	virtual void ReportStatus() const override;
 
 	void SetMIDIChannels(TMIDIChannels Channels);
@@ -72,6 +68,17 @@ public:
 
 	u8 GetMasterVolume() const;
 
+	static const char* GetResamplerQualityName(TResamplerQuality Quality);
+
+protected:
+	// CSynthBase
+	virtual void HandleMIDIShortMessage(u32 nMessage, size_t nFrameOffset) override;
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, u8 nBank, size_t nFrameOffset) override;
+	virtual void UpdateState(TSynthState& State) override;
+	virtual void RenderSubBlock(s16* pBuffer, size_t nFrames) override;
+	virtual void RenderSubBlock(s32* pBuffer, size_t nFrames) override;
+	virtual void RenderSubBlock(float* pBuffer, size_t nFrames) override;
+
 private:
 	// ReportHandler
 	virtual bool onMIDIQueueOverflow() override;
@@ -82,11 +89,41 @@ private:
 	static const u8 StandardMIDIChannelsSysEx[];
 	static const u8 AlternateMIDIChannelsSysEx[];
 
+	// Parts 1-8 and the rhythm part
+	static constexpr size_t PartCount = 9;
+
+	static constexpr size_t ResamplerQualityLevels = static_cast<size_t>(TResamplerQuality::Best) + 1;
+
+	template <class T>
+	void RenderResampled(T* pOutBuffer, size_t nFrames);
+	template <class T>
+	void RenderHandover(T* pOutBuffer, size_t nFrames);
+	u32 GetSynthTimestamp(size_t nFrameOffset) const;
+	void UpdatePartChannels();
+	void UpdateResamplerGovernor(u32 nMicros, size_t nFrames);
+	void SetActiveResamplerQuality(TResamplerQuality Quality);
+
 	MT32Emu::Synth* m_pSynth;
 
+	// Configured (maximum) quality and the quality currently in use
 	TResamplerQuality m_ResamplerQuality;
+	TResamplerQuality m_ActiveResamplerQuality;
 	MT32Emu::SampleRateConverter* m_pSampleRateConverter;
 
+	// Resampler quality governor; keeps one converter per quality level so switching never allocates
+	bool m_bResamplerGovernor;
+	MT32Emu::SampleRateConverter* m_pSampleRateConverters[ResamplerQualityLevels];
+	MT32Emu::SampleRateConverter* m_pPreviousSampleRateConverter;
+	size_t m_nHandoverPosition;
+	u32 m_nGovernorMicros;
+	u32 m_nGovernorFrames;
+	u32 m_nGovernorQuietWindows;
+	u32 m_nGovernorStepUpWindows;
+
+	// MIDI channel assigned to each part, refreshed by the audio core after SysEx
+	u8 m_PartChannels[PartCount];
+	volatile bool m_bPartChannelsChanged;
+
 	CROMManager m_ROMManager;
 	TMT32ROMSet m_CurrentROMSet;
 	const MT32Emu::ROMImage* m_pControlROMImage;
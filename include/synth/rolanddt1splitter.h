@@ -0,0 +1,67 @@
+//
+// rolanddt1splitter.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _rolanddt1splitter_h
+#define _rolanddt1splitter_h
+
+#include <circle/types.h>
+
+#include "midiparser.h"
+
+// Splits an MT-32 DT1 (data set) message that is too long for the synth's SysEx buffer into shorter DT1 messages as its
+// fragments arrive, advancing the address and recomputing the checksum of each
+class CRolandDT1Splitter
+{
+public:
+	using TMessageHandler = void (*)(const u8* pData, size_t nSize, void* pUser);
+
+	CRolandDT1Splitter(TMessageHandler pHandler, void* pUser);
+
+	// Takes the fragments of one message in order; returns false if it isn't an MT-32 DT1 message, or if its checksum
+	// turns out to be wrong once the last fragment arrives (by which time all but the last piece have been passed on)
+	bool OnSysExFragment(const u8* pData, size_t nSize, CMIDIParser::TSysExFragment Fragment);
+	bool IsSplitting() const { return m_bSplitting; }
+
+private:
+	// The same as the MT-32's own bulk dumps
+	static constexpr size_t MaxDataBytes = 256;
+
+	// F0, manufacturer, device, model, command and a 3-byte address
+	static constexpr size_t HeaderSize = 8;
+
+	void AddBytes(const u8* pData, size_t nSize);
+	void Emit(size_t nDataBytes);
+
+	TMessageHandler m_pHandler;
+	void* m_pUser;
+
+	bool m_bSplitting;
+	u32 m_nAddress;
+	u8 m_nSum;
+
+	// Header and pending data; one byte more is kept than is sent, as the last one may turn out to be the checksum
+	size_t m_nDataBytes;
+	u8 m_Message[HeaderSize + MaxDataBytes + 2];
+};
+
+#endif
@@ -28,6 +28,7 @@
 
 enum class TRolandModelID : u8
 {
+	MT32 = 0x16,
 	GS   = 0x42,
 	SC55 = 0x45
 };
@@ -33,27 +33,41 @@
 class CSoundFontSynth : public CSynthBase
 {
 public:
-	CSoundFontSynth(unsigned nSampleRate, float nGain = 0.2f, u32 nPolyphony = 256);
+	CSoundFontSynth(unsigned nSampleRate, float nGain = 0.2f, u32 nPolyphony = 256, unsigned int nCPUCores = 2, bool bPolyphonyGovernor = false, unsigned int nMIDIChannels = 16);
 	virtual ~CSoundFontSynth() override;
 
 	// CSynthBase
 	virtual bool Initialize() override;
-	virtual void HandleMIDIShortMessage(u32 nMessage) override;
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) override;
 	virtual bool IsActive() override;
+	virtual u32 GetActiveVoiceCount() override;
 	virtual void AllSoundOff() override;
 	virtual void SetMasterVolume(u8 nVolume) override;
-	virtual size_t Render(s16* pOutBuffer, size_t nFrames) override;
-	virtual size_t Render(float* pOutBuffer, size_t nFrames) override;
-	virtual u8 GetChannelVelocities(u8* pOutVelocities, size_t nMaxChannels) override;
 	virtual void ReportStatus() const override;
 
 	bool SwitchSoundFont(size_t nIndex);
 	size_t GetSoundFontIndex() const { return m_nCurrentSoundFontIndex; }
 	CSoundFontManager& GetSoundFontManager() { return m_SoundFontManager; }
 
+	// Polyphony governor statistics
+	u32 GetVoiceCap() const { return m_nVoiceCap; }
+	u32 GetCulledVoiceCount() const { return m_nCulledVoices; }
+
+protected:
+	// CSynthBase
+	virtual void HandleMIDIShortMessage(u32 nMessage, size_t nFrameOffset) override;
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, u8 nBank, size_t nFrameOffset) override;
+	virtual void UpdateState(TSynthState& State) override;
+	virtual void RenderSubBlock(s16* pOutBuffer, size_t nFrames) override;
+	virtual void RenderSubBlock(s32* pOutBuffer, size_t nFrames) override;
+	virtual void RenderSubBlock(float* pOutBuffer, size_t nFrames) override;
+
 private:
 	bool Reinitialize(const char* pSoundFontPath);
+	void ResetChannels(u8 nBank);
+
+	void EnforceVoiceCap();
+	bool IsCulledVoice(fluid_voice_t* pVoice, unsigned int nID, size_t nFirst);
+	void UpdatePolyphonyGovernor(u32 nMicros, size_t nFrames);
 
 	fluid_settings_t* m_pSettings;
 	fluid_synth_t* m_pSynth;
@@ -62,8 +76,32 @@ private:
 	float m_nCurrentGain;
 
 	u32 m_nPolyphony;
+	unsigned int m_nCPUCores;
+	unsigned int m_nMIDIChannels;
 	size_t m_nCurrentSoundFontIndex;
 
+	// Polyphony governor; lowers the voice cap while render time approaches the deadline
+	bool m_bPolyphonyGovernor;
+	u32 m_nGovernorMicros;
+	u32 m_nGovernorFrames;
+	u32 m_nGovernorQuietWindows;
+	u32 m_nGovernorStepUpWindows;
+	volatile u32 m_nVoiceCap;
+	volatile u32 m_nCulledVoices;
+
+	// Voice cap enforcement; sized for the polyphony at init so the audio core never allocates
+	fluid_voice_t** m_pVoiceList;
+	u64* m_pVoicePriorities;
+
+	// Voices culled and still fading out; FluidSynth reuses voices and all of a note's voices share its ID, so both are kept
+	struct TCulledVoice
+	{
+		fluid_voice_t* pVoice;
+		unsigned int nID;
+	};
+	TCulledVoice* m_pCulledVoiceList;
+	size_t m_nCulledVoiceListSize;
+
 	CSoundFontManager m_SoundFontManager;
 
 	static void FluidSynthLogCallback(int nLevel, const char* pMessage, void* pUser);
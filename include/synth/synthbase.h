@@ -26,36 +26,210 @@
 #include <circle/synchronize.h>
 #include <circle/types.h>
 
+#include "synth/channelactivity.h"
+#include "seqlock.h"
+#include "synth/midicommandqueue.h"
+#include "synth/mt32romset.h"
+#include "utility.h"
+
 class CSynthLCD;
 
+// Published by the audio core after every block; other cores read this instead of querying the synth
+struct TSynthState
+{
+	bool bActive;
+	u32 nActiveVoices; // Sounding voices (FluidSynth) or partials (mt32emu)
+	u8 nMasterVolume;
+	u8 nChannels; // Entries used in ChannelVelocities; parts for mt32emu, MIDI channels for FluidSynth
+	u8 ChannelVelocities[16];
+
+	// mt32emu
+	u32 nPartStates;
+	TMT32ROMSet ROMSet;
+	u8 nResamplerQuality; // CMT32Synth::TResamplerQuality in use, as lowered by the governor
+
+	// FluidSynth
+	size_t nSoundFontIndex;
+	u32 nVoiceCap;
+	u32 nCulledVoices;
+};
+
 class CSynthBase
 {
 public:
 	CSynthBase(unsigned int nSampleRate)
 		: m_Lock(TASK_LEVEL),
 		  m_nSampleRate(nSampleRate),
-		  m_pLCD(nullptr)
+		  m_pLCD(nullptr),
+		  m_bScheduling(false),
+		  m_nBlockTicks(0),
+		  m_nScheduleBaseTicks(0),
+		  m_nBlockFrames(0),
+		  m_nBlockPosition(0)
 	{
 	}
 
 	virtual ~CSynthBase() = default;
 
 	virtual bool Initialize() = 0;
-	virtual void HandleMIDIShortMessage(u32 nMessage) = 0;
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) = 0;
 	virtual bool IsActive() = 0;
+	virtual u32 GetActiveVoiceCount() = 0; // Sounding voices (FluidSynth) or partials (mt32emu)
 	virtual void AllSoundOff() = 0;
 	virtual void SetMasterVolume(u8 nVolume) = 0;
-	virtual size_t Render(s16* pOutBuffer, size_t nFrames) = 0;
-	virtual size_t Render(float* pOutBuffer, size_t nFrames) = 0;
-	virtual u8 GetChannelVelocities(u8* pOutVelocities, size_t nMaxChannels) = 0;
 	virtual void ReportStatus() const = 0;
 	void SetLCD(CSynthLCD* pLCD) { m_pLCD = pLCD; }
 
+	// MIDI is queued by the MIDI core with the time it was received (in microseconds), and applied by the audio core
+	// Bits 24-31 of a short message select a set of 16 channels beyond the first, for synths that have them
+	// QueueMIDIShortMessages() queues a run of short messages at once, and returns how many fitted
+	bool QueueMIDIShortMessage(u32 nMessage, u32 nTimestamp) { return m_MIDIQueue.EnqueueShortMessage(nMessage, nTimestamp); }
+	bool QueueMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp, u8 nBank = 0) { return m_MIDIQueue.EnqueueSysExMessage(pData, nSize, nTimestamp, nBank); }
+	size_t QueueMIDIShortMessages(const u32* pMessages, const u32* pTimestamps, size_t nCount) { return m_MIDIQueue.EnqueueShortMessages(pMessages, pTimestamps, nCount); }
+	void DiscardQueuedMIDI() { m_MIDIQueue.Discard(); }
+	size_t GetMIDIQueueFreeSpace() const { return m_MIDIQueue.GetFreeSpace(); }
+
+	// Called on the audio core before rendering each block, with the time it started
+	// Queued MIDI is then played one block late, at the same point in the block as it arrived after the previous one
+	// started; this adds up to a block of latency, but keeps the spacing between messages instead of bunching them up
+	void BeginBlock(u32 nTicks, size_t nFrames)
+	{
+		const u32 nBlockMicros = static_cast<u64>(nFrames) * 1000000 / m_nSampleRate;
+
+		// After a gap in rendering (idle, or the other synth was playing), only look back one block
+		const u32 nElapsed = nTicks - m_nBlockTicks;
+		const bool bContinuous = m_bScheduling && nElapsed > 0 && nElapsed <= 2 * nBlockMicros;
+		m_nScheduleBaseTicks = bContinuous ? m_nBlockTicks : nTicks - Utility::Max(nBlockMicros, 1u);
+		m_nBlockTicks = nTicks;
+		m_nBlockFrames = nFrames;
+		m_nBlockPosition = 0;
+		m_bScheduling = true;
+	}
+
+	// Called on the audio core; whether MIDI is waiting to be applied by the next Render()
+	bool HasQueuedMIDI() const { return !m_MIDIQueue.IsEmpty(); }
+
+	// Called on the audio core between Render() calls; applies MIDI immediately, bypassing the queue
+	void SendMIDIShortMessage(u32 nMessage)
+	{
+		m_Lock.Acquire();
+		m_ChannelActivity.ProcessShortMessage(nMessage);
+		HandleMIDIShortMessage(nMessage, 0);
+		m_Lock.Release();
+	}
+
+	void SendMIDISysExMessage(const u8* pData, size_t nSize)
+	{
+		m_Lock.Acquire();
+		HandleMIDISysExMessage(pData, nSize, 0, 0);
+		m_Lock.Release();
+	}
+
+	// Called on the audio core after each block, so the render lock is only ever contended by control changes
+	void PublishState()
+	{
+		TSynthState State{};
+
+		m_Lock.Acquire();
+		UpdateState(State);
+		m_Lock.Release();
+
+		m_State.Write(State);
+	}
+
+	// Any core; the state as of the last published block
+	void GetState(TSynthState& OutState) const { m_State.Read(OutState); }
+
+	// Render interleaved stereo in the output device's native format; each synth picks its cheapest path
+	size_t Render(s16* pOutBuffer, size_t nFrames) { return RenderSubBlocks(pOutBuffer, nFrames); }
+	size_t Render(s32* pOutBuffer, size_t nFrames) { return RenderSubBlocks(pOutBuffer, nFrames); } // Signed 24-bit in 32-bit words
+	size_t Render(float* pOutBuffer, size_t nFrames) { return RenderSubBlocks(pOutBuffer, nFrames); }
+
 protected:
+	static constexpr size_t MIDISubBlockFrames = 64;
+
+	// Called on the audio core with m_Lock held, before rendering the sub-block the message falls in;
+	// nFrameOffset is where in that sub-block it should take effect, for synths that can schedule it; nBank selects a
+	// set of 16 channels beyond the first, like the top byte of a short message, for synths with more than 16 channels
+	virtual void HandleMIDIShortMessage(u32 nMessage, size_t nFrameOffset) = 0;
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, u8 nBank, size_t nFrameOffset) = 0;
+	virtual void UpdateState(TSynthState& State) = 0;
+
+	// Called on the audio core with m_Lock held; nFrames is never more than MIDISubBlockFrames
+	virtual void RenderSubBlock(s16* pOutBuffer, size_t nFrames) = 0;
+	virtual void RenderSubBlock(s32* pOutBuffer, size_t nFrames) = 0;
+	virtual void RenderSubBlock(float* pOutBuffer, size_t nFrames) = 0;
+
 	CSpinLock m_Lock;
 	unsigned int m_nSampleRate;
+	CChannelActivity m_ChannelActivity;
 	CSynthLCD* m_pLCD;
+
+private:
+	template <class T>
+	size_t RenderSubBlocks(T* pOutBuffer, size_t nFrames)
+	{
+		m_Lock.Acquire();
+
+		for (size_t nOffset = 0; nOffset < nFrames; nOffset += MIDISubBlockFrames)
+		{
+			const size_t nSubBlockFrames = Utility::Min(nFrames - nOffset, MIDISubBlockFrames);
+			ProcessMIDIQueue(nSubBlockFrames);
+			RenderSubBlock(pOutBuffer + nOffset * 2, nSubBlockFrames);
+			m_nBlockPosition += nSubBlockFrames;
+		}
+
+		m_Lock.Release();
+		return nFrames;
+	}
+
+	// Frame of the current block a message received at nTimestamp is due; the time between the previous and current
+	// block starts is mapped onto the block, so messages received after this block started are due in the next one
+	size_t GetScheduledFrame(u32 nTimestamp) const
+	{
+		if (!m_bScheduling)
+			return 0;
+
+		const s32 nSinceBase = nTimestamp - m_nScheduleBaseTicks;
+		if (nSinceBase <= 0)
+			return 0;
+
+		return static_cast<u64>(nSinceBase) * m_nBlockFrames / (m_nBlockTicks - m_nScheduleBaseTicks);
+	}
+
+	// Apply the queued MIDI that is due before the end of the next sub-block
+	void ProcessMIDIQueue(size_t nSubBlockFrames)
+	{
+		CMIDICommandQueue::TCommand Command;
+
+		while (m_MIDIQueue.Peek(Command, m_SysExBuffer))
+		{
+			const size_t nFrame = GetScheduledFrame(Command.nTimestamp);
+			if (nFrame >= m_nBlockPosition + nSubBlockFrames)
+				break;
+
+			const size_t nFrameOffset = nFrame > m_nBlockPosition ? nFrame - m_nBlockPosition : 0;
+			if (Command.nSysExSize)
+				HandleMIDISysExMessage(Command.pSysExData, Command.nSysExSize, Command.nMessage >> 24, nFrameOffset);
+			else
+			{
+				m_ChannelActivity.ProcessShortMessage(Command.nMessage);
+				HandleMIDIShortMessage(Command.nMessage, nFrameOffset);
+			}
+
+			m_MIDIQueue.Pop();
+		}
+	}
+
+	// Scheduling of queued MIDI within the current block
+	bool m_bScheduling;
+	u32 m_nBlockTicks;
+	u32 m_nScheduleBaseTicks;
+	size_t m_nBlockFrames;
+	size_t m_nBlockPosition;
+
+	CMIDICommandQueue m_MIDIQueue;
+	CSeqLock<TSynthState> m_State;
+	u8 m_SysExBuffer[CMIDICommandQueue::MaxSysExSize];
 };
 
 #endif
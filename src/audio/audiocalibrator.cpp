@@ -0,0 +1,171 @@
+//
+// audiocalibrator.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <fatfs/ff.h>
+#include <ini.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "audio/audiocalibrator.h"
+#include "audio/audiostats.h"
+#include "utility.h"
+
+const char AudioCalibratorName[] = "calibrator";
+
+// Fraction of each block's deadline that must be left unused in the worst case
+constexpr u32 SafetyMarginPercent = 25;
+
+// Render at least this much audio at each block size
+constexpr u32 MeasureMillis = 50;
+constexpr size_t WarmupBlocks = 2;
+
+constexpr size_t MinPeriods = 2;
+constexpr size_t SpikePeriods = 4;
+
+CAudioCalibrator::CAudioCalibrator(unsigned int nSampleRate, unsigned int nClockRate)
+	: m_nSampleRate(nSampleRate),
+	  m_nClockRate(nClockRate),
+	  m_PeakCycles{0},
+	  m_Buffer{0}
+{
+	// Cycle counter is per-core
+	CAudioStats::EnableCycleCounter();
+}
+
+void CAudioCalibrator::Measure(CSynthBase& Synth, const char* pName, size_t nLoadNotes, bool b24Bit)
+{
+	if (b24Bit)
+		Measure<s32>(Synth, pName, nLoadNotes);
+	else
+		Measure<s16>(Synth, pName, nLoadNotes);
+}
+
+template <class T>
+void CAudioCalibrator::Measure(CSynthBase& Synth, const char* pName, size_t nLoadNotes)
+{
+	CLogger* const pLogger = CLogger::Get();
+	T* const pBuffer = reinterpret_cast<T*>(m_Buffer);
+
+	for (size_t i = 0, nBlockFrames = MinBlockFrames; i < Candidates; ++i, nBlockFrames *= 2)
+	{
+		// Retrigger the load for each block size so that decaying notes don't flatter the larger sizes
+		Synth.AllSoundOff();
+		for (size_t nNote = 0; nNote < nLoadNotes; ++nNote)
+		{
+			const u8 nChannel = nNote % 16;
+			const u8 nKey     = 36 + (nNote / 16) * 5 % 60;
+			Synth.SendMIDIShortMessage(0x7F0090 | nKey << 8 | nChannel);
+		}
+
+		const size_t nBlocks = Utility::Max(static_cast<size_t>(m_nSampleRate * MeasureMillis / 1000 / nBlockFrames), static_cast<size_t>(4));
+		u32 nPeakCycles = 0;
+
+		for (size_t nBlock = 0; nBlock < WarmupBlocks + nBlocks; ++nBlock)
+		{
+			const u32 nStartCycles = CAudioStats::GetCycleCount();
+			Synth.Render(pBuffer, nBlockFrames);
+			const u32 nCycles = CAudioStats::GetCycleCount() - nStartCycles;
+
+			if (nBlock >= WarmupBlocks)
+				nPeakCycles = Utility::Max(nPeakCycles, nCycles);
+		}
+
+		m_PeakCycles[i] = Utility::Max(m_PeakCycles[i], nPeakCycles);
+
+		const u32 nLoadPercent = static_cast<u64>(nPeakCycles) * 100 / GetDeadlineCycles(nBlockFrames);
+		pLogger->Write(AudioCalibratorName, LogNotice, "%s: %4u frames: peak load %u%%", pName, static_cast<unsigned int>(nBlockFrames), nLoadPercent);
+	}
+
+	Synth.AllSoundOff();
+}
+
+CAudioCalibrator::TResult CAudioCalibrator::GetResult() const
+{
+	for (size_t i = 0, nBlockFrames = MinBlockFrames; i < Candidates; ++i, nBlockFrames *= 2)
+	{
+		if (static_cast<u64>(m_PeakCycles[i]) * 100 <= static_cast<u64>(GetDeadlineCycles(nBlockFrames)) * (100 - SafetyMarginPercent))
+			return TResult{nBlockFrames, MinPeriods};
+	}
+
+	// Nothing fits with margin to spare; use the largest block and queue more of them to ride out spikes
+	CLogger::Get()->Write(AudioCalibratorName, LogWarning, "No block size leaves %u%% headroom; consider reducing polyphony", SafetyMarginPercent);
+	return TResult{MaxBlockFrames, SpikePeriods};
+}
+
+u32 CAudioCalibrator::GetDeadlineCycles(size_t nBlockFrames) const
+{
+	return static_cast<u64>(m_nClockRate) * nBlockFrames / m_nSampleRate;
+}
+
+bool CAudioCalibrator::Load(const char* pPath, u32 nSignature, TResult& Result)
+{
+	struct TSavedResult
+	{
+		u32 nSignature;
+		TResult Result;
+	};
+
+	TSavedResult Saved{0, TResult{0, 0}};
+	const auto Handler = [](void* pUser, const char* pSection, const char* pName, const char* pValue)
+	{
+		TSavedResult* pSaved = static_cast<TSavedResult*>(pUser);
+
+		if (!strcmp(pName, "signature"))
+			pSaved->nSignature = strtoul(pValue, nullptr, 16);
+		else if (!strcmp(pName, "block_frames"))
+			pSaved->Result.nBlockFrames = strtoul(pValue, nullptr, 10);
+		else if (!strcmp(pName, "periods"))
+			pSaved->Result.nPeriods = strtoul(pValue, nullptr, 10);
+
+		return 1;
+	};
+
+	if (ini_parse(pPath, Handler, &Saved) != 0)
+		return false;
+
+	// Stale results from a different setup must be measured again
+	if (Saved.nSignature != nSignature || !Saved.Result.nBlockFrames || !Saved.Result.nPeriods)
+		return false;
+
+	Result = Saved.Result;
+	return true;
+}
+
+bool CAudioCalibrator::Save(const char* pPath, u32 nSignature, const TResult& Result)
+{
+	char Buffer[128];
+	const int nLength = snprintf(Buffer, sizeof(Buffer),
+		"# Generated by mt32-pi; delete to recalibrate\n[calibration]\nsignature = %08lx\nblock_frames = %u\nperiods = %u\n",
+		static_cast<unsigned long>(nSignature), static_cast<unsigned int>(Result.nBlockFrames), static_cast<unsigned int>(Result.nPeriods));
+
+	FIL File;
+	if (f_open(&File, pPath, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+		return false;
+
+	UINT nWritten;
+	const bool bResult = f_write(&File, Buffer, nLength, &nWritten) == FR_OK && nWritten == static_cast<UINT>(nLength);
+
+	return f_close(&File) == FR_OK && bResult;
+}
@@ -0,0 +1,287 @@
+//
+// audiocapture.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/logger.h>
+#include <circle/macros.h>
+#include <circle/util.h>
+
+#include <cstdio>
+
+#include "audio/audiocapture.h"
+#include "utility.h"
+
+const char AudioCaptureName[] = "audiocapture";
+
+constexpr unsigned int MaxCaptureFiles = 1000;
+
+// Audio data starts on a sector boundary so that whole chunks are written straight from the buffer
+constexpr size_t WAVHeaderBytes = 512;
+
+struct TWAVHeader
+{
+	char RIFFID[4];
+	u32 nRIFFSize;
+	char WAVEID[4];
+
+	char FormatID[4];
+	u32 nFormatSize;
+	u16 nFormatTag;
+	u16 nChannels;
+	u32 nSampleRate;
+	u32 nByteRate;
+	u16 nBlockAlign;
+	u16 nBitsPerSample;
+
+	char JunkID[4];
+	u32 nJunkSize;
+	u8 Junk[WAVHeaderBytes - 52];
+
+	char DataID[4];
+	u32 nDataSize;
+}
+PACKED;
+
+static_assert(sizeof(TWAVHeader) == WAVHeaderBytes, "WAV header must fill one sector");
+
+// Packs signed 24-bit samples in 32-bit words into 3 bytes each; returns the end of the output
+static u8* PackS24(u8* pOut, const u8* pIn, size_t nBytes)
+{
+	const s32* pSamples = reinterpret_cast<const s32*>(pIn);
+	for (size_t i = 0; i < nBytes / 4; ++i)
+	{
+		*pOut++ = pSamples[i];
+		*pOut++ = pSamples[i] >> 8;
+		*pOut++ = pSamples[i] >> 16;
+	}
+
+	return pOut;
+}
+
+CAudioCapture::CAudioCapture()
+	: m_nSampleRate(0),
+	  m_nSampleBytes(0),
+
+	  m_bRequested(false),
+	  m_bCapturing(false),
+
+	  m_pRing(nullptr),
+	  m_nWriteIndex(0),
+	  m_nReadIndex(0),
+	  m_nDroppedFrames(0),
+	  m_nDroppedFramesAtStart(0),
+
+	  m_bFileOpen(false),
+	  m_File{},
+	  m_FileName{0},
+	  m_nDataBytes(0),
+	  m_pConvertBuffer(nullptr)
+{
+}
+
+CAudioCapture::~CAudioCapture()
+{
+	delete[] m_pRing;
+	delete[] m_pConvertBuffer;
+}
+
+void CAudioCapture::Initialize(unsigned int nSampleRate, size_t nSampleBytes)
+{
+	m_nSampleRate  = nSampleRate;
+	m_nSampleBytes = nSampleBytes;
+}
+
+void CAudioCapture::Write(const void* pData, size_t nBytes)
+{
+	const u32 nWriteIndex = m_nWriteIndex;
+	const u32 nReadIndex  = __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE);
+
+	if (RingBytes - (nWriteIndex - nReadIndex) < nBytes)
+	{
+		m_nDroppedFrames += nBytes / (m_nSampleBytes * 2);
+		return;
+	}
+
+	const size_t nOffset = nWriteIndex & (RingBytes - 1);
+	const size_t nFirst  = Utility::Min(nBytes, RingBytes - nOffset);
+
+	// Copy in up to two segments to handle wraparound
+	memcpy(m_pRing + nOffset, pData, nFirst);
+	memcpy(m_pRing, static_cast<const u8*>(pData) + nFirst, nBytes - nFirst);
+
+	__atomic_store_n(&m_nWriteIndex, nWriteIndex + nBytes, __ATOMIC_RELEASE);
+}
+
+void CAudioCapture::Update()
+{
+	const bool bRequested = IsRequested();
+
+	if (bRequested && !m_bFileOpen)
+	{
+		if (!Open())
+			Stop();
+	}
+	else if (!bRequested && m_bFileOpen)
+		Close();
+	else if (m_bFileOpen && !Drain(false))
+	{
+		Stop();
+		Close();
+	}
+}
+
+void CAudioCapture::Finish()
+{
+	Stop();
+	Update();
+}
+
+bool CAudioCapture::Open()
+{
+	CLogger* const pLogger = CLogger::Get();
+
+	if (!m_pRing)
+	{
+		m_pRing = new u8[RingBytes];
+
+		// Room for a chunk of samples packed down to 24 bits, or gathered from either end of the ring
+		m_pConvertBuffer = new u8[ChunkBytes];
+	}
+
+	unsigned int nIndex = 0;
+	for (; nIndex < MaxCaptureFiles; ++nIndex)
+	{
+		FILINFO FileInfo;
+		snprintf(m_FileName, sizeof(m_FileName), "capture%03u.wav", nIndex);
+		if (f_stat(m_FileName, &FileInfo) == FR_NO_FILE)
+			break;
+	}
+
+	if (nIndex == MaxCaptureFiles || f_open(&m_File, m_FileName, FA_WRITE | FA_CREATE_NEW) != FR_OK)
+	{
+		pLogger->Write(AudioCaptureName, LogError, "Couldn't create a capture file");
+		return false;
+	}
+
+	m_bFileOpen  = true;
+	m_nDataBytes = 0;
+
+	if (!WriteHeader())
+	{
+		pLogger->Write(AudioCaptureName, LogError, "Couldn't write to %s", m_FileName);
+		f_close(&m_File);
+		m_bFileOpen = false;
+		return false;
+	}
+
+	// Discard anything left over from a previous capture, then let the audio core start writing
+	__atomic_store_n(&m_nReadIndex, __atomic_load_n(&m_nWriteIndex, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	m_nDroppedFramesAtStart = m_nDroppedFrames;
+	__atomic_store_n(&m_bCapturing, true, __ATOMIC_RELEASE);
+
+	pLogger->Write(AudioCaptureName, LogNotice, "Capturing to %s", m_FileName);
+	return true;
+}
+
+void CAudioCapture::Close()
+{
+	__atomic_store_n(&m_bCapturing, false, __ATOMIC_RELEASE);
+
+	// Sizes in the header are only known now
+	const bool bResult = Drain(true) && WriteHeader();
+	f_close(&m_File);
+	m_bFileOpen = false;
+
+	const u32 nFrames = m_nDataBytes / (m_nSampleBytes == 2 ? 4 : 6);
+	const u32 nDroppedFrames = m_nDroppedFrames - m_nDroppedFramesAtStart;
+	CLogger::Get()->Write(AudioCaptureName, bResult ? LogNotice : LogError, "%s %s: %u frames, %u dropped", bResult ? "Finished" : "Failed writing", m_FileName, nFrames, nDroppedFrames);
+}
+
+bool CAudioCapture::Drain(bool bFlush)
+{
+	UINT nWritten;
+
+	while (true)
+	{
+		// Only whole chunks are written until the final flush, so every write stays a multiple of the sector size;
+		// anything less is left in the ring for next time
+		const u32 nAvailable = __atomic_load_n(&m_nWriteIndex, __ATOMIC_ACQUIRE) - m_nReadIndex;
+		if (nAvailable == 0 || (nAvailable < ChunkBytes && !bFlush))
+			return true;
+
+		const size_t nOffset = m_nReadIndex & (RingBytes - 1);
+		const size_t nBytes  = Utility::Min(static_cast<size_t>(nAvailable), ChunkBytes);
+		const size_t nFirst  = Utility::Min(nBytes, RingBytes - nOffset);
+		const u8* pData      = m_pRing + nOffset;
+		size_t nWriteBytes   = nBytes;
+
+		// 24-bit samples are packed into 3 bytes each, and a chunk wrapping around the end of the ring is gathered
+		if (m_nSampleBytes == 4)
+		{
+			PackS24(PackS24(m_pConvertBuffer, pData, nFirst), m_pRing, nBytes - nFirst);
+			pData       = m_pConvertBuffer;
+			nWriteBytes = nBytes / 4 * 3;
+		}
+		else if (nFirst < nBytes)
+		{
+			memcpy(m_pConvertBuffer, pData, nFirst);
+			memcpy(m_pConvertBuffer + nFirst, m_pRing, nBytes - nFirst);
+			pData = m_pConvertBuffer;
+		}
+
+		if (f_write(&m_File, pData, nWriteBytes, &nWritten) != FR_OK || nWritten != nWriteBytes)
+			return false;
+
+		m_nDataBytes += nWriteBytes;
+		__atomic_store_n(&m_nReadIndex, m_nReadIndex + nBytes, __ATOMIC_RELEASE);
+
+		// One chunk per call keeps the writer core responsive; flushing empties the ring
+		if (!bFlush)
+			return true;
+	}
+}
+
+bool CAudioCapture::WriteHeader()
+{
+	const u16 nBitsPerSample = m_nSampleBytes == 2 ? 16 : 24;
+	const u16 nBlockAlign    = 2 * nBitsPerSample / 8;
+
+	TWAVHeader Header =
+	{
+		{'R', 'I', 'F', 'F'}, static_cast<u32>(WAVHeaderBytes - 8 + m_nDataBytes), {'W', 'A', 'V', 'E'},
+		{'f', 'm', 't', ' '}, 16, 1, 2, m_nSampleRate, m_nSampleRate * nBlockAlign, nBlockAlign, nBitsPerSample,
+		{'J', 'U', 'N', 'K'}, sizeof(TWAVHeader::Junk), {0},
+		{'d', 'a', 't', 'a'}, m_nDataBytes,
+	};
+
+	UINT nWritten;
+	const FSIZE_t nPosition = f_tell(&m_File);
+	const bool bRewrite = nPosition != 0;
+
+	if (bRewrite && f_lseek(&m_File, 0) != FR_OK)
+		return false;
+
+	if (f_write(&m_File, &Header, sizeof(Header), &nWritten) != FR_OK || nWritten != sizeof(Header))
+		return false;
+
+	return !bRewrite || f_lseek(&m_File, nPosition) == FR_OK;
+}
@@ -0,0 +1,89 @@
+//
+// audioscheduler.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/synchronize.h>
+
+#include "audio/audioscheduler.h"
+#include "utility.h"
+
+constexpr size_t MinPeriods = 2;
+constexpr size_t MaxPeriods = 16;
+
+CAudioScheduler::CAudioScheduler(CSoundBaseDevice* pSound, size_t nBlockFrames, size_t nPeriods)
+	: m_pSound(pSound),
+	  m_nBlockFrames(nBlockFrames),
+	  m_nPeriods(Utility::Clamp(nPeriods, MinPeriods, MaxPeriods)),
+	  m_bPrimed(false),
+	  m_bStopped(false)
+{
+}
+
+bool CAudioScheduler::Initialize()
+{
+	// The device calls us back when its queue drops below half full, so allocate twice the
+	// target fill level; that way the callback fires every time a period has been consumed
+	if (!m_pSound->AllocateQueueFrames(m_nBlockFrames * m_nPeriods * 2))
+		return false;
+
+	m_pSound->RegisterNeedDataCallback(NeedDataCallback, this);
+
+	return true;
+}
+
+bool CAudioScheduler::WaitForBlock()
+{
+	const size_t nTargetFrames = m_nBlockFrames * m_nPeriods;
+
+	// Event register is latched, so a SEV between the check and the WFE is not lost
+	while (!m_bStopped && m_pSound->GetQueueFramesAvail() + m_nBlockFrames > nTargetFrames)
+	{
+		m_bPrimed = true;
+		WaitForEvent();
+	}
+
+	return !m_bStopped;
+}
+
+void CAudioScheduler::Stop()
+{
+	m_bStopped = true;
+	DataSyncBarrier();
+	SendEvent();
+}
+
+size_t CAudioScheduler::GetBlockFramesForChunkSize(size_t nChunkSize)
+{
+	const size_t nFrames = Utility::Max(nChunkSize / 2, static_cast<size_t>(1));
+
+	size_t nBlockFrames = 1;
+	while (nBlockFrames * 2 <= nFrames)
+		nBlockFrames *= 2;
+
+	return nBlockFrames;
+}
+
+void CAudioScheduler::NeedDataCallback(void* pParam)
+{
+	// Called from the DMA completion IRQ on core 0; wake the audio core
+	DataSyncBarrier();
+	SendEvent();
+}
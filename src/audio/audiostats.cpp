@@ -0,0 +1,106 @@
+//
+// audiostats.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "audio/audiostats.h"
+#include "utility.h"
+
+CAudioStats::CAudioStats()
+	: m_nDeadlineMicros(0),
+	  m_nTotalMicros(0),
+
+	  m_nBlocks(0),
+	  m_nXruns(0),
+	  m_nShortWrites(0),
+	  m_nMinMicros(0),
+	  m_nMaxMicros(0),
+	  m_nAvgMicros(0),
+	  m_nLastMicros(0),
+	  m_Histogram{0}
+{
+}
+
+void CAudioStats::Initialize(size_t nBlockFrames, unsigned int nSampleRate)
+{
+	m_nDeadlineMicros = static_cast<u64>(nBlockFrames) * 1000000 / nSampleRate;
+}
+
+void CAudioStats::EnableCycleCounter()
+{
+	// Enable the PMU cycle counter on this core (PMCR.E, PMCNTENSET.C)
+#if defined(MT32_PI_HOST)
+	// Nothing to do
+#elif AARCH == 32
+	u32 nValue;
+	asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r"(nValue));
+	asm volatile("mcr p15, 0, %0, c9, c12, 0" : : "r"(nValue | 1));
+	asm volatile("mcr p15, 0, %0, c9, c12, 1" : : "r"(1 << 31));
+#else
+	u64 nValue;
+	asm volatile("mrs %0, pmcr_el0" : "=r"(nValue));
+	asm volatile("msr pmcr_el0, %0" : : "r"(nValue | 1));
+	asm volatile("msr pmcntenset_el0, %0" : : "r"(static_cast<u64>(1) << 31));
+#endif
+}
+
+void CAudioStats::OnBlockRendered(u32 nMicros)
+{
+	const u32 nBlocks = m_nBlocks + 1;
+	m_nTotalMicros += nMicros;
+
+	if (nBlocks == 1 || nMicros < m_nMinMicros)
+		m_nMinMicros = nMicros;
+	if (nMicros > m_nMaxMicros)
+		m_nMaxMicros = nMicros;
+
+	m_nAvgMicros  = m_nTotalMicros / nBlocks;
+	m_nLastMicros = nMicros;
+
+	if (m_nDeadlineMicros)
+	{
+		const u64 nBucket = static_cast<u64>(nMicros) * (HistogramBuckets - 1) / m_nDeadlineMicros;
+		++m_Histogram[Utility::Min(nBucket, static_cast<u64>(HistogramBuckets - 1))];
+	}
+
+	m_nBlocks = nBlocks;
+}
+
+void CAudioStats::GetSnapshot(TSnapshot& Snapshot) const
+{
+	// Fields are updated independently, so values may be one block apart
+	Snapshot.nBlocks         = m_nBlocks;
+	Snapshot.nXruns          = m_nXruns;
+	Snapshot.nShortWrites    = m_nShortWrites;
+	Snapshot.nDeadlineMicros = m_nDeadlineMicros;
+	Snapshot.nMinMicros      = m_nMinMicros;
+	Snapshot.nAvgMicros      = m_nAvgMicros;
+	Snapshot.nMaxMicros      = m_nMaxMicros;
+	Snapshot.nLastMicros     = m_nLastMicros;
+
+	const u32 nLastMicros = Snapshot.nLastMicros;
+	if (Snapshot.nDeadlineMicros && nLastMicros < Snapshot.nDeadlineMicros)
+		Snapshot.nHeadroomPercent = static_cast<u64>(Snapshot.nDeadlineMicros - nLastMicros) * 100 / Snapshot.nDeadlineMicros;
+	else
+		Snapshot.nHeadroomPercent = 0;
+
+	for (size_t i = 0; i < HistogramBuckets; ++i)
+		Snapshot.Histogram[i] = m_Histogram[i];
+}
@@ -57,8 +57,11 @@ const char* FalseStrings[] = {"false", "off", "0"};
 
 // Enum string tables
 CONFIG_ENUM_STRINGS(TSystemDefaultSynth, ENUM_SYSTEMDEFAULTSYNTH);
+CONFIG_ENUM_STRINGS(TMIDIRoute, ENUM_MIDIROUTE);
+CONFIG_ENUM_STRINGS(TMIDIThru, ENUM_MIDITHRU);
 CONFIG_ENUM_STRINGS(TAudioOutputDevice, ENUM_AUDIOOUTPUTDEVICE);
 CONFIG_ENUM_STRINGS(TAudioI2CDACInit, ENUM_AUDIOI2CDACINIT);
+CONFIG_ENUM_STRINGS(TAudioCalibration, ENUM_AUDIOCALIBRATION);
 CONFIG_ENUM_STRINGS(TMT32EmuResamplerQuality, ENUM_RESAMPLERQUALITY);
 CONFIG_ENUM_STRINGS(TMT32EmuMIDIChannels, ENUM_MIDICHANNELS);
 CONFIG_ENUM_STRINGS(TMT32EmuROMSet, ENUM_MT32ROMSET);
@@ -148,8 +151,25 @@ bool CConfig::ParseOption(const char* pString, float* pOutFloat)
 
 // Define template function wrappers for parsing enums
 CONFIG_ENUM_PARSER(TSystemDefaultSynth);
+CONFIG_ENUM_PARSER(TMIDIRoute);
+
+// gpio_thru was once on/off, meaning GPIO in to GPIO out; keep accepting those values for it only
+bool CConfig::ParseOption(const char* pString, TMIDIThru* pOut, bool bAcceptOnOff)
+{
+	if (ParseEnum<TMIDIThru, TMIDIThruStrings, Utility::ArraySize(TMIDIThruStrings)>(pString, pOut))
+		return true;
+
+	bool bEnabled;
+	if (!bAcceptOnOff || !ParseOption(pString, &bEnabled))
+		return false;
+
+	*pOut = bEnabled ? TMIDIThru::GPIO : TMIDIThru::Off;
+	return true;
+}
+
 CONFIG_ENUM_PARSER(TAudioOutputDevice);
 CONFIG_ENUM_PARSER(TAudioI2CDACInit);
+CONFIG_ENUM_PARSER(TAudioCalibration);
 CONFIG_ENUM_PARSER(TMT32EmuResamplerQuality);
 CONFIG_ENUM_PARSER(TMT32EmuMIDIChannels);
 CONFIG_ENUM_PARSER(TMT32EmuROMSet);
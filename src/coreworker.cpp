@@ -0,0 +1,81 @@
+//
+// coreworker.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/synchronize.h>
+
+#include "coreworker.h"
+
+CCoreWorker* CCoreWorker::s_pThis = nullptr;
+
+CCoreWorker::CCoreWorker()
+	: m_pFunction(nullptr),
+	  m_pParam(nullptr),
+	  m_bRunning(true)
+{
+	s_pThis = this;
+}
+
+void CCoreWorker::Run()
+{
+	while (__atomic_load_n(&m_bRunning, __ATOMIC_ACQUIRE))
+	{
+		const TJobFunction pFunction = __atomic_load_n(&m_pFunction, __ATOMIC_ACQUIRE);
+		if (!pFunction)
+		{
+			WaitForEvent();
+			continue;
+		}
+
+		pFunction(m_pParam);
+
+		// Mark the job as done and wake anyone waiting in Join()
+		__atomic_store_n(&m_pFunction, nullptr, __ATOMIC_RELEASE);
+		DataSyncBarrier();
+		SendEvent();
+	}
+}
+
+void CCoreWorker::Stop()
+{
+	__atomic_store_n(&m_bRunning, false, __ATOMIC_RELEASE);
+	DataSyncBarrier();
+	SendEvent();
+}
+
+bool CCoreWorker::Submit(TJobFunction pFunction, void* pParam)
+{
+	if (__atomic_load_n(&m_pFunction, __ATOMIC_ACQUIRE))
+		return false;
+
+	m_pParam = pParam;
+	__atomic_store_n(&m_pFunction, pFunction, __ATOMIC_RELEASE);
+	DataSyncBarrier();
+	SendEvent();
+
+	return true;
+}
+
+void CCoreWorker::Join()
+{
+	while (__atomic_load_n(&m_pFunction, __ATOMIC_ACQUIRE))
+		WaitForEvent();
+}
@@ -207,7 +207,7 @@ void CHD44780Base::Update(CMT32Synth& Synth)
 		return;
 
 	SetBarChars(TBarCharSet::Wide);
-	UpdateChannelLevels(Synth);
+	UpdateChannelLevels();
 
 	const bool bShowSystemMessage = m_SystemState != TSystemState::None && m_SystemState != TSystemState::DisplayingImage;
 
@@ -247,7 +247,7 @@ void CHD44780Base::Update(CSoundFontSynth& Synth)
 		return;
 
 	SetBarChars(TBarCharSet::Narrow);
-	UpdateChannelLevels(Synth);
+	UpdateChannelLevels();
 
 	const bool bShowSystemMessage = m_SystemState != TSystemState::None && m_SystemState != TSystemState::DisplayingImage;
 
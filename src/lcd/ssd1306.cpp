@@ -479,7 +479,7 @@ void CSSD1306::Update(CMT32Synth& Synth)
 		return;
 
 	Clear(false);
-	UpdateChannelLevels(Synth);
+	UpdateChannelLevels();
 	UpdateChannelPeakLevels();
 
 	if (m_SystemState != TSystemState::None)
@@ -511,7 +511,7 @@ void CSSD1306::Update(CSoundFontSynth& Synth)
 		return;
 
 	Clear(false);
-	UpdateChannelLevels(Synth);
+	UpdateChannelLevels();
 	UpdateChannelPeakLevels();
 
 	if (m_SystemState != TSystemState::None)
@@ -48,7 +48,7 @@ CSynthLCD::CSynthLCD()
 	  m_SC55TextBuffer{'\0'},
 	  m_SC55PixelBuffer{0},
 
-	  m_ChannelVelocities{0},
+	  m_SynthState{},
 	  m_ChannelLevels{0},
 	  m_ChannelPeakLevels{0},
 	  m_ChannelPeakTimes{0}
@@ -150,8 +150,9 @@ void CSynthLCD::Update(CMT32Synth& Synth)
 {
 	const unsigned nTicks = CTimer::Get()->GetTicks();
 	UpdateSystem(nTicks);
+	Synth.GetState(m_SynthState);
 
-	const u8 nMasterVolume = Synth.GetMasterVolume();
+	const u8 nMasterVolume = m_SynthState.nMasterVolume;
 
 	// Hide message if master volume changed and message has been displayed long enough
 	if (m_nPreviousMasterVolume != nMasterVolume)
@@ -172,13 +173,14 @@ void CSynthLCD::Update(CMT32Synth& Synth)
 	}
 
 	if (m_MT32State == TMT32State::DisplayingPartStates)
-		UpdatePartStateText(Synth);
+		UpdatePartStateText();
 }
 
 void CSynthLCD::Update(CSoundFontSynth& Synth)
 {
 	const unsigned nTicks = CTimer::Get()->GetTicks();
 	UpdateSystem(nTicks);
+	Synth.GetState(m_SynthState);
 
 	// Displaying text timeout
 	if (m_bSC55DisplayingText && (nTicks - m_nSC55DisplayTextTime) > MSEC2HZ(SC55DisplayTimeMillis))
@@ -222,33 +224,33 @@ void CSynthLCD::UpdateSystem(unsigned int nTicks)
 	}
 }
 
-void CSynthLCD::UpdatePartStateText(const CMT32Synth& Synth)
+void CSynthLCD::UpdatePartStateText()
 {
 	// First 5 parts
 	for (u8 i = 0; i < 5; ++i)
 	{
-		bool bState = m_ChannelVelocities[i] > 0;
+		bool bState = m_SynthState.ChannelVelocities[i] > 0;
 		m_MT32TextBuffer[i * 2] = bState ? '\xFF' : ('1' + i);
 		m_MT32TextBuffer[i * 2 + 1] = ' ';
 	}
 
 	// Rhythm
-	bool bState = m_ChannelVelocities[8] > 0;
+	bool bState = m_SynthState.ChannelVelocities[8] > 0;
 	m_MT32TextBuffer[10] = bState ? '\xFF' : 'R';
 	m_MT32TextBuffer[11] = ' ';
 
 	// Volume
-	sprintf(m_MT32TextBuffer + 12, "|vol:%3d", Synth.GetMasterVolume());
+	sprintf(m_MT32TextBuffer + 12, "|vol:%3d", m_SynthState.nMasterVolume);
 }
 
-void CSynthLCD::UpdateChannelLevels(CSynthBase& Synth)
+void CSynthLCD::UpdateChannelLevels()
 {
-	const u8 nChannelCount = Synth.GetChannelVelocities(m_ChannelVelocities, Utility::ArraySize(m_ChannelVelocities));
+	const u8 nChannelCount = Utility::Min(m_SynthState.nChannels, static_cast<u8>(MIDIChannelCount));
 
 	for (u8 nChannel = 0; nChannel < nChannelCount; ++nChannel)
 	{
 		// MIDI velocity range [0-127] to normalized range [0-1]
-		float nLevel = m_ChannelVelocities[nChannel] / 127.0f;
+		float nLevel = m_SynthState.ChannelVelocities[nChannel] / 127.0f;
 
 		if (nLevel >= m_ChannelLevels[nChannel])
 			m_ChannelLevels[nChannel] = nLevel;
@@ -0,0 +1,278 @@
+//
+// midioutput.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/util.h>
+
+#include "midioutput.h"
+#include "midiparser.h"
+
+// USB-MIDI Code Index Numbers
+constexpr u8 CINSystemCommon2 = 0x2;
+constexpr u8 CINSystemCommon3 = 0x3;
+constexpr u8 CINSysExContinue = 0x4;
+constexpr u8 CINSysExEnd1     = 0x5;
+constexpr u8 CINSingleByte    = 0xF;
+
+CMIDIOutput::CMIDIOutput()
+	: m_pStreamSource(nullptr),
+	  m_bStreamQueued(false),
+	  m_bStreamFailed(false)
+{
+}
+
+bool CMIDIOutput::SendShortMessage(u32 nMessage)
+{
+	// Only System Real-Time may appear inside a SysEx message
+	if (m_pStreamSource && (nMessage & 0xFF) < 0xF8)
+		return false;
+
+	return QueueShortMessage(nMessage);
+}
+
+bool CMIDIOutput::SendSysExMessage(const u8* pData, size_t nSize)
+{
+	if (m_pStreamSource)
+		return false;
+
+	return QueueSysExMessage(pData, nSize);
+}
+
+bool CMIDIOutput::SendSysExFragment(const void* pSource, const u8* pData, size_t nSize, TSysExFragment Fragment)
+{
+	if (Fragment == TSysExFragment::Start)
+	{
+		// Another source is part way through a message
+		if (m_pStreamSource)
+			return false;
+
+		m_pStreamSource = pSource;
+		m_bStreamQueued = false;
+		m_bStreamFailed = false;
+	}
+
+	// This source's first piece was refused
+	else if (pSource != m_pStreamSource)
+		return false;
+
+	bool bSent = true;
+	if (!m_bStreamFailed)
+	{
+		if (Fragment == TSysExFragment::Abort)
+		{
+			if (m_bStreamQueued)
+				TerminateSysEx();
+		}
+		else if (QueueSysExFragment(pData, nSize, Fragment == TSysExFragment::End))
+			m_bStreamQueued = true;
+		else
+		{
+			if (m_bStreamQueued)
+				TerminateSysEx();
+
+			m_bStreamFailed = true;
+			bSent = false;
+		}
+	}
+
+	if (Fragment == TSysExFragment::End || Fragment == TSysExFragment::Abort)
+		m_pStreamSource = nullptr;
+
+	return bSent;
+}
+
+CSerialMIDIOutput::CSerialMIDIOutput(CSerialDevice* pSerialDevice)
+	: m_pSerialDevice(pSerialDevice),
+	  m_nRunningStatus(0),
+	  m_PendingBytes{0},
+	  m_nPendingOffset(0),
+	  m_nPendingSize(0)
+{
+}
+
+bool CSerialMIDIOutput::QueueShortMessage(u32 nMessage)
+{
+	const u8 nStatus = nMessage & 0xFF;
+	const u8 nLength = CMIDIParser::GetShortMessageLength(nStatus);
+	if (!nLength)
+		return false;
+
+	const u8 Bytes[] = { nStatus, static_cast<u8>(nMessage >> 8), static_cast<u8>(nMessage >> 16) };
+
+	// Omit the status byte if it matches the last channel message's; System Common clears running status,
+	// and System Real-Time leaves it alone
+	const bool bRunningStatus = nStatus == m_nRunningStatus;
+	const size_t nOffset = bRunningStatus ? 1 : 0;
+	if (m_TxBuffer.GetFreeSpace() < nLength - nOffset)
+		return false;
+
+	m_TxBuffer.Enqueue(Bytes + nOffset, nLength - nOffset);
+
+	if (nStatus < 0xF0)
+		m_nRunningStatus = nStatus;
+	else if (nStatus < 0xF8)
+		m_nRunningStatus = 0;
+
+	return true;
+}
+
+bool CSerialMIDIOutput::QueueSysExMessage(const u8* pData, size_t nSize)
+{
+	return QueueSysExFragment(pData, nSize, true);
+}
+
+bool CSerialMIDIOutput::QueueSysExFragment(const u8* pData, size_t nSize, bool bEnd)
+{
+	if (m_TxBuffer.GetFreeSpace() < nSize + (bEnd ? 0 : 1))
+		return false;
+
+	m_TxBuffer.Enqueue(pData, nSize);
+	m_nRunningStatus = 0;
+
+	return true;
+}
+
+void CSerialMIDIOutput::TerminateSysEx()
+{
+	const u8 nEOX = 0xF7;
+	m_TxBuffer.Enqueue(nEOX);
+}
+
+void CSerialMIDIOutput::Update()
+{
+	// Top up the serial driver's transmit buffer; it may accept fewer bytes than offered, so keep the rest for next time
+	while (true)
+	{
+		if (m_nPendingOffset == m_nPendingSize)
+		{
+			m_nPendingOffset = 0;
+			m_nPendingSize = m_TxBuffer.Dequeue(m_PendingBytes, sizeof(m_PendingBytes));
+			if (!m_nPendingSize)
+				return;
+		}
+
+		const size_t nRemaining = m_nPendingSize - m_nPendingOffset;
+		const int nResult = m_pSerialDevice->Write(m_PendingBytes + m_nPendingOffset, nRemaining);
+		if (nResult <= 0)
+			return;
+
+		m_nPendingOffset += nResult;
+		if (static_cast<size_t>(nResult) < nRemaining)
+			return;
+	}
+}
+
+CUSBMIDIOutput::CUSBMIDIOutput()
+	: m_pDevice(nullptr),
+	  m_SysExCarry{0},
+	  m_nSysExCarrySize(0)
+{
+}
+
+bool CUSBMIDIOutput::QueueShortMessage(u32 nMessage)
+{
+	const u8 nStatus = nMessage & 0xFF;
+	const u8 nLength = CMIDIParser::GetShortMessageLength(nStatus);
+	if (!nLength)
+		return false;
+
+	// Channel messages use their status nibble as the CIN; cable 0
+	u8 nCIN;
+	if (nStatus < 0xF0)
+		nCIN = nStatus >> 4;
+	else if (nStatus >= 0xF8)
+		nCIN = CINSingleByte;
+	else
+		nCIN = nLength == 1 ? CINSysExEnd1 : nLength == 2 ? CINSystemCommon2 : CINSystemCommon3;
+
+	return m_TxBuffer.Enqueue(nCIN | (nMessage & 0xFFFFFF) << 8);
+}
+
+bool CUSBMIDIOutput::QueueSysExMessage(const u8* pData, size_t nSize)
+{
+	if (!nSize)
+		return false;
+
+	return QueueSysExFragment(pData, nSize, true);
+}
+
+bool CUSBMIDIOutput::QueueSysExFragment(const u8* pData, size_t nSize, bool bEnd)
+{
+	// Bytes that don't fill a packet are carried over to the next piece, and one packet is kept free for the EOX
+	const size_t nBytes = m_nSysExCarrySize + nSize;
+	const size_t nPackets = bEnd ? (nBytes + 2) / 3 : nBytes / 3 + 1;
+	if (m_TxBuffer.GetFreeSpace() < nPackets)
+		return false;
+
+	QueueSysExPackets(pData, nSize, bEnd);
+	return true;
+}
+
+void CUSBMIDIOutput::TerminateSysEx()
+{
+	const u8 nEOX = 0xF7;
+	QueueSysExPackets(&nEOX, 1, true);
+}
+
+void CUSBMIDIOutput::QueueSysExPackets(const u8* pData, size_t nSize, bool bEnd)
+{
+	u8 Packet[3];
+	size_t nPacketSize = m_nSysExCarrySize;
+	memcpy(Packet, m_SysExCarry, m_nSysExCarrySize);
+
+	// Three bytes per packet; the last packet's CIN gives the number of bytes left (1-3)
+	for (size_t i = 0; i < nSize; ++i)
+	{
+		Packet[nPacketSize++] = pData[i];
+
+		if (nPacketSize == 3 && !(bEnd && i == nSize - 1))
+		{
+			m_TxBuffer.Enqueue(CINSysExContinue | Packet[0] << 8 | Packet[1] << 16 | static_cast<u32>(Packet[2]) << 24);
+			nPacketSize = 0;
+		}
+	}
+
+	if (bEnd)
+	{
+		u32 nPacket = CINSysExEnd1 + nPacketSize - 1;
+		for (size_t i = 0; i < nPacketSize; ++i)
+			nPacket |= static_cast<u32>(Packet[i]) << (8 * (i + 1));
+
+		m_TxBuffer.Enqueue(nPacket);
+		m_nSysExCarrySize = 0;
+	}
+	else
+	{
+		memcpy(m_SysExCarry, Packet, nPacketSize);
+		m_nSysExCarrySize = nPacketSize;
+	}
+}
+
+void CUSBMIDIOutput::Update()
+{
+	u32 Packets[MaxPacketsPerTransfer];
+	const size_t nPackets = m_TxBuffer.Dequeue(Packets, MaxPacketsPerTransfer);
+	if (!nPackets || !m_pDevice)
+		return;
+
+	m_pDevice->SendEventPackets(reinterpret_cast<const u8*>(Packets), nPackets * sizeof(u32));
+}
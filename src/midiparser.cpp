@@ -21,91 +21,159 @@
 //
 
 #include <circle/logger.h>
+#include <circle/util.h>
 
 #include "midiparser.h"
 
 const char MIDIParserName[] = "midiparser";
 
+// Short message lengths by status byte
+constexpr u8 ChannelMessageLengths[] = { 3, 3, 3, 3, 2, 2, 3 };
+constexpr u8 SystemMessageLengths[]  = { 0, 2, 3, 2, 0, 0, 1, 0, 1, 0, 1, 1, 1, 0, 1, 1 };
+
 CMIDIParser::CMIDIParser()
 	: m_State(TState::StatusByte),
 	  m_MessageBuffer{0},
-	  m_nMessageLength(0)
+	  m_nMessageLength(0),
+	  m_bSysExFragmented(false),
+	  m_pBatch(nullptr),
+	  m_nBatchTimestamp(0)
+{
+}
+
+bool CMIDIParser::TBatch::AddShortMessage(u32 nMessage, u32 nTimestamp)
+{
+	if (nMessages == MaxMessages)
+		return false;
+
+	Messages[nMessages]   = nMessage;
+	Timestamps[nMessages] = nTimestamp;
+	++nMessages;
+	return true;
+}
+
+bool CMIDIParser::TBatch::AddSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp)
 {
+	if (nMessages == MaxMessages || nSysExSpans == MaxMessages || MaxSysExBytes - nSysExBytes < nSize)
+		return false;
+
+	memcpy(SysExData + nSysExBytes, pData, nSize);
+	SysExSpans[nSysExSpans] = { static_cast<u16>(nSysExBytes), static_cast<u16>(nSize) };
+	nSysExBytes += nSize;
+
+	Messages[nMessages]   = 0xF0 | nSysExSpans++ << 8;
+	Timestamps[nMessages] = nTimestamp;
+	++nMessages;
+	return true;
 }
 
 void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize)
+{
+	for (size_t i = 0; i < nSize; ++i)
+		ParseMIDIByte(pData[i]);
+}
+
+size_t CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp, TBatch& Batch)
+{
+	m_pBatch = &Batch;
+	m_nBatchTimestamp = nTimestamp;
+
+	size_t nParsed = 0;
+	while (nParsed < nSize && !Batch.IsFull())
+		ParseMIDIByte(pData[nParsed++]);
+
+	m_pBatch = nullptr;
+	return nParsed;
+}
+
+void CMIDIParser::ParseMIDIByte(u8 nByte)
 {
 	// Process MIDI messages
 	// See: https://www.midi.org/specifications/item/table-1-summary-of-midi-message
-	for (size_t i = 0; i < nSize; ++i)
-	{
-		u8 nByte = pData[i];
 
-		// System Real-Time message - single byte, handle immediately
-		// Can appear anywhere in the stream, even in between status/data bytes
-		if (nByte >= 0xF8)
-		{
-			// Ignore undefined System Real-Time
-			if (nByte != 0xF9 && nByte != 0xFD)
-				OnShortMessage(nByte);
+	// System Real-Time message - single byte, handle immediately
+	// Can appear anywhere in the stream, even in between status/data bytes
+	if (nByte >= 0xF8)
+	{
+		// Ignore undefined System Real-Time
+		if (nByte != 0xF9 && nByte != 0xFD)
+			EmitShortMessage(nByte);
 
-			continue;
-		}
+		return;
+	}
 
-		switch (m_State)
-		{
-			// Expecting a status byte
-			case TState::StatusByte:
+	switch (m_State)
+	{
+		// Expecting a status byte
+		case TState::StatusByte:
+			ParseStatusByte(nByte);
+			break;
+
+		// Expecting a data byte
+		case TState::DataByte:
+			// Expected a data byte, but received a status
+			if (nByte & 0x80)
+			{
+				OnUnexpectedStatus();
+				ResetState(true);
 				ParseStatusByte(nByte);
 				break;
-
-			// Expecting a data byte
-			case TState::DataByte:
-				// Expected a data byte, but received a status
-				if (nByte & 0x80)
-				{
-					OnUnexpectedStatus();
-					ResetState(true);
-					ParseStatusByte(nByte);
-					break;
-				}
-
-				m_MessageBuffer[m_nMessageLength++] = nByte;
-				CheckCompleteShortMessage();
+			}
+
+			m_MessageBuffer[m_nMessageLength++] = nByte;
+			CheckCompleteShortMessage();
+			break;
+
+		// Expecting a SysEx data byte or EOX
+		case TState::SysExByte:
+			// Received a status that wasn't EOX
+			if (nByte & 0x80 && nByte != 0xF7)
+			{
+				OnUnexpectedStatus();
+				if (m_bSysExFragmented)
+					OnSysExFragment(m_MessageBuffer, m_nMessageLength, TSysExFragment::Abort);
+				ResetState(true);
+				ParseStatusByte(nByte);
 				break;
+			}
+
+			// Buffer full; pass on what we have so far and carry on
+			if (m_nMessageLength == sizeof(m_MessageBuffer))
+			{
+				OnSysExFragment(m_MessageBuffer, m_nMessageLength, m_bSysExFragmented ? TSysExFragment::Continue : TSysExFragment::Start);
+				m_bSysExFragmented = true;
+				m_nMessageLength = 0;
+			}
+
+			m_MessageBuffer[m_nMessageLength++] = nByte;
+
+			// End of SysEx
+			if (nByte == 0xF7)
+			{
+				if (m_bSysExFragmented)
+					OnSysExFragment(m_MessageBuffer, m_nMessageLength, TSysExFragment::End);
+				else
+					EmitSysExMessage();
+				ResetState(true);
+			}
+
+			break;
+	}
+}
 
-			// Expecting a SysEx data byte or EOX
-			case TState::SysExByte:
-				// Received a status that wasn't EOX
-				if (nByte & 0x80 && nByte != 0xF7)
-				{
-					OnUnexpectedStatus();
-					ResetState(true);
-					ParseStatusByte(nByte);
-					break;
-				}
-
-				// Buffer overflow
-				if (m_nMessageLength == sizeof(m_MessageBuffer))
-				{
-					OnSysExOverflow();
-					ResetState(true);
-					ParseStatusByte(nByte);
-					break;
-				}
-
-				m_MessageBuffer[m_nMessageLength++] = nByte;
-
-				// End of SysEx
-				if (nByte == 0xF7)
-				{
-					OnSysExMessage(m_MessageBuffer, m_nMessageLength);
-					ResetState(true);
-				}
+u8 CMIDIParser::GetShortMessageLength(u8 nStatus)
+{
+	if (nStatus < 0x80)
+		return 0;
+	if (nStatus < 0xF0)
+		return ChannelMessageLengths[(nStatus >> 4) - 8];
+	return SystemMessageLengths[nStatus & 0x0F];
+}
 
-				break;
-		}
-	}
+void CMIDIParser::OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment)
+{
+	if (Fragment == TSysExFragment::Start)
+		OnSysExOverflow();
 }
 
 void CMIDIParser::OnUnexpectedStatus()
@@ -142,7 +210,7 @@ void CMIDIParser::ParseStatusByte(u8 nByte)
 
 			// Tune Request - single byte, handle immediately and clear running status
 			case 0xF6:
-				OnShortMessage(nByte);
+				EmitShortMessage(nByte);
 				m_MessageBuffer[0] = 0;
 				break;
 
@@ -176,7 +244,7 @@ bool CMIDIParser::CheckCompleteShortMessage()
 	if (m_nMessageLength == 3 ||
 		(m_nMessageLength == 2 && ((nStatus >= 0xC0 && nStatus <= 0xDF) || nStatus == 0xF1 || nStatus == 0xF3)))
 	{
-		OnShortMessage(PrepareShortMessage());
+		EmitShortMessage(PrepareShortMessage());
 
 		// Clear running status if System Common
 		ResetState(nStatus >= 0xF1 && nStatus <= 0xF7);
@@ -197,11 +265,29 @@ u32 CMIDIParser::PrepareShortMessage() const
 	return nMessage;
 }
 
+void CMIDIParser::EmitShortMessage(u32 nMessage)
+{
+	// The batch was checked for space before parsing the byte
+	if (m_pBatch)
+		m_pBatch->AddShortMessage(nMessage, m_nBatchTimestamp);
+	else
+		OnShortMessage(nMessage);
+}
+
+void CMIDIParser::EmitSysExMessage()
+{
+	if (m_pBatch)
+		m_pBatch->AddSysExMessage(m_MessageBuffer, m_nMessageLength, m_nBatchTimestamp);
+	else
+		OnSysExMessage(m_MessageBuffer, m_nMessageLength);
+}
+
 void CMIDIParser::ResetState(bool bClearStatusByte)
 {
 	if (bClearStatusByte)
 		m_MessageBuffer[0] = 0;
 
 	m_nMessageLength = 0;
+	m_bSysExFragmented = false;
 	m_State = TState::StatusByte;
 }
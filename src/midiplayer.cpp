@@ -0,0 +1,572 @@
+//
+// midiplayer.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/logger.h>
+#include <circle/util.h>
+
+#include <cstdio>
+
+#include "midiplayer.h"
+#include "utility.h"
+
+const char MIDIPlayerName[] = "midiplayer";
+const char MIDIPath[] = "midi";
+
+// Microseconds per quarter note until the first tempo event
+constexpr u32 DefaultTempo = 500000;
+
+CMIDIPlayer::CMIDIPlayer()
+	: m_nSampleRate(0),
+	  m_pShortMessageHandler(nullptr),
+	  m_pSysExMessageHandler(nullptr),
+
+	  m_nRequest(NoRequest),
+	  m_bContinue(false),
+	  m_State(TState::Idle),
+
+	  m_pRing(nullptr),
+	  m_nWriteIndex(0),
+	  m_nReadIndex(0),
+	  m_bEndOfFile(false),
+
+	  m_nPlaybackFrame(0),
+	  m_SysExBuffer{0},
+
+	  m_bFileOpen(false),
+	  m_File{},
+	  m_nFileIndex(0),
+	  m_FileName{0},
+	  m_pTracks(nullptr),
+	  m_nTracks(0),
+
+	  m_nDivision(0),
+	  m_nTicksPerSecond(0),
+	  m_nTempo(DefaultTempo),
+	  m_nTempoTick(0),
+	  m_nTempoMicros(0)
+{
+}
+
+CMIDIPlayer::~CMIDIPlayer()
+{
+	Close();
+
+	if (m_pRing)
+		delete[] m_pRing;
+
+	if (m_pTracks)
+		delete[] m_pTracks;
+}
+
+void CMIDIPlayer::Initialize(unsigned int nSampleRate, TShortMessageHandler pShortMessageHandler, TSysExMessageHandler pSysExMessageHandler)
+{
+	m_nSampleRate          = nSampleRate;
+	m_pShortMessageHandler = pShortMessageHandler;
+	m_pSysExMessageHandler = pSysExMessageHandler;
+}
+
+void CMIDIPlayer::Play(size_t nIndex, bool bContinue)
+{
+	m_bContinue = bContinue;
+	__atomic_store_n(&m_nRequest, static_cast<s32>(nIndex), __ATOMIC_RELEASE);
+}
+
+bool CMIDIPlayer::Update()
+{
+	s32 nRequest = __atomic_load_n(&m_nRequest, __ATOMIC_ACQUIRE);
+
+	if (nRequest != NoRequest)
+	{
+		// The audio core must let go of the current file first; it silences the synths and goes idle
+		if (m_bFileOpen)
+		{
+			TState Expected = TState::Playing;
+			__atomic_compare_exchange_n(&m_State, &Expected, TState::Stopping, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+			if (IsPlaying())
+				return false;
+
+			Close();
+		}
+
+		// A newer request is picked up by the next update
+		if (!__atomic_compare_exchange_n(&m_nRequest, &nRequest, NoRequest, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return false;
+
+		return nRequest != StopRequest && Open(nRequest);
+	}
+
+	if (!m_bFileOpen)
+		return false;
+
+	// The audio core has played everything
+	if (!IsPlaying())
+	{
+		Close();
+		return m_bContinue && Open(m_nFileIndex + 1);
+	}
+
+	FillRing();
+	return false;
+}
+
+void CMIDIPlayer::Finish()
+{
+	Close();
+	__atomic_store_n(&m_State, TState::Idle, __ATOMIC_RELEASE);
+}
+
+size_t CMIDIPlayer::Advance(size_t nMaxFrames)
+{
+	const TState State = __atomic_load_n(&m_State, __ATOMIC_ACQUIRE);
+
+	if (State == TState::Idle)
+		return nMaxFrames;
+
+	if (State == TState::Stopping)
+	{
+		SendAllNotesOff();
+		__atomic_store_n(&m_State, TState::Idle, __ATOMIC_RELEASE);
+		return nMaxFrames;
+	}
+
+	while (true)
+	{
+		if (m_nReadIndex == __atomic_load_n(&m_nWriteIndex, __ATOMIC_ACQUIRE))
+		{
+			// The end of the file is flagged after its last events are written, so check for those again
+			if (__atomic_load_n(&m_bEndOfFile, __ATOMIC_ACQUIRE) && m_nReadIndex == __atomic_load_n(&m_nWriteIndex, __ATOMIC_ACQUIRE))
+				__atomic_store_n(&m_State, TState::Idle, __ATOMIC_RELEASE);
+
+			// Otherwise the reader has fallen behind; the playback position is held until it catches up
+			return nMaxFrames;
+		}
+
+		const TEvent& Event = m_pRing[m_nReadIndex & (RingEvents - 1)];
+
+		// Not due yet; render up to it
+		const s32 nFramesUntilEvent = static_cast<s32>(Event.nFrame - m_nPlaybackFrame);
+		if (nFramesUntilEvent > 0)
+		{
+			const size_t nFrames = Utility::Min(nMaxFrames, static_cast<size_t>(nFramesUntilEvent));
+			m_nPlaybackFrame += nFrames;
+			return nFrames;
+		}
+
+		if ((Event.nMessage & 0xFF) == 0xF0)
+		{
+			// Gather the data from the slots that follow, which may wrap around the end of the ring
+			const size_t nSize = Event.nMessage >> 8;
+			for (size_t i = 0; i < nSize; ++i)
+				m_SysExBuffer[i] = reinterpret_cast<const u8*>(&m_pRing[(m_nReadIndex + 1 + i / sizeof(TEvent)) & (RingEvents - 1)])[i % sizeof(TEvent)];
+
+			__atomic_store_n(&m_nReadIndex, m_nReadIndex + 1 + (nSize + sizeof(TEvent) - 1) / sizeof(TEvent), __ATOMIC_RELEASE);
+			m_pSysExMessageHandler(m_SysExBuffer, nSize);
+		}
+		else
+		{
+			const u32 nMessage = Event.nMessage;
+			__atomic_store_n(&m_nReadIndex, m_nReadIndex + 1, __ATOMIC_RELEASE);
+			m_pShortMessageHandler(nMessage);
+		}
+	}
+}
+
+bool CMIDIPlayer::Open(size_t nIndex)
+{
+	CLogger* const pLogger = CLogger::Get();
+
+	if (!m_pRing)
+	{
+		m_pRing   = new TEvent[RingEvents];
+		m_pTracks = new TTrack[MaxTracks];
+	}
+
+	// Find the file; indices past the end wrap around
+	DIR Dir;
+	FILINFO FileInfo;
+	size_t nFiles = 0;
+	bool bFound = false;
+
+	for (size_t nPass = 0; nPass < 2 && !bFound; ++nPass)
+	{
+		FRESULT Result = f_findfirst(&Dir, &FileInfo, MIDIPath, "*.mid");
+		while (Result == FR_OK && *FileInfo.fname)
+		{
+			if (!(FileInfo.fattrib & (AM_DIR | AM_HID | AM_SYS)))
+			{
+				if (nFiles++ == nIndex)
+				{
+					bFound = true;
+					break;
+				}
+			}
+
+			Result = f_findnext(&Dir, &FileInfo);
+		}
+		f_closedir(&Dir);
+
+		if (!nFiles)
+			break;
+
+		nIndex %= nFiles;
+		nFiles = 0;
+	}
+
+	if (!bFound)
+	{
+		pLogger->Write(MIDIPlayerName, LogWarning, "No MIDI files found in '%s'", MIDIPath);
+		return false;
+	}
+
+	char Path[sizeof(MIDIPath) + FF_LFN_BUF + 1];
+	snprintf(Path, sizeof(Path), "%s/%s", MIDIPath, FileInfo.fname);
+	strcpy(m_FileName, FileInfo.fname);
+	m_nFileIndex = nIndex;
+
+	if (f_open(&m_File, Path, FA_READ) != FR_OK)
+	{
+		pLogger->Write(MIDIPlayerName, LogError, "Couldn't open '%s' for reading", Path);
+		return false;
+	}
+	m_bFileOpen = true;
+
+	// Header chunk
+	u8 Header[14];
+	UINT nRead;
+	if (f_read(&m_File, Header, sizeof(Header), &nRead) != FR_OK || nRead != sizeof(Header) || memcmp(Header, "MThd", 4) != 0)
+	{
+		pLogger->Write(MIDIPlayerName, LogError, "'%s' is not a Standard MIDI File", m_FileName);
+		Close();
+		return false;
+	}
+
+	const u32 nHeaderSize = Header[4] << 24 | Header[5] << 16 | Header[6] << 8 | Header[7];
+	const u16 nFormat     = Header[8] << 8 | Header[9];
+	const u16 nDivision   = Header[12] << 8 | Header[13];
+
+	// Format 2 files hold independent sequences, not parts to be played together
+	if (nFormat > 1 || !nDivision)
+	{
+		pLogger->Write(MIDIPlayerName, LogError, "'%s' is an unsupported MIDI file (format %d)", m_FileName, nFormat);
+		Close();
+		return false;
+	}
+
+	// Find the tracks; unknown chunks are skipped
+	const u32 nFileSize = f_size(&m_File);
+	u32 nOffset = 8 + nHeaderSize;
+	m_nTracks = 0;
+
+	while (nOffset + 8 <= nFileSize && m_nTracks < MaxTracks)
+	{
+		u8 ChunkHeader[8];
+		if (f_lseek(&m_File, nOffset) != FR_OK || f_read(&m_File, ChunkHeader, sizeof(ChunkHeader), &nRead) != FR_OK || nRead != sizeof(ChunkHeader))
+			break;
+
+		const u32 nChunkSize = ChunkHeader[4] << 24 | ChunkHeader[5] << 16 | ChunkHeader[6] << 8 | ChunkHeader[7];
+		nOffset += 8;
+
+		if (memcmp(ChunkHeader, "MTrk", 4) == 0)
+		{
+			TTrack& Track         = m_pTracks[m_nTracks++];
+			Track.nNextOffset     = nOffset;
+			Track.nEndOffset      = Utility::Min(nOffset + nChunkSize, nFileSize);
+			Track.nNextTick       = 0;
+			Track.nRunningStatus  = 0;
+			Track.bDone           = false;
+			Track.nWindowPosition = 0;
+			Track.nWindowSize     = 0;
+			ReadDeltaTime(Track);
+		}
+
+		nOffset += nChunkSize;
+	}
+
+	// Negative upper byte is an SMPTE frame rate, with the lower byte being ticks per frame
+	m_nDivision       = nDivision;
+	m_nTicksPerSecond = (nDivision & 0x8000) ? -static_cast<s8>(nDivision >> 8) * (nDivision & 0xFF) : 0;
+	m_nTempo          = DefaultTempo;
+	m_nTempoTick      = 0;
+	m_nTempoMicros    = 0;
+
+	// The audio core is idle, so the ring can be reset from here
+	m_nWriteIndex    = 0;
+	m_nReadIndex     = 0;
+	m_nPlaybackFrame = 0;
+	m_bEndOfFile     = false;
+
+	FillRing();
+
+	pLogger->Write(MIDIPlayerName, LogNotice, "Playing '%s' (%u tracks)", m_FileName, static_cast<unsigned int>(m_nTracks));
+	__atomic_store_n(&m_State, TState::Playing, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+void CMIDIPlayer::Close()
+{
+	if (!m_bFileOpen)
+		return;
+
+	f_close(&m_File);
+	m_bFileOpen = false;
+}
+
+void CMIDIPlayer::FillRing()
+{
+	// Merge tracks until there may not be room for the largest event
+	while (RingEvents - (m_nWriteIndex - __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE)) >= MaxSysExEvents)
+	{
+		// Earliest event next; ties go to the lowest track, as the tracks are played in parallel
+		TTrack* pNextTrack = nullptr;
+		for (size_t i = 0; i < m_nTracks; ++i)
+		{
+			TTrack& Track = m_pTracks[i];
+			if (!Track.bDone && (!pNextTrack || Track.nNextTick < pNextTrack->nNextTick))
+				pNextTrack = &Track;
+		}
+
+		if (!pNextTrack)
+		{
+			__atomic_store_n(&m_bEndOfFile, true, __ATOMIC_RELEASE);
+			return;
+		}
+
+		if (!ReadEvent(*pNextTrack))
+		{
+			CLogger::Get()->Write(MIDIPlayerName, LogWarning, "Track %u of '%s' is truncated or corrupt", static_cast<unsigned int>(pNextTrack - m_pTracks), m_FileName);
+			pNextTrack->bDone = true;
+		}
+		else
+			ReadDeltaTime(*pNextTrack);
+	}
+}
+
+bool CMIDIPlayer::ReadByte(TTrack& Track, u8& nByte)
+{
+	if (Track.nWindowPosition == Track.nWindowSize)
+	{
+		if (Track.nNextOffset >= Track.nEndOffset)
+			return false;
+
+		// Tracks are read in small windows, so a file is never held in memory all at once
+		const u32 nBytes = Utility::Min(static_cast<u32>(sizeof(Track.Window)), Track.nEndOffset - Track.nNextOffset);
+		UINT nRead;
+
+		if (f_tell(&m_File) != Track.nNextOffset && f_lseek(&m_File, Track.nNextOffset) != FR_OK)
+			return false;
+
+		if (f_read(&m_File, Track.Window, nBytes, &nRead) != FR_OK || nRead != nBytes)
+			return false;
+
+		Track.nNextOffset += nBytes;
+		Track.nWindowPosition = 0;
+		Track.nWindowSize     = nBytes;
+	}
+
+	nByte = Track.Window[Track.nWindowPosition++];
+	return true;
+}
+
+bool CMIDIPlayer::ReadVarLen(TTrack& Track, u32& nValue)
+{
+	nValue = 0;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		u8 nByte;
+		if (!ReadByte(Track, nByte))
+			return false;
+
+		nValue = (nValue << 7) | (nByte & 0x7F);
+		if (!(nByte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+bool CMIDIPlayer::Skip(TTrack& Track, u32 nBytes)
+{
+	const u32 nBuffered = Track.nWindowSize - Track.nWindowPosition;
+	if (nBytes <= nBuffered)
+	{
+		Track.nWindowPosition += nBytes;
+		return true;
+	}
+
+	nBytes -= nBuffered;
+	Track.nWindowPosition = Track.nWindowSize;
+
+	if (nBytes > Track.nEndOffset - Track.nNextOffset)
+		return false;
+
+	Track.nNextOffset += nBytes;
+	return true;
+}
+
+void CMIDIPlayer::ReadDeltaTime(TTrack& Track)
+{
+	if (Track.bDone)
+		return;
+
+	// A track that ends without an end of track event is simply finished
+	u32 nDelta;
+	if (ReadVarLen(Track, nDelta))
+		Track.nNextTick += nDelta;
+	else
+		Track.bDone = true;
+}
+
+bool CMIDIPlayer::ReadEvent(TTrack& Track)
+{
+	u8 nStatus;
+	if (!ReadByte(Track, nStatus))
+		return false;
+
+	// Running status; this byte is the first data byte
+	u8 Data[2];
+	size_t nDataRead = 0;
+	if (!(nStatus & 0x80))
+	{
+		if (!Track.nRunningStatus)
+			return false;
+
+		Data[nDataRead++] = nStatus;
+		nStatus = Track.nRunningStatus;
+	}
+
+	// Meta event; only tempo changes and the end of the track matter
+	if (nStatus == 0xFF)
+	{
+		u8 nType;
+		u32 nLength;
+		if (!ReadByte(Track, nType) || !ReadVarLen(Track, nLength))
+			return false;
+
+		if (nType == 0x2F)
+		{
+			Track.bDone = true;
+			return true;
+		}
+
+		if (nType == 0x51 && nLength == 3)
+		{
+			u8 Tempo[3];
+			for (u8& nByte : Tempo)
+				if (!ReadByte(Track, nByte))
+					return false;
+
+			// Later events are timed from this point
+			if (!m_nTicksPerSecond)
+			{
+				m_nTempoMicros = m_nTempoMicros + (Track.nNextTick - m_nTempoTick) * m_nTempo / m_nDivision;
+				m_nTempoTick   = Track.nNextTick;
+				m_nTempo       = Tempo[0] << 16 | Tempo[1] << 8 | Tempo[2];
+			}
+
+			return true;
+		}
+
+		return Skip(Track, nLength);
+	}
+
+	const u32 nFrame = TickToFrame(Track.nNextTick);
+
+	// SysEx; the F0 is implied and the data normally ends with F7
+	if (nStatus == 0xF0)
+	{
+		Track.nRunningStatus = 0;
+
+		u32 nLength;
+		if (!ReadVarLen(Track, nLength))
+			return false;
+
+		const size_t nSize = nLength + 1;
+		if (nSize > MaxSysExSize)
+		{
+			CLogger::Get()->Write(MIDIPlayerName, LogWarning, "Skipping %u byte SysEx message", static_cast<unsigned int>(nSize));
+			return Skip(Track, nLength);
+		}
+
+		// Data goes into the slots after the event, which become visible to the audio core together with it
+		u8 nByte = 0xF0;
+		for (size_t i = 0; i < nSize; ++i)
+		{
+			if (i && !ReadByte(Track, nByte))
+				return false;
+
+			reinterpret_cast<u8*>(&m_pRing[(m_nWriteIndex + 1 + i / sizeof(TEvent)) & (RingEvents - 1)])[i % sizeof(TEvent)] = nByte;
+		}
+
+		m_pRing[m_nWriteIndex & (RingEvents - 1)] = {nFrame, static_cast<u32>(0xF0 | nSize << 8)};
+		__atomic_store_n(&m_nWriteIndex, m_nWriteIndex + 1 + (nSize + sizeof(TEvent) - 1) / sizeof(TEvent), __ATOMIC_RELEASE);
+
+		return true;
+	}
+
+	// Escaped data (split SysEx or real-time messages) is rare in practice and isn't supported
+	if (nStatus == 0xF7)
+	{
+		Track.nRunningStatus = 0;
+
+		u32 nLength;
+		return ReadVarLen(Track, nLength) && Skip(Track, nLength);
+	}
+
+	// Other system messages can't appear in a MIDI file
+	if (nStatus > 0xF0)
+		return false;
+
+	// Channel message; program change and channel pressure have one data byte
+	const size_t nDataBytes = (nStatus & 0xE0) == 0xC0 ? 1 : 2;
+	while (nDataRead < nDataBytes)
+		if (!ReadByte(Track, Data[nDataRead++]))
+			return false;
+
+	Track.nRunningStatus = nStatus;
+	PushEvent(nFrame, nStatus | Data[0] << 8 | (nDataBytes == 2 ? Data[1] << 16 : 0));
+
+	return true;
+}
+
+u32 CMIDIPlayer::TickToFrame(u64 nTick) const
+{
+	const u64 nMicros = m_nTicksPerSecond ? nTick * 1000000 / m_nTicksPerSecond : m_nTempoMicros + (nTick - m_nTempoTick) * m_nTempo / m_nDivision;
+	return nMicros * m_nSampleRate / 1000000;
+}
+
+void CMIDIPlayer::PushEvent(u32 nFrame, u32 nMessage)
+{
+	m_pRing[m_nWriteIndex & (RingEvents - 1)] = {nFrame, nMessage};
+	__atomic_store_n(&m_nWriteIndex, m_nWriteIndex + 1, __ATOMIC_RELEASE);
+}
+
+void CMIDIPlayer::SendAllNotesOff()
+{
+	// Reset All Controllers first to release the sustain pedal, then All Notes Off
+	for (u8 nChannel = 0; nChannel < 16; ++nChannel)
+	{
+		m_pShortMessageHandler(0xB0 | nChannel | 121 << 8);
+		m_pShortMessageHandler(0xB0 | nChannel | 123 << 8);
+	}
+}
@@ -27,6 +27,7 @@
 
 #include <cstdarg>
 
+#include "audio/sampleconverter.h"
 #include "lcd/hd44780.h"
 #include "lcd/ssd1306.h"
 #include "mt32pi.h"
@@ -39,8 +40,18 @@ constexpr u32 LEDTimeoutMillis                     = 50;
 constexpr u32 ActiveSenseTimeoutMillis             = 330;
 constexpr u32 DeferredSoundFontSwitchTimeoutMillis = 1000;
 
-constexpr float Sample16BitMax = (1 << 16 - 1) - 1;
-constexpr float Sample24BitMax = (1 << 24 - 1) - 1;
+// How long output must stay silent before the audio core stops rendering
+constexpr u32 AudioIdleHoldMillis = 100;
+
+const char AudioCalibrationPath[] = "mt32-pi-calibration.cfg";
+
+// More notes than the MT-32 has partials, so that every partial is in use
+constexpr size_t MT32CalibrationNotes = 64;
+
+// Queued USB MIDI packets: up to 3 MIDI bytes, cable number, byte count, and whether the bytes are a complete short message
+constexpr u32 USBMIDIPacketCableShift   = 24;
+constexpr u32 USBMIDIPacketLengthShift  = 28;
+constexpr u32 USBMIDIPacketShortMessage = 1u << 31;
 
 enum class TCustomSysExCommand : u8
 {
@@ -48,13 +59,15 @@ enum class TCustomSysExCommand : u8
 	SwitchMT32ROMSet = 0x01,
 	SwitchSoundFont  = 0x02,
 	SwitchSynth      = 0x03,
+	GetAudioStats    = 0x04,
+	SetAudioCapture  = 0x05,
+	PlayMIDIFile     = 0x06,
 };
 
 CMT32Pi* CMT32Pi::s_pThis = nullptr;
 
 CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSystem* pInterrupt, CGPIOManager* pGPIOManager, CSerialDevice* pSerialDevice, CUSBHCIDevice* pUSBHCI)
 	: CMultiCoreSupport(CMemorySystem::Get()),
-	  CMIDIParser(),
 
 	  m_pTimer(CTimer::Get()),
 	  m_pActLED(CActLED::Get()),
@@ -79,7 +92,10 @@ CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSyste
 
 	  m_bSerialMIDIAvailable(false),
 	  m_bSerialMIDIEnabled(false),
-	  m_pUSBMIDIDevice(nullptr),
+	  m_SerialMIDIOutput(pSerialDevice),
+	  m_USBMIDIDevices{},
+	  m_USBMIDICableRoutes{TMIDIRoute::Default},
+	  m_USBMIDIThru(TMIDIThru::Off),
 
 	  m_bActiveSenseFlag(false),
 	  m_nActiveSenseTime(0),
@@ -88,14 +104,26 @@ CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSyste
 	  m_bUITaskDone(false),
 	  m_bLEDOn(false),
 	  m_nLEDOnTime(0),
+	  m_nHeldButtons(0),
+	  m_bButtonComboPressed(false),
 
 	  m_pSound(nullptr),
+	  m_pAudioScheduler(nullptr),
+	  m_bAudioReady(false),
+	  m_bShowAudioStats(false),
 	  m_pPisound(nullptr),
 
 	  m_nMasterVolume(100),
 	  m_pCurrentSynth(nullptr),
 	  m_pMT32Synth(nullptr),
-	  m_pSoundFontSynth(nullptr)
+	  m_pSoundFontSynth(nullptr),
+
+	  m_bDualSynth(false),
+	  m_nMT32ChannelMask(0xFFFF),
+
+	  m_SerialMIDIInput(*this, "serial"),
+	  m_PisoundMIDIInput(*this, "Pisound"),
+	  m_nNextMIDIInput(0)
 {
 	s_pThis = this;
 }
@@ -112,6 +140,15 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 	m_bSerialMIDIAvailable = bSerialMIDIAvailable;
 	m_bSerialMIDIEnabled = bSerialMIDIAvailable;
 
+	m_USBMIDICableRoutes[0] = pConfig->MIDIUSBCable1Route;
+	m_USBMIDICableRoutes[1] = pConfig->MIDIUSBCable2Route;
+	m_USBMIDICableRoutes[2] = pConfig->MIDIUSBCable3Route;
+	m_USBMIDICableRoutes[3] = pConfig->MIDIUSBCable4Route;
+
+	m_USBMIDIThru = pConfig->MIDIUSBThru;
+	m_SerialMIDIInput.SetThru(pConfig->MIDIGPIOThru);
+	m_PisoundMIDIInput.SetThru(pConfig->MIDIPisoundThru);
+
 	if (pConfig->LCDType == CConfig::TLCDType::HD44780FourBit)
 		m_pLCD = new CHD44780FourBit(pConfig->LCDWidth, pConfig->LCDHeight);
 	else if (pConfig->LCDType == CConfig::TLCDType::HD44780I2C)
@@ -147,8 +184,7 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 	if (m_pPisound->Initialize())
 	{
 		pLogger->Write(MT32PiName, LogWarning, "Blokas Pisound detected");
-		m_pPisound->RegisterMIDIReceiveHandler(MIDIReceiveHandler);
-		m_bSerialMIDIEnabled = false;
+		m_pPisound->RegisterMIDIReceiveHandler(PisoundMIDIReceiveHandler);
 	}
 	else
 	{
@@ -156,28 +192,6 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		m_pPisound = nullptr;
 	}
 
-	if (pConfig->AudioOutputDevice == CConfig::TAudioOutputDevice::I2SDAC)
-	{
-		LCDLog(TLCDLogType::Startup, "Init audio (I2S)");
-
-		// Pisound provides clock
-		const bool bSlave = m_pPisound != nullptr;
-		m_pSound = new CI2SSoundBaseDevice(m_pInterrupt, pConfig->AudioSampleRate, pConfig->AudioChunkSize, bSlave);
-		m_pSound->SetWriteFormat(TSoundFormat::SoundFormatSigned24);
-
-		if (pConfig->AudioI2CDACInit == CConfig::TAudioI2CDACInit::PCM51xx)
-			InitPCM51xx(pConfig->AudioI2CDACAddress);
-	}
-	else
-	{
-		LCDLog(TLCDLogType::Startup, "Init audio (PWM)");
-		m_pSound = new CPWMSoundBaseDevice(m_pInterrupt, pConfig->AudioSampleRate, pConfig->AudioChunkSize);
-		m_pSound->SetWriteFormat(TSoundFormat::SoundFormatSigned16);
-	}
-
-	if (!m_pSound->AllocateQueueFrames(pConfig->AudioChunkSize))
-		pLogger->Write(MT32PiName, LogPanic, "Failed to allocate sound queue");
-
 	LCDLog(TLCDLogType::Startup, "Init controls");
 	if (pConfig->ControlScheme == CConfig::TControlScheme::SimpleButtons)
 		m_pControl = new CControlSimpleButtons(m_EventQueue);
@@ -192,7 +206,7 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 	}
 
 	LCDLog(TLCDLogType::Startup, "Init mt32emu");
-	m_pMT32Synth = new CMT32Synth(pConfig->AudioSampleRate, pConfig->MT32EmuResamplerQuality);
+	m_pMT32Synth = new CMT32Synth(pConfig->AudioSampleRate, pConfig->MT32EmuResamplerQuality, pConfig->MT32EmuResamplerGovernor);
 	if (!m_pMT32Synth->Initialize())
 	{
 		pLogger->Write(MT32PiName, LogWarning, "mt32emu init failed; no ROMs present?");
@@ -204,8 +218,19 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 	if (pConfig->MT32EmuMIDIChannels == CMT32Synth::TMIDIChannels::Alternate)
 		m_pMT32Synth->SetMIDIChannels(pConfig->MT32EmuMIDIChannels);
 
+	// In dual synth mode the whole SoundFont synth renders on core 3, so it can't also use it for voice rendering
 	LCDLog(TLCDLogType::Startup, "Init FluidSynth");
-	m_pSoundFontSynth = new CSoundFontSynth(pConfig->AudioSampleRate, pConfig->FluidSynthGain, pConfig->FluidSynthPolyphony);
+	const unsigned int nFluidSynthCores = pConfig->SystemDualSynth ? 1 : 2;
+
+	// Give FluidSynth as many sets of 16 channels as the USB cable routes use
+	unsigned int nFluidSynthChannels = 16;
+	for (TMIDIRoute Route : m_USBMIDICableRoutes)
+	{
+		if (Route >= TMIDIRoute::SoundFont)
+			nFluidSynthChannels = Utility::Max(nFluidSynthChannels, (static_cast<unsigned int>(Route) - static_cast<unsigned int>(TMIDIRoute::SoundFont) + 1) * 16);
+	}
+
+	m_pSoundFontSynth = new CSoundFontSynth(pConfig->AudioSampleRate, pConfig->FluidSynthGain, pConfig->FluidSynthPolyphony, nFluidSynthCores, pConfig->FluidSynthPolyphonyGovernor, nFluidSynthChannels);
 	if (!m_pSoundFontSynth->Initialize())
 	{
 		pLogger->Write(MT32PiName, LogWarning, "FluidSynth init failed; no SoundFonts present?");
@@ -213,6 +238,9 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		m_pSoundFontSynth = nullptr;
 	}
 
+	m_MT32MIDICoalescer.SetSynth(m_pMT32Synth);
+	m_SoundFontMIDICoalescer.SetSynth(m_pSoundFontSynth);
+
 	// Set initial synthesizer
 	if (pConfig->SystemDefaultSynth == CConfig::TSystemDefaultSynth::MT32)
 		m_pCurrentSynth = m_pMT32Synth;
@@ -236,16 +264,84 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		}
 	}
 
+	// Give the other cores something to read before the audio core starts publishing
+	PublishSynthStates();
+
+	if (pConfig->SystemDualSynth)
+	{
+		if (m_pMT32Synth && m_pSoundFontSynth)
+		{
+			// Channels below the split channel go to the MT-32
+			const int nSplitChannel = Utility::Clamp(pConfig->SystemSplitChannel, 1, 17);
+			m_nMT32ChannelMask = (1 << (nSplitChannel - 1)) - 1;
+			m_bDualSynth = true;
+			pLogger->Write(MT32PiName, LogNotice, "Dual synth mode; channels %d-16 go to FluidSynth", nSplitChannel);
+		}
+		else
+			pLogger->Write(MT32PiName, LogWarning, "Dual synth mode needs both synths; disabled");
+	}
+
 	if (m_pPisound)
 		pLogger->Write(MT32PiName, LogNotice, "Using Pisound MIDI interface");
-	else if (m_bSerialMIDIEnabled)
+	if (m_bSerialMIDIEnabled)
 		pLogger->Write(MT32PiName, LogNotice, "Using serial MIDI interface");
-	else
+	else if (!m_pPisound)
 		pLogger->Write(MT32PiName, LogError, "No USB MIDI device or Pisound detected and serial port in use");
 
 	CCPUThrottle::Get()->DumpStatus();
 	SetPowerSaveTimeout(pConfig->SystemPowerSaveTimeout);
 
+	// Start other cores; the UI and audio tasks wait for audio to be set up, but the core worker
+	// must already be running for FluidSynth to render during calibration
+	if (!CMultiCoreSupport::Initialize())
+		return false;
+
+	// Audio is rendered in fixed power-of-two blocks, one block per DMA chunk
+	size_t nBlockFrames = CAudioScheduler::GetBlockFramesForChunkSize(pConfig->AudioChunkSize);
+	size_t nPeriods = pConfig->AudioPeriods;
+
+	if (pConfig->AudioCalibration != CConfig::TAudioCalibration::Off)
+		CalibrateAudio(nBlockFrames, nPeriods);
+	else if (nBlockFrames * 2 != static_cast<size_t>(pConfig->AudioChunkSize))
+		pLogger->Write(MT32PiName, LogWarning, "Chunk size rounded down to %u samples", static_cast<unsigned int>(nBlockFrames * 2));
+
+	const size_t nChunkSize = nBlockFrames * 2;
+
+	if (pConfig->AudioOutputDevice == CConfig::TAudioOutputDevice::I2SDAC)
+	{
+		LCDLog(TLCDLogType::Startup, "Init audio (I2S)");
+
+		// Pisound provides clock
+		const bool bSlave = m_pPisound != nullptr;
+		m_pSound = new CI2SSoundBaseDevice(m_pInterrupt, pConfig->AudioSampleRate, nChunkSize, bSlave);
+		m_pSound->SetWriteFormat(TSoundFormat::SoundFormatSigned24);
+
+		if (pConfig->AudioI2CDACInit == CConfig::TAudioI2CDACInit::PCM51xx)
+			InitPCM51xx(pConfig->AudioI2CDACAddress);
+	}
+	else
+	{
+		LCDLog(TLCDLogType::Startup, "Init audio (PWM)");
+		m_pSound = new CPWMSoundBaseDevice(m_pInterrupt, pConfig->AudioSampleRate, nChunkSize);
+		m_pSound->SetWriteFormat(TSoundFormat::SoundFormatSigned16);
+	}
+
+	m_pAudioScheduler = new CAudioScheduler(m_pSound, nBlockFrames, nPeriods);
+	if (!m_pAudioScheduler->Initialize())
+		pLogger->Write(MT32PiName, LogPanic, "Failed to allocate sound queue");
+
+	// Bound how long the main core may stall waiting for room in a synth's MIDI queue
+	const unsigned nBlockMicros = (nBlockFrames * 1000000 + pConfig->AudioSampleRate - 1) / pConfig->AudioSampleRate;
+	m_MT32MIDICoalescer.SetMaxWait(nBlockMicros);
+	m_SoundFontMIDICoalescer.SetMaxWait(nBlockMicros);
+
+	const bool b24Bit = pConfig->AudioOutputDevice == CConfig::TAudioOutputDevice::I2SDAC;
+	m_AudioCapture.Initialize(pConfig->AudioSampleRate, b24Bit ? sizeof(s32) : sizeof(s16));
+
+	m_MIDIPlayer.Initialize(pConfig->AudioSampleRate, MIDIPlayerShortMessageHandler, MIDIPlayerSysExMessageHandler);
+	if (pConfig->MIDIPlayerAutoPlay)
+		m_MIDIPlayer.Play(0, true);
+
 	// Attach LCD to synths and clear
 	if (m_pLCD)
 	{
@@ -260,13 +356,69 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 	// Start audio
 	m_pSound->Start();
 
-	// Start other cores
-	if (!CMultiCoreSupport::Initialize())
-		return false;
+	// Release the UI and audio tasks
+	m_bAudioReady = true;
+	DataSyncBarrier();
+	SendEvent();
 
 	return true;
 }
 
+void CMT32Pi::CalibrateAudio(size_t& nBlockFrames, size_t& nPeriods)
+{
+	CConfig* const pConfig = CConfig::Get();
+	CLogger* const pLogger = CLogger::Get();
+
+	// Anything that changes the render load or the deadline invalidates saved results
+	const u32 SetupFields[] =
+	{
+		static_cast<u32>(pConfig->AudioSampleRate),
+		static_cast<u32>(pConfig->AudioOutputDevice),
+		CCPUThrottle::Get()->GetClockRate(),
+		static_cast<u32>(pConfig->MT32EmuResamplerQuality),
+		pConfig->MT32EmuResamplerGovernor,
+		static_cast<u32>(pConfig->FluidSynthSoundFont),
+		static_cast<u32>(pConfig->FluidSynthPolyphony),
+		pConfig->FluidSynthPolyphonyGovernor,
+		m_bDualSynth,
+		m_pMT32Synth != nullptr,
+		m_pSoundFontSynth != nullptr,
+	};
+
+	// FNV-1a
+	u32 nSignature = 2166136261u;
+	for (u32 nField : SetupFields)
+		nSignature = (nSignature ^ nField) * 16777619u;
+
+	CAudioCalibrator::TResult Result;
+	const bool bUseSaved = pConfig->AudioCalibration == CConfig::TAudioCalibration::Saved;
+
+	if (bUseSaved && CAudioCalibrator::Load(AudioCalibrationPath, nSignature, Result))
+		pLogger->Write(MT32PiName, LogNotice, "Using saved audio calibration");
+	else
+	{
+		LCDLog(TLCDLogType::Startup, "Calibrating audio");
+
+		const bool b24Bit = pConfig->AudioOutputDevice == CConfig::TAudioOutputDevice::I2SDAC;
+		CAudioCalibrator Calibrator(pConfig->AudioSampleRate, CCPUThrottle::Get()->GetClockRate());
+
+		// Whichever synth is active (or both at once, on separate cores) must keep up
+		if (m_pMT32Synth)
+			Calibrator.Measure(*m_pMT32Synth, "mt32emu", MT32CalibrationNotes, b24Bit);
+		if (m_pSoundFontSynth)
+			Calibrator.Measure(*m_pSoundFontSynth, "FluidSynth", pConfig->FluidSynthPolyphony, b24Bit);
+
+		Result = Calibrator.GetResult();
+
+		if (bUseSaved && !CAudioCalibrator::Save(AudioCalibrationPath, nSignature, Result))
+			pLogger->Write(MT32PiName, LogWarning, "Couldn't save audio calibration");
+	}
+
+	nBlockFrames = Result.nBlockFrames;
+	nPeriods = Utility::Max(nPeriods, Result.nPeriods);
+	pLogger->Write(MT32PiName, LogNotice, "Audio calibrated: chunk size %u, %u periods", static_cast<unsigned int>(nBlockFrames * 2), static_cast<unsigned int>(nPeriods));
+}
+
 void CMT32Pi::MainTask()
 {
 	CLogger* const pLogger = CLogger::Get();
@@ -298,13 +450,19 @@ void CMT32Pi::MainTask()
 		// Check for active sensing timeout
 		if (m_bActiveSenseFlag && (ticks > m_nActiveSenseTime) && (ticks - m_nActiveSenseTime) >= MSEC2HZ(ActiveSenseTimeoutMillis))
 		{
-			m_pCurrentSynth->AllSoundOff();
+			if (m_bDualSynth)
+			{
+				m_pMT32Synth->AllSoundOff();
+				m_pSoundFontSynth->AllSoundOff();
+			}
+			else
+				m_pCurrentSynth->AllSoundOff();
 			m_bActiveSenseFlag = false;
 			pLogger->Write(MT32PiName, LogNotice, "Active sense timeout - turning notes off");
 		}
 
 		// Update power management
-		if (m_pCurrentSynth->IsActive())
+		if (IsSynthActive() || m_MIDIPlayer.IsPlaying())
 			Awaken();
 
 		CPower::Update();
@@ -321,19 +479,13 @@ void CMT32Pi::MainTask()
 
 		// Check for USB PnP events
 		if (CConfig::Get()->MIDIUSB && m_pUSBHCI->UpdatePlugAndPlay())
-		{
-			if (!m_pUSBMIDIDevice && (m_pUSBMIDIDevice = static_cast<CUSBMIDIDevice*>(CDeviceNameService::Get()->GetDevice("umidi1", FALSE))))
-			{
-				m_pUSBMIDIDevice->RegisterRemovedHandler(USBDeviceRemovedHandler);
-				m_pUSBMIDIDevice->RegisterPacketHandler(USBMIDIPacketHandler);
-				pLogger->Write(MT32PiName, LogNotice, "Using USB MIDI interface");
-				m_bSerialMIDIEnabled = false;
-			}
-		}
+			AttachUSBMIDIDevices();
 	}
 
 	// Stop audio
+	m_pAudioScheduler->Stop();
 	m_pSound->Cancel();
+	m_CoreWorker.Stop();
 
 	// Wait for UI task to finish
 	while (!m_bUITaskDone)
@@ -343,11 +495,15 @@ void CMT32Pi::MainTask()
 void CMT32Pi::UITask()
 {
 	CLogger::Get()->Write(MT32PiName, LogNotice, "UI task on Core 1 starting up");
+	WaitForAudioReady();
 
 	// Display current MT-32 ROM version/SoundFont
 	m_pCurrentSynth->ReportStatus();
 
 	const bool bMisterEnabled = CConfig::Get()->ControlMister;
+	bool bShowingAudioStats = false;
+	u8 nResamplerQuality = static_cast<u8>(CMT32Synth::TResamplerQuality::None);
+	u32 nVoiceCap = 0;
 
 	while (m_bRunning)
 	{
@@ -356,7 +512,16 @@ void CMT32Pi::UITask()
 		// Update LCD
 		if (m_pLCD && (ticks - m_nLCDUpdateTime) >= MSEC2HZ(LCDUpdatePeriodMillis))
 		{
-			if (m_pCurrentSynth == m_pMT32Synth)
+			// Clear leftovers when switching between pages
+			if (bShowingAudioStats != m_bShowAudioStats)
+			{
+				bShowingAudioStats = m_bShowAudioStats;
+				m_pLCD->Clear(false);
+			}
+
+			if (bShowingAudioStats)
+				UpdateAudioStatsLCD();
+			else if (m_pCurrentSynth == m_pMT32Synth)
 				m_pLCD->Update(*m_pMT32Synth);
 			else
 				m_pLCD->Update(*m_pSoundFontSynth);
@@ -373,15 +538,65 @@ void CMT32Pi::UITask()
 			else if (m_pCurrentSynth == m_pSoundFontSynth)
 				Status.Synth = TMisterSynth::SoundFont;
 
+			TSynthState State;
 			if (m_pMT32Synth)
-				Status.MT32ROMSet = static_cast<u8>(m_pMT32Synth->GetROMSet());
+			{
+				m_pMT32Synth->GetState(State);
+				Status.MT32ROMSet = static_cast<u8>(State.ROMSet);
+			}
 
 			if (m_pSoundFontSynth)
-				Status.SoundFontIndex = m_pSoundFontSynth->GetSoundFontIndex();
+			{
+				m_pSoundFontSynth->GetState(State);
+				Status.SoundFontIndex = State.nSoundFontIndex;
+			}
 
 			m_MisterControl.Update(Status);
 			m_nMisterUpdateTime = ticks;
 		}
+
+		// The governors run on the audio core, which mustn't stall on logging, so their changes are reported from here
+		if (m_pMT32Synth)
+		{
+			TSynthState State;
+			m_pMT32Synth->GetState(State);
+
+			// The governor never goes as low as no resampling, so a change from it is only the first published state
+			if (State.nResamplerQuality != nResamplerQuality)
+			{
+				const auto Quality = static_cast<CMT32Synth::TResamplerQuality>(State.nResamplerQuality);
+				if (nResamplerQuality != static_cast<u8>(CMT32Synth::TResamplerQuality::None))
+					CLogger::Get()->Write(MT32PiName, LogNotice, "Resampler quality: %s", CMT32Synth::GetResamplerQualityName(Quality));
+				nResamplerQuality = State.nResamplerQuality;
+			}
+		}
+
+		if (m_pSoundFontSynth)
+		{
+			TSynthState State;
+			m_pSoundFontSynth->GetState(State);
+
+			// The cap is only worth reporting when it's lowered; it creeps back up in small steps once load drops
+			if (State.nVoiceCap < nVoiceCap)
+				CLogger::Get()->Write(MT32PiName, LogNotice, "Voice cap: %u", State.nVoiceCap);
+			nVoiceCap = State.nVoiceCap;
+		}
+
+		// Write captured audio to the SD card and read ahead in the playing MIDI file
+		if (m_FileAccessGate.Enter())
+		{
+			m_AudioCapture.Update();
+			if (m_MIDIPlayer.Update())
+				LCDLog(TLCDLogType::Notice, "Play %s", m_MIDIPlayer.GetFileName());
+			m_FileAccessGate.Leave();
+		}
+	}
+
+	if (m_FileAccessGate.Enter())
+	{
+		m_AudioCapture.Finish();
+		m_MIDIPlayer.Finish();
+		m_FileAccessGate.Leave();
 	}
 
 	// Clear screen
@@ -392,48 +607,157 @@ void CMT32Pi::UITask()
 }
 
 void CMT32Pi::AudioTask()
+{
+	CLogger::Get()->Write(MT32PiName, LogNotice, "Audio task on Core 2 starting up");
+	WaitForAudioReady();
+
+	m_AudioStats.Initialize(m_pAudioScheduler->GetBlockFrames(), CConfig::Get()->AudioSampleRate);
+
+	// Select output format once; the synth renders directly in the device's native format
+	if (CConfig::Get()->AudioOutputDevice == CConfig::TAudioOutputDevice::I2SDAC)
+		AudioTaskLoop<s32>();
+	else
+		AudioTaskLoop<s16>();
+}
+
+void CMT32Pi::WaitForAudioReady()
+{
+	while (!m_bAudioReady)
+		WaitForEvent();
+}
+
+template <class T>
+void CMT32Pi::AudioTaskLoop()
 {
 	CLogger* const pLogger = CLogger::Get();
-	pLogger->Write(MT32PiName, LogNotice, "Audio task on Core 2 starting up");
 
-	const bool bUse24Bit    = CConfig::Get()->AudioOutputDevice == CConfig::TAudioOutputDevice::I2SDAC;
-	const size_t nQueueSize = m_pSound->GetQueueSizeFrames();
-	float FloatBuffer[nQueueSize * 2];
-	s16 Int16Buffer[nQueueSize * 2];
-	s32 Int32Buffer[nQueueSize * 2];
+	const size_t nFrames = m_pAudioScheduler->GetBlockFrames();
+	const size_t nWriteBytes = nFrames * 2 * sizeof(T);
+	T OutputBuffer[nFrames * 2];
+	T SoundFontBuffer[m_bDualSynth ? nFrames * 2 : 1];
 
-	while (m_bRunning)
-	{
-		const size_t nFrames = nQueueSize - m_pSound->GetQueueFramesAvail();
-		m_pCurrentSynth->Render(FloatBuffer, nFrames);
+	// Once output has been silent for a while and the synths are idle, stop rendering and resend a zeroed block
+	// until MIDI arrives; queued MIDI is applied at the start of the next block, as it would have been anyway
+	const size_t nIdleHoldFrames = CConfig::Get()->AudioSampleRate * AudioIdleHoldMillis / 1000;
+	size_t nSilentFrames = 0;
+	bool bIdle = false;
 
-		size_t nWriteBytes;
-		int nResult;
+	// Sleep until the DMA interrupt makes room for a block, then render exactly one block
+	while (m_pAudioScheduler->WaitForBlock())
+	{
+		if (m_pAudioScheduler->IsUnderrun())
+			m_AudioStats.OnXrun();
 
-		if (bUse24Bit)
+		const u32 nBlockTicks = CTimer::GetClockTicks();
+		if (!bIdle || HasQueuedMIDI() || m_MIDIPlayer.IsPlaying())
 		{
-			nWriteBytes = nFrames * 2 * sizeof(*Int32Buffer);
+			bIdle = false;
 
-			// Convert to signed 24-bit integers
-			for (size_t i = 0; i < nFrames * 2; ++i)
-				Int32Buffer[i] = Utility::Clamp(FloatBuffer[i], -1.0f, 1.0f) * Sample24BitMax;
+			// Queued MIDI is spread over the block according to when it was received
+			if (m_bDualSynth)
+			{
+				m_pMT32Synth->BeginBlock(nBlockTicks, nFrames);
+				m_pSoundFontSynth->BeginBlock(nBlockTicks, nFrames);
+			}
+			else
+				m_pCurrentSynth->BeginBlock(nBlockTicks, nFrames);
 
-			nResult = m_pSound->Write(Int32Buffer, nWriteBytes);
+			// MIDI file events are applied between partial renders, so each lands on its exact frame
+			for (size_t nOffset = 0; nOffset < nFrames;)
+			{
+				const size_t nSegmentFrames = m_MIDIPlayer.Advance(nFrames - nOffset);
+
+				if (m_bDualSynth)
+					RenderDualSynth(OutputBuffer + nOffset * 2, SoundFontBuffer, nSegmentFrames);
+				else
+					m_pCurrentSynth->Render(OutputBuffer + nOffset * 2, nSegmentFrames);
+
+				nOffset += nSegmentFrames;
+			}
+
+			PublishSynthStates();
+
+			if (!SampleConverter::IsSilent(OutputBuffer, nFrames * 2))
+				nSilentFrames = 0;
+			else if ((nSilentFrames += nFrames) >= nIdleHoldFrames && !IsSynthActive())
+			{
+				memset(OutputBuffer, 0, nWriteBytes);
+				nSilentFrames = 0;
+				bIdle = true;
+			}
 		}
 		else
+			PublishSynthStates();
+		m_AudioStats.OnBlockRendered(CTimer::GetClockTicks() - nBlockTicks);
+
+		m_AudioCapture.Capture(OutputBuffer, nWriteBytes);
+		if (m_pSound->Write(OutputBuffer, nWriteBytes) != static_cast<int>(nWriteBytes))
 		{
-			nWriteBytes = nFrames * 2 * sizeof(*Int16Buffer);
+			m_AudioStats.OnShortWrite();
+			pLogger->Write(MT32PiName, LogError, "Sound data dropped");
+		}
+	}
+}
 
-			// Convert to signed 16-bit integers
-			for (size_t i = 0; i < nFrames * 2; ++i)
-				Int16Buffer[i] = Utility::Clamp(FloatBuffer[i], -1.0f, 1.0f) * Sample16BitMax;
+void CMT32Pi::PublishSynthStates()
+{
+	// Both synths are published even when only one is in use, as the MiSTer status reports on both
+	if (m_pMT32Synth)
+		m_pMT32Synth->PublishState();
+	if (m_pSoundFontSynth)
+		m_pSoundFontSynth->PublishState();
+}
 
-			nResult = m_pSound->Write(Int16Buffer, nWriteBytes);
-		}
+bool CMT32Pi::IsSynthActive() const
+{
+	TSynthState State;
 
-		if (nResult != static_cast<int>(nWriteBytes))
-			pLogger->Write(MT32PiName, LogError, "Sound data dropped");
+	if (!m_bDualSynth)
+	{
+		m_pCurrentSynth->GetState(State);
+		return State.bActive;
 	}
+
+	m_pMT32Synth->GetState(State);
+	if (State.bActive)
+		return true;
+
+	m_pSoundFontSynth->GetState(State);
+	return State.bActive;
+}
+
+bool CMT32Pi::HasQueuedMIDI() const
+{
+	return m_bDualSynth ? m_pMT32Synth->HasQueuedMIDI() || m_pSoundFontSynth->HasQueuedMIDI() : m_pCurrentSynth->HasQueuedMIDI();
+}
+
+template <class T>
+void CMT32Pi::RenderDualSynth(T* pOutBuffer, T* pSoundFontBuffer, size_t nFrames)
+{
+	struct TRenderJob
+	{
+		CSynthBase* pSynth;
+		T* pBuffer;
+		size_t nFrames;
+	};
+
+	TRenderJob Job{m_pSoundFontSynth, pSoundFontBuffer, nFrames};
+	const auto RenderJob = [](void* pParam)
+	{
+		TRenderJob* pJob = static_cast<TRenderJob*>(pParam);
+		pJob->pSynth->Render(pJob->pBuffer, pJob->nFrames);
+	};
+
+	// Render the SoundFont synth on core 3 while the MT-32 renders here
+	const bool bSubmitted = m_CoreWorker.Submit(RenderJob, &Job);
+	m_pMT32Synth->Render(pOutBuffer, nFrames);
+
+	if (bSubmitted)
+		m_CoreWorker.Join();
+	else
+		RenderJob(&Job);
+
+	SampleConverter::MixInPlace(pOutBuffer, pSoundFontBuffer, nFrames * 2);
 }
 
 void CMT32Pi::Run(unsigned nCore)
@@ -450,6 +774,9 @@ void CMT32Pi::Run(unsigned nCore)
 		case 2:
 			return AudioTask();
 
+		case 3:
+			return m_CoreWorker.Run();
+
 		default:
 			break;
 	}
@@ -485,7 +812,35 @@ void CMT32Pi::OnUnderVoltageDetected()
 	LCDLog(TLCDLogType::Warning, "Low voltage! Chk PSU");
 }
 
-void CMT32Pi::OnShortMessage(u32 nMessage)
+CSynthBase* CMT32Pi::GetRouteSynth(TMIDIRoute Route) const
+{
+	CSynthBase* const pSynth = Route == TMIDIRoute::MT32 ? static_cast<CSynthBase*>(m_pMT32Synth) : m_pSoundFontSynth;
+
+	// A routed cable only plays while its synth is audible
+	return pSynth && (m_bDualSynth || pSynth == m_pCurrentSynth) ? pSynth : nullptr;
+}
+
+u8 CMT32Pi::GetRouteBank(TMIDIRoute Route)
+{
+	// The extra SoundFont routes go to FluidSynth's upper channels, 16 at a time
+	return Route > TMIDIRoute::SoundFont ? static_cast<u8>(Route) - static_cast<u8>(TMIDIRoute::SoundFont) : 0;
+}
+
+CSynthBase* CMT32Pi::GetChannelMessageSynth(u32& nMessage, TMIDIRoute Route) const
+{
+	if (Route != TMIDIRoute::Default)
+	{
+		nMessage |= GetRouteBank(Route) << 24;
+		return GetRouteSynth(Route);
+	}
+
+	if (!m_bDualSynth)
+		return m_pCurrentSynth;
+
+	return m_nMT32ChannelMask & (1 << (nMessage & 0x0F)) ? m_pMT32Synth : static_cast<CSynthBase*>(m_pSoundFontSynth);
+}
+
+void CMT32Pi::OnShortMessage(u32 nMessage, TMIDIRoute Route, u32 nTimestamp)
 {
 	// Active sensing
 	if (nMessage == 0xFE)
@@ -497,35 +852,135 @@ void CMT32Pi::OnShortMessage(u32 nMessage)
 	// Flash LED
 	LEDOn();
 
-	m_pCurrentSynth->HandleMIDIShortMessage(nMessage);
+	bool bQueued;
+	if ((nMessage & 0xF0) != 0xF0)
+	{
+		CSynthBase* const pSynth = GetChannelMessageSynth(nMessage, Route);
+		if (!pSynth)
+			return;
+
+		bQueued = GetMIDICoalescer(pSynth).QueueShortMessage(nMessage, nTimestamp);
+	}
+	else if (Route != TMIDIRoute::Default)
+	{
+		CSynthBase* const pSynth = GetRouteSynth(Route);
+		if (!pSynth)
+			return;
+
+		// System Reset only resets the route's own channels
+		bQueued = GetMIDICoalescer(pSynth).QueueShortMessage(nMessage | GetRouteBank(Route) << 24, nTimestamp);
+	}
+	else if (!m_bDualSynth)
+		bQueued = GetMIDICoalescer(m_pCurrentSynth).QueueShortMessage(nMessage, nTimestamp);
+	else
+	{
+		// System messages go to both synths
+		const bool bMT32Queued = m_MT32MIDICoalescer.QueueShortMessage(nMessage, nTimestamp);
+		bQueued = m_SoundFontMIDICoalescer.QueueShortMessage(nMessage, nTimestamp) && bMT32Queued;
+	}
+
+	if (!bQueued)
+		LCDLog(TLCDLogType::Error, "MIDI queue full!");
 
 	// Wake from power saving mode if necessary
 	Awaken();
 }
 
-void CMT32Pi::OnSysExMessage(const u8* pData, size_t nSize)
+void CMT32Pi::OnSysExMessage(const u8* pData, size_t nSize, TMIDIRoute Route, u32 nTimestamp)
 {
 	// Flash LED
 	LEDOn();
 
-	// If we don't consume the SysEx message, forward it to the synthesizer
+	// If we don't consume the SysEx message, forward it to the synthesizer(s); each ignores SysEx not meant for it
 	if (!ParseCustomSysEx(pData, nSize))
-		m_pCurrentSynth->HandleMIDISysExMessage(pData, nSize);
+	{
+		bool bQueued;
+		if (Route != TMIDIRoute::Default)
+		{
+			CSynthBase* const pSynth = GetRouteSynth(Route);
+			bQueued = !pSynth || GetMIDICoalescer(pSynth).QueueSysExMessage(pData, nSize, nTimestamp, GetRouteBank(Route));
+		}
+		else if (m_bDualSynth)
+		{
+			const bool bMT32Queued = m_MT32MIDICoalescer.QueueSysExMessage(pData, nSize, nTimestamp);
+			bQueued = m_SoundFontMIDICoalescer.QueueSysExMessage(pData, nSize, nTimestamp) && bMT32Queued;
+		}
+		else
+			bQueued = GetMIDICoalescer(m_pCurrentSynth).QueueSysExMessage(pData, nSize, nTimestamp);
+
+		if (!bQueued)
+			LCDLog(TLCDLogType::Error, "MIDI queue full!");
+	}
 
 	// Wake from power saving mode if necessary
 	Awaken();
 }
 
-void CMT32Pi::OnUnexpectedStatus()
+void CMT32Pi::DispatchMIDIBatch(TMIDIRoute Route, TMIDIThru Thru)
 {
-	CMIDIParser::OnUnexpectedStatus();
-	LCDLog(TLCDLogType::Error, "Unexp. MIDI status!");
-}
+	CMIDIParser::TBatch& Batch = m_MIDIBatch;
+	if (Batch.IsEmpty())
+		return;
 
-void CMT32Pi::OnSysExOverflow()
-{
-	CMIDIParser::OnSysExOverflow();
-	LCDLog(TLCDLogType::Error, "SysEx overflow!");
+	bool bChannelMessages = false;
+	bool bQueued = true;
+
+	// Consecutive channel messages for the same synth are queued in one go
+	CSynthBase* pRunSynth = nullptr;
+	size_t nRunStart = 0;
+	auto QueueRun = [&](size_t nRunEnd)
+	{
+		if (pRunSynth && nRunEnd > nRunStart)
+			bQueued &= GetMIDICoalescer(pRunSynth).QueueShortMessages(Batch.Messages + nRunStart, Batch.Timestamps + nRunStart, nRunEnd - nRunStart);
+		pRunSynth = nullptr;
+	};
+
+	for (size_t i = 0; i < Batch.nMessages; ++i)
+	{
+		if (Batch.IsSysEx(i))
+		{
+			QueueRun(i);
+			SendMIDIThru(Thru, Batch.GetSysExData(i), Batch.GetSysExSize(i));
+			OnSysExMessage(Batch.GetSysExData(i), Batch.GetSysExSize(i), Route, Batch.Timestamps[i]);
+			continue;
+		}
+
+		u32& nMessage = Batch.Messages[i];
+		SendMIDIThru(Thru, nMessage);
+
+		// System messages are few, and may go to both synths
+		if ((nMessage & 0xF0) == 0xF0)
+		{
+			QueueRun(i);
+			OnShortMessage(nMessage, Route, Batch.Timestamps[i]);
+			continue;
+		}
+
+		CSynthBase* const pSynth = GetChannelMessageSynth(nMessage, Route);
+		if (pSynth != pRunSynth)
+		{
+			QueueRun(i);
+			pRunSynth = pSynth;
+			nRunStart = i;
+		}
+
+		bChannelMessages = true;
+	}
+
+	QueueRun(Batch.nMessages);
+	Batch.Clear();
+
+	if (!bChannelMessages)
+		return;
+
+	// Flash LED
+	LEDOn();
+
+	if (!bQueued)
+		LCDLog(TLCDLogType::Error, "MIDI queue full!");
+
+	// Wake from power saving mode if necessary
+	Awaken();
 }
 
 bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
@@ -547,6 +1002,13 @@ bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 		return true;
 	}
 
+	// Query audio statistics (F0 7D 04 F7)
+	if (nSize == 4 && Command == TCustomSysExCommand::GetAudioStats)
+	{
+		SendAudioStats();
+		return true;
+	}
+
 	if (nSize != 5)
 		return false;
 
@@ -574,6 +1036,16 @@ bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 			return true;
 		}
 
+		// Start/stop audio capture (F0 7D 05 xx F7)
+		case TCustomSysExCommand::SetAudioCapture:
+			SetAudioCapture(nParameter != 0);
+			return true;
+
+		// Play/stop MIDI file (F0 7D 06 xx F7)
+		case TCustomSysExCommand::PlayMIDIFile:
+			PlayMIDIFile(nParameter);
+			return true;
+
 		default:
 			return false;
 	}
@@ -581,25 +1053,215 @@ bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 
 void CMT32Pi::UpdateMIDI()
 {
-	size_t nBytes;
-	u8 Buffer[MIDIRxBufferSize];
+	// Serial, Pisound, then each USB MIDI device
+	constexpr size_t nMIDIInputs = 2 + MaxUSBMIDIDevices;
 
-	// Read MIDI messages from serial device or ring buffer
-	if (m_bSerialMIDIEnabled)
-		nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer));
-	else
-		nBytes = m_MIDIRxBuffer.Dequeue(Buffer, sizeof(Buffer));
+	bool bReceived = false;
 
-	if (nBytes == 0)
-		return;
+	// Each input parses a bounded amount per pass, and the first turn rotates, so a busy input can't hold up the others;
+	// the parsers only emit complete messages, so SysEx is never interleaved with another input's messages
+	for (size_t i = 0; i < nMIDIInputs; ++i)
+	{
+		const size_t nInput = (m_nNextMIDIInput + i) % nMIDIInputs;
+
+		if (nInput >= 2)
+		{
+			bReceived |= UpdateUSBMIDI(m_USBMIDIDevices[nInput - 2]);
+			continue;
+		}
+
+		if (nInput == 1)
+		{
+			u32 Buffer[MIDIInputQuantum];
+			const size_t nBytes = m_PisoundMIDIRxBuffer.Dequeue(Buffer, Utility::ArraySize(Buffer));
+			m_PisoundMIDIInput.ParseTimestampedBytes(Buffer, nBytes);
+			bReceived |= nBytes > 0;
+			continue;
+		}
+
+		// The serial driver doesn't timestamp its buffer, but it's polled often enough that the read time is close
+		u8 Buffer[MIDIInputQuantum];
+		const size_t nBytes = m_bSerialMIDIEnabled ? ReceiveSerialMIDI(Buffer, sizeof(Buffer)) : 0;
+		if (nBytes == 0)
+			continue;
+
+		m_SerialMIDIInput.ParseMIDIBytes(Buffer, nBytes, CTimer::GetClockTicks());
+		bReceived = true;
+	}
+
+	m_nNextMIDIInput = (m_nNextMIDIInput + 1) % nMIDIInputs;
 
-	// Process MIDI messages
-	ParseMIDIBytes(Buffer, nBytes);
+	// Pass on controller values held back while a synth was catching up
+	if (m_pMT32Synth)
+		m_MT32MIDICoalescer.Update();
+	if (m_pSoundFontSynth)
+		m_SoundFontMIDICoalescer.Update();
+
+	// Send anything queued for MIDI thru
+	UpdateMIDIOutputs();
+
+	if (!bReceived)
+		return;
 
 	// Reset the Active Sense timer
 	s_pThis->m_nActiveSenseTime = s_pThis->m_pTimer->GetTicks();
 }
 
+bool CMT32Pi::UpdateUSBMIDI(TUSBMIDIDevice& Device)
+{
+	TUSBMIDIPacket Packets[MIDIInputQuantum / 3];
+	const size_t nPackets = Device.RxBuffer.Dequeue(Packets, Utility::ArraySize(Packets));
+
+	// Short messages are batched until the route changes
+	TMIDIRoute BatchRoute = TMIDIRoute::Default;
+
+	for (size_t i = 0; i < nPackets; ++i)
+	{
+		const u32 nPacket = Packets[i].nPacket;
+		const u8 nCable = nPacket >> USBMIDIPacketCableShift & 0x0F;
+		const TMIDIRoute Route = nCable < USBMIDIRoutedCables ? m_USBMIDICableRoutes[nCable] : TMIDIRoute::Default;
+
+		// Short messages were decoded at ingress; only SysEx needs the cable's parser
+		if (nPacket & USBMIDIPacketShortMessage)
+		{
+			if (Route != BatchRoute || m_MIDIBatch.IsFull())
+			{
+				DispatchMIDIBatch(BatchRoute, m_USBMIDIThru);
+				BatchRoute = Route;
+			}
+
+			m_MIDIBatch.AddShortMessage(nPacket & 0xFFFFFF, Packets[i].nTimestamp);
+			continue;
+		}
+
+		// The cable's parser dispatches its own messages, so hand on the earlier ones first
+		DispatchMIDIBatch(BatchRoute, m_USBMIDIThru);
+
+		const u8 nLength = nPacket >> USBMIDIPacketLengthShift & 0x03;
+		const u8 Data[]  = { static_cast<u8>(nPacket), static_cast<u8>(nPacket >> 8), static_cast<u8>(nPacket >> 16) };
+
+		CMIDIInput*& pCableInput = Device.pCableInputs[nCable];
+		if (!pCableInput)
+		{
+			char Name[16];
+			snprintf(Name, sizeof(Name), "USB %u:%u", Device.nNumber, nCable + 1);
+			pCableInput = new CMIDIInput(*this, Name, Route);
+			pCableInput->SetThru(m_USBMIDIThru);
+		}
+
+		pCableInput->ParseMIDIBytes(Data, nLength, Packets[i].nTimestamp);
+	}
+
+	DispatchMIDIBatch(BatchRoute, m_USBMIDIThru);
+	return nPackets > 0;
+}
+
+void CMT32Pi::AttachUSBMIDIDevices()
+{
+	CLogger* const pLogger = CLogger::Get();
+
+	// Circle numbers USB MIDI devices from 1 and reuses the numbers of removed devices
+	for (unsigned nNumber = 1; nNumber <= MaxUSBMIDIDevices; ++nNumber)
+	{
+		char Name[16];
+		snprintf(Name, sizeof(Name), "umidi%u", nNumber);
+
+		CUSBMIDIDevice* const pDevice = static_cast<CUSBMIDIDevice*>(CDeviceNameService::Get()->GetDevice(Name, FALSE));
+		if (!pDevice)
+			continue;
+
+		TUSBMIDIDevice* pFreeSlot = nullptr;
+		bool bAttached = false;
+		for (TUSBMIDIDevice& Device : m_USBMIDIDevices)
+		{
+			if (Device.pDevice == pDevice)
+				bAttached = true;
+			else if (!Device.pDevice && !pFreeSlot)
+				pFreeSlot = &Device;
+		}
+
+		if (bAttached || !pFreeSlot)
+			continue;
+
+		// Drop anything left over from the slot's previous device; its parsers may be part way through a message
+		TUSBMIDIPacket Packets[MIDIInputQuantum / 3];
+		while (pFreeSlot->RxBuffer.Dequeue(Packets, Utility::ArraySize(Packets)))
+			;
+
+		for (CMIDIInput*& pCableInput : pFreeSlot->pCableInputs)
+		{
+			delete pCableInput;
+			pCableInput = nullptr;
+		}
+
+		const size_t nSlot = pFreeSlot - m_USBMIDIDevices;
+		pFreeSlot->nNumber = nNumber;
+		pFreeSlot->pDevice = pDevice;
+		pDevice->RegisterRemovedHandler(USBDeviceRemovedHandler, pFreeSlot);
+		pDevice->RegisterPacketHandler(USBMIDIPacketHandlers[nSlot]);
+		pLogger->Write(MT32PiName, LogNotice, "Using USB MIDI interface %u", nNumber);
+	}
+}
+
+CUSBMIDIDevice* CMT32Pi::GetUSBMIDIOutputDevice() const
+{
+	// Output goes to the first attached USB MIDI device
+	for (const TUSBMIDIDevice& Device : m_USBMIDIDevices)
+	{
+		CUSBMIDIDevice* const pDevice = Device.pDevice;
+		if (pDevice)
+			return pDevice;
+	}
+
+	return nullptr;
+}
+
+void CMT32Pi::UpdateMIDIOutputs()
+{
+	if (m_bSerialMIDIEnabled)
+		m_SerialMIDIOutput.Update();
+
+	m_USBMIDIOutput.SetDevice(GetUSBMIDIOutputDevice());
+	m_USBMIDIOutput.Update();
+}
+
+void CMT32Pi::SendMIDIThru(TMIDIThru Thru, u32 nMessage)
+{
+	// Messages that don't fit are dropped whole, so a slow output never holds up the inputs
+	bool bSent = true;
+	if ((static_cast<u8>(Thru) & static_cast<u8>(TMIDIThru::GPIO)) && m_bSerialMIDIEnabled)
+		bSent &= m_SerialMIDIOutput.SendShortMessage(nMessage);
+	if (static_cast<u8>(Thru) & static_cast<u8>(TMIDIThru::USB))
+		bSent &= m_USBMIDIOutput.SendShortMessage(nMessage);
+
+	if (!bSent)
+		LCDLog(TLCDLogType::Error, "MIDI out overrun!");
+}
+
+void CMT32Pi::SendMIDIThru(TMIDIThru Thru, const u8* pData, size_t nSize)
+{
+	bool bSent = true;
+	if ((static_cast<u8>(Thru) & static_cast<u8>(TMIDIThru::GPIO)) && m_bSerialMIDIEnabled)
+		bSent &= m_SerialMIDIOutput.SendSysExMessage(pData, nSize);
+	if (static_cast<u8>(Thru) & static_cast<u8>(TMIDIThru::USB))
+		bSent &= m_USBMIDIOutput.SendSysExMessage(pData, nSize);
+
+	if (!bSent)
+		LCDLog(TLCDLogType::Error, "MIDI out overrun!");
+}
+
+void CMT32Pi::SendMIDIThru(TMIDIThru Thru, const void* pSource, const u8* pData, size_t nSize, CMIDIParser::TSysExFragment Fragment)
+{
+	bool bSent = true;
+	if ((static_cast<u8>(Thru) & static_cast<u8>(TMIDIThru::GPIO)) && m_bSerialMIDIEnabled)
+		bSent &= m_SerialMIDIOutput.SendSysExFragment(pSource, pData, nSize, Fragment);
+	if (static_cast<u8>(Thru) & static_cast<u8>(TMIDIThru::USB))
+		bSent &= m_USBMIDIOutput.SendSysExFragment(pSource, pData, nSize, Fragment);
+
+	if (!bSent)
+		LCDLog(TLCDLogType::Error, "MIDI out overrun!");
+}
+
 size_t CMT32Pi::ReceiveSerialMIDI(u8* pOutData, size_t nSize)
 {
 	// Read serial MIDI data
@@ -637,24 +1299,13 @@ size_t CMT32Pi::ReceiveSerialMIDI(u8* pOutData, size_t nSize)
 		return 0;
 	}
 
-	// Replay received MIDI data out via the serial port ('software thru')
-	if (CConfig::Get()->MIDIGPIOThru)
-	{
-		int nSendResult = m_pSerial->Write(pOutData, nResult);
-		if (nSendResult != nResult)
-		{
-			CLogger::Get()->Write(MT32PiName, LogWarning, "received %d bytes, but only sent %d bytes", nResult, nSendResult);
-			LCDLog(TLCDLogType::Error, "UART TX error!");
-		}
-	}
-
 	return static_cast<size_t>(nResult);
 }
 
 void CMT32Pi::ProcessEventQueue()
 {
 	TEvent Buffer[EventQueueSize];
-	const size_t nEvents = m_EventQueue.Dequeue(Buffer, sizeof(Buffer));
+	const size_t nEvents = m_EventQueue.Dequeue(Buffer, Utility::ArraySize(Buffer));
 
 	// We got some events, wake up
 	if (nEvents > 0)
@@ -703,9 +1354,44 @@ void CMT32Pi::ProcessEventQueue()
 
 void CMT32Pi::ProcessButtonEvent(const TButtonEvent& Event)
 {
+	const u8 nButtonBit = 1 << static_cast<u8>(Event.Button);
+	if (Event.bPressed)
+		m_nHeldButtons |= nButtonBit;
+	else
+		m_nHeldButtons &= ~nButtonBit;
+
+	// Volume down + volume up toggles audio capture
+	constexpr u8 AudioCaptureButtons = 1 << static_cast<u8>(TButton::Button3) | 1 << static_cast<u8>(TButton::Button4);
+	if (Event.bPressed && (m_nHeldButtons & AudioCaptureButtons) == AudioCaptureButtons)
+	{
+		SetAudioCapture(!m_AudioCapture.IsRequested());
+		m_bButtonComboPressed = true;
+		return;
+	}
+
+	// The volume buttons act on release, so the first button of the combination doesn't change the volume as well
+	if (Event.Button == TButton::Button3 || Event.Button == TButton::Button4)
+	{
+		if (!Event.bPressed && !m_bButtonComboPressed)
+			SetMasterVolume(m_nMasterVolume + (Event.Button == TButton::Button3 ? -1 : 1));
+
+		if (!(m_nHeldButtons & AudioCaptureButtons))
+			m_bButtonComboPressed = false;
+
+		return;
+	}
+
 	if (Event.Button == TButton::EncoderButton)
 	{
-		LCDLog(TLCDLogType::Notice, "Enc. button %s", Event.bPressed ? "PRESSED" : "RELEASED");
+		// Toggle audio diagnostics page
+		if (CConfig::Get()->LCDDiagnostics)
+		{
+			if (Event.bPressed)
+				m_bShowAudioStats = !m_bShowAudioStats;
+		}
+		else
+			LCDLog(TLCDLogType::Notice, "Enc. button %s", Event.bPressed ? "PRESSED" : "RELEASED");
+
 		return;
 	}
 
@@ -736,14 +1422,6 @@ void CMT32Pi::ProcessButtonEvent(const TButtonEvent& Event)
 			DeferSwitchSoundFont(nNextSoundFont);
 		}
 	}
-	else if (Event.Button == TButton::Button3)
-	{
-		SetMasterVolume(m_nMasterVolume - 1);
-	}
-	else if (Event.Button == TButton::Button4)
-	{
-		SetMasterVolume(m_nMasterVolume + 1);
-	}
 }
 
 void CMT32Pi::SwitchSynth(TSynth NewSynth)
@@ -767,7 +1445,15 @@ void CMT32Pi::SwitchSynth(TSynth NewSynth)
 		return;
 	}
 
-	m_pCurrentSynth->AllSoundOff();
+	// Both synths keep playing in dual synth mode; only the LCD and controls change focus
+	if (!m_bDualSynth)
+	{
+		// Drop anything the old synth hasn't rendered yet so it can't play when switched back
+		m_pCurrentSynth->DiscardQueuedMIDI();
+		GetMIDICoalescer(m_pCurrentSynth).Discard();
+		m_pCurrentSynth->AllSoundOff();
+	}
+
 	m_pCurrentSynth = pNewSynth;
 	const char* pMode = NewSynth == TSynth::MT32 ? "MT-32 mode" : "SoundFont mode";
 	CLogger::Get()->Write(MT32PiName, LogNotice, "Switching to %s", pMode);
@@ -801,7 +1487,13 @@ void CMT32Pi::SwitchSoundFont(size_t nIndex)
 		return;
 
 	CLogger::Get()->Write(MT32PiName, LogNotice, "Switching to SoundFont %d", nIndex);
-	if (m_pSoundFontSynth->SwitchSoundFont(nIndex) && m_pCurrentSynth == m_pSoundFontSynth)
+
+	// Loading reads the SD card, so keep the UI core out of FatFs meanwhile
+	m_FileAccessGate.Suspend();
+	const bool bSwitched = m_pSoundFontSynth->SwitchSoundFont(nIndex);
+	m_FileAccessGate.Resume();
+
+	if (bSwitched && m_pCurrentSynth == m_pSoundFontSynth)
 		m_pSoundFontSynth->ReportStatus();
 }
 
@@ -830,6 +1522,105 @@ void CMT32Pi::SetMasterVolume(s32 nVolume)
 		LCDLog(TLCDLogType::Notice, "Volume: %d", m_nMasterVolume);
 }
 
+void CMT32Pi::SetAudioCapture(bool bEnabled)
+{
+	if (bEnabled)
+		m_AudioCapture.Start();
+	else
+		m_AudioCapture.Stop();
+
+	LCDLog(TLCDLogType::Notice, "Capture %s", bEnabled ? "started" : "stopped");
+}
+
+void CMT32Pi::PlayMIDIFile(u8 nIndex)
+{
+	// 7F stops playback; the file name is shown once playback starts
+	if (nIndex == 0x7F)
+	{
+		m_MIDIPlayer.Stop();
+		LCDLog(TLCDLogType::Notice, "Playback stopped");
+	}
+	else
+		m_MIDIPlayer.Play(nIndex);
+}
+
+void CMT32Pi::SendMIDI(const u8* pData, size_t nSize)
+{
+	// Replies are SysEx, and go to the first attached USB MIDI device, or serial if there are none
+	if (GetUSBMIDIOutputDevice())
+		m_USBMIDIOutput.SendSysExMessage(pData, nSize);
+	else if (m_bSerialMIDIEnabled)
+		m_SerialMIDIOutput.SendSysExMessage(pData, nSize);
+}
+
+void CMT32Pi::SendAudioStats()
+{
+	CAudioStats::TSnapshot Stats;
+	m_AudioStats.GetSnapshot(Stats);
+
+	const u32 Fields[] =
+	{
+		Stats.nBlocks,
+		Stats.nXruns,
+		Stats.nShortWrites,
+		Stats.nDeadlineMicros,
+		Stats.nMinMicros,
+		Stats.nAvgMicros,
+		Stats.nMaxMicros,
+		Stats.nLastMicros,
+		Stats.nHeadroomPercent,
+	};
+
+	TSynthState SoundFontState{};
+	if (m_pSoundFontSynth)
+		m_pSoundFontSynth->GetState(SoundFontState);
+
+	const u32 VoiceFields[] =
+	{
+		SoundFontState.nVoiceCap,
+		SoundFontState.nCulledVoices,
+	};
+
+	// F0 7D 04 <fields> <histogram> <voice cap> <culled voices> F7; each value is sent as five 7-bit groups, least significant first
+	constexpr size_t nHistogramEnd = Utility::ArraySize(Fields) + CAudioStats::HistogramBuckets;
+	constexpr size_t nValues = nHistogramEnd + Utility::ArraySize(VoiceFields);
+	u8 Buffer[3 + nValues * 5 + 1] = { 0xF0, 0x7D, static_cast<u8>(TCustomSysExCommand::GetAudioStats) };
+	u8* pOut = Buffer + 3;
+
+	for (size_t i = 0; i < nValues; ++i)
+	{
+		u32 nValue;
+		if (i < Utility::ArraySize(Fields))
+			nValue = Fields[i];
+		else if (i < nHistogramEnd)
+			nValue = Stats.Histogram[i - Utility::ArraySize(Fields)];
+		else
+			nValue = VoiceFields[i - nHistogramEnd];
+
+		for (size_t j = 0; j < 5; ++j, nValue >>= 7)
+			*pOut++ = nValue & 0x7F;
+	}
+
+	*pOut = 0xF7;
+	SendMIDI(Buffer, sizeof(Buffer));
+}
+
+void CMT32Pi::UpdateAudioStatsLCD()
+{
+	CAudioStats::TSnapshot Stats;
+	m_AudioStats.GetSnapshot(Stats);
+
+	const u64 nDeadline = Utility::Max(Stats.nDeadlineMicros, static_cast<u32>(1));
+	const unsigned int nAvgLoad = static_cast<u64>(Stats.nAvgMicros) * 100 / nDeadline;
+	const unsigned int nMaxLoad = static_cast<u64>(Stats.nMaxMicros) * 100 / nDeadline;
+
+	char Buffer[21];
+	snprintf(Buffer, sizeof(Buffer), "Ld%3u%% Pk%3u%% Hd%3u%%", nAvgLoad, nMaxLoad, static_cast<unsigned int>(Stats.nHeadroomPercent));
+	m_pLCD->Print(Buffer, 0, 0, true, false);
+	snprintf(Buffer, sizeof(Buffer), "Xrun %-5u Drop %u", static_cast<unsigned int>(Stats.nXruns), static_cast<unsigned int>(Stats.nShortWrites));
+	m_pLCD->Print(Buffer, 0, 1, true, true);
+}
+
 void CMT32Pi::LEDOn()
 {
 	m_pActLED->On();
@@ -898,34 +1689,176 @@ void CMT32Pi::EventHandler(const TEvent& Event)
 }
 
 void CMT32Pi::USBDeviceRemovedHandler(CDevice* pDevice, void* pContext)
+{
+	TUSBMIDIDevice* const pUSBMIDIDevice = static_cast<TUSBMIDIDevice*>(pContext);
+	CLogger::Get()->Write(MT32PiName, LogNotice, "USB MIDI interface %u removed", pUSBMIDIDevice->nNumber);
+	pUSBMIDIDevice->pDevice = nullptr;
+}
+
+// The following handlers are called from interrupt context, enqueue into ring buffer for main thread
+template <size_t N>
+void CMT32Pi::USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength)
+{
+	assert(s_pThis != nullptr);
+	TUSBMIDIDevice& Device = s_pThis->m_USBMIDIDevices[N];
+	const u32 nTimestamp = CTimer::GetClockTicks();
+
+	// Circle's handler has no context argument, so each device slot has its own instance
+	for (unsigned nOffset = 0; nOffset < nLength; nOffset += 3)
+	{
+		const unsigned nChunk = Utility::Min(nLength - nOffset, 3u);
+
+		u32 nPacket = (nCable & 0x0F) << USBMIDIPacketCableShift | nChunk << USBMIDIPacketLengthShift;
+		for (unsigned i = 0; i < nChunk; ++i)
+			nPacket |= pPacket[nOffset + i] << (i * 8);
+
+		// Each USB-MIDI event packet is framed, so a status byte followed by exactly its data bytes is a complete message;
+		// Circle strips the Code Index Number, so the expected length is looked up from the status byte instead
+		if (nOffset == 0 && nChunk == nLength && CMIDIParser::GetShortMessageLength(pPacket[0]) == nLength)
+			nPacket |= USBMIDIPacketShortMessage;
+
+		if (!Device.RxBuffer.Enqueue({nPacket, nTimestamp}))
+		{
+			CLogger::Get()->Write(MT32PiName, LogWarning, "MIDI overrun error on USB %u:%u input!", Device.nNumber, nCable + 1);
+			s_pThis->LCDLog(TLCDLogType::Error, "MIDI overrun error!");
+			return;
+		}
+	}
+}
+
+TMIDIPacketHandler* const CMT32Pi::USBMIDIPacketHandlers[MaxUSBMIDIDevices] = { USBMIDIPacketHandler<0>, USBMIDIPacketHandler<1>, USBMIDIPacketHandler<2>, USBMIDIPacketHandler<3> };
+
+void CMT32Pi::PisoundMIDIReceiveHandler(const u8* pData, size_t nSize)
 {
 	assert(s_pThis != nullptr);
+	const u32 nTimestamp = CTimer::GetClockTicks();
 
-	s_pThis->m_pUSBMIDIDevice = nullptr;
+	for (size_t i = 0; i < nSize; ++i)
+	{
+		if (!s_pThis->m_PisoundMIDIRxBuffer.Enqueue(CMIDIInput::PackTimestampedByte(pData[i], nTimestamp)))
+		{
+			CLogger::Get()->Write(MT32PiName, LogWarning, "MIDI overrun error on Pisound input!");
+			s_pThis->LCDLog(TLCDLogType::Error, "MIDI overrun error!");
+			return;
+		}
+	}
+}
+
+CMT32Pi::CMIDIInput::CMIDIInput(CMT32Pi& MT32Pi, const char* pName, TMIDIRoute Route)
+	: m_MT32Pi(MT32Pi),
+	  m_Name{'\0'},
+	  m_Route(Route),
+	  m_Thru(TMIDIThru::Off),
+	  m_DT1Splitter(SplitSysExHandler, this),
+	  m_nTimestamp(0)
+{
+	strncpy(m_Name, pName, sizeof(m_Name) - 1);
+}
+
+void CMT32Pi::CMIDIInput::ParseMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp)
+{
+	AppendMIDIBytes(pData, nSize, nTimestamp);
+	m_MT32Pi.DispatchMIDIBatch(m_Route, m_Thru);
+}
+
+void CMT32Pi::CMIDIInput::AppendMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp)
+{
+	CMIDIParser::TBatch& Batch = m_MT32Pi.m_MIDIBatch;
 
-	// Re-enable serial MIDI if not in-use by logger and not using Pisound
-	if (s_pThis->m_bSerialMIDIAvailable && !s_pThis->m_pPisound)
+	// Messages are stamped with the time their last byte was received
+	m_nTimestamp = nTimestamp;
+	while (nSize)
 	{
-		CLogger::Get()->Write(MT32PiName, LogNotice, "Using serial MIDI interface");
-		s_pThis->m_bSerialMIDIEnabled = true;
+		const size_t nParsed = CMIDIParser::ParseMIDIBytes(pData, nSize, nTimestamp, Batch);
+		pData += nParsed;
+		nSize -= nParsed;
+
+		if (Batch.IsFull())
+			m_MT32Pi.DispatchMIDIBatch(m_Route, m_Thru);
 	}
 }
 
-// The following handlers are called from interrupt context, enqueue into ring buffer for main thread
-void CMT32Pi::USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength)
+void CMT32Pi::CMIDIInput::ParseTimestampedBytes(const u32* pData, size_t nSize)
 {
-	MIDIReceiveHandler(pPacket, nLength);
+	// Only the low 24 bits of the timestamps were kept (about 16 seconds); recover the rest from the current time
+	const u32 nNow = CTimer::GetClockTicks();
+
+	// Bytes received together share a timestamp, so parse them in runs
+	u8 Bytes[MIDIInputQuantum];
+	size_t nRunStart = 0;
+	for (size_t i = 0; i < nSize; ++i)
+	{
+		Bytes[i - nRunStart] = pData[i] >> 24;
+
+		const bool bRunEnd = i + 1 == nSize || i + 1 - nRunStart == sizeof(Bytes) || ((pData[i + 1] ^ pData[i]) & 0xFFFFFF);
+		if (!bRunEnd)
+			continue;
+
+		AppendMIDIBytes(Bytes, i + 1 - nRunStart, nNow - ((nNow - pData[i]) & 0xFFFFFF));
+		nRunStart = i + 1;
+	}
+
+	m_MT32Pi.DispatchMIDIBatch(m_Route, m_Thru);
+}
+
+void CMT32Pi::CMIDIInput::OnUnexpectedStatus()
+{
+	CMIDIParser::OnUnexpectedStatus();
+	m_MT32Pi.LCDLog(TLCDLogType::Error, "Unexp. MIDI status!");
+}
+
+void CMT32Pi::CMIDIInput::OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment)
+{
+	// Hand on the messages before it first, so thru stays in order
+	m_MT32Pi.DispatchMIDIBatch(m_Route, m_Thru);
+
+	// Too long for the synths, but MT-32 bulk dumps can be split, and MIDI thru can stream anything
+	const bool bWasSplitting = m_DT1Splitter.IsSplitting();
+	const bool bSplit = m_DT1Splitter.OnSysExFragment(pData, nSize, Fragment);
+	if (Fragment == TSysExFragment::Start && !bSplit)
+	{
+		CLogger::Get()->Write(MT32PiName, LogWarning, "SysEx message on %s input is too long for the synth; ignored", m_Name);
+		m_MT32Pi.LCDLog(TLCDLogType::Error, "SysEx too long!");
+	}
+	else if (Fragment == TSysExFragment::End && bWasSplitting && !bSplit)
+		CLogger::Get()->Write(MT32PiName, LogWarning, "Long MT-32 SysEx message on %s input has a bad checksum; its last part was ignored", m_Name);
+
+	m_MT32Pi.SendMIDIThru(m_Thru, this, pData, nSize, Fragment);
+}
+
+void CMT32Pi::CMIDIInput::SplitSysExHandler(const u8* pData, size_t nSize, void* pUser)
+{
+	CMIDIInput* const pThis = static_cast<CMIDIInput*>(pUser);
+	pThis->m_MT32Pi.OnSysExMessage(pData, nSize, pThis->m_Route, pThis->m_nTimestamp);
+}
+
+void CMT32Pi::MIDIPlayerShortMessageHandler(u32 nMessage)
+{
+	assert(s_pThis != nullptr);
+
+	// Called on the audio core between renders, so messages are applied directly instead of queued
+	if (!s_pThis->m_bDualSynth)
+		s_pThis->m_pCurrentSynth->SendMIDIShortMessage(nMessage);
+	else if ((nMessage & 0xF0) == 0xF0)
+	{
+		s_pThis->m_pMT32Synth->SendMIDIShortMessage(nMessage);
+		s_pThis->m_pSoundFontSynth->SendMIDIShortMessage(nMessage);
+	}
+	else if (s_pThis->m_nMT32ChannelMask & (1 << (nMessage & 0x0F)))
+		s_pThis->m_pMT32Synth->SendMIDIShortMessage(nMessage);
+	else
+		s_pThis->m_pSoundFontSynth->SendMIDIShortMessage(nMessage);
 }
 
-void CMT32Pi::MIDIReceiveHandler(const u8* pData, size_t nSize)
+void CMT32Pi::MIDIPlayerSysExMessageHandler(const u8* pData, size_t nSize)
 {
 	assert(s_pThis != nullptr);
 
-	// Enqueue data into ring buffer
-	if (s_pThis->m_MIDIRxBuffer.Enqueue(pData, nSize) != nSize)
+	if (s_pThis->m_bDualSynth)
 	{
-		static const char* pErrorString = "MIDI overrun error!";
-		CLogger::Get()->Write(MT32PiName, LogWarning, pErrorString);
-		s_pThis->LCDLog(TLCDLogType::Error, pErrorString);
+		s_pThis->m_pMT32Synth->SendMIDISysExMessage(pData, nSize);
+		s_pThis->m_pSoundFontSynth->SendMIDISysExMessage(pData, nSize);
 	}
+	else
+		s_pThis->m_pCurrentSynth->SendMIDISysExMessage(pData, nSize);
 }
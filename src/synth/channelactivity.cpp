@@ -0,0 +1,131 @@
+//
+// channelactivity.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/util.h>
+
+#include "synth/channelactivity.h"
+#include "utility.h"
+
+CChannelActivity::CChannelActivity()
+	: m_NoteVelocities{{0}},
+	  m_nHeldNotes{0},
+	  m_MaxVelocities{0}
+{
+}
+
+void CChannelActivity::ProcessShortMessage(u32 nMessage)
+{
+	const u8 nStatus  = nMessage & 0xFF;
+	const u8 nChannel = nMessage & 0x0F;
+	const u8 nData1   = (nMessage >> 8) & 0x7F;
+	const u8 nData2   = (nMessage >> 16) & 0x7F;
+
+	// Only the first 16 channels are tracked
+	if (nMessage >> 24)
+		return;
+
+	// System reset
+	if (nStatus == 0xFF)
+	{
+		Reset();
+		return;
+	}
+
+	switch (nStatus & 0xF0)
+	{
+		case 0x80:
+			NoteOff(nChannel, nData1);
+			break;
+
+		case 0x90:
+			if (nData2)
+				NoteOn(nChannel, nData1, nData2);
+			else
+				NoteOff(nChannel, nData1);
+			break;
+
+		case 0xB0:
+			// All Sound Off, All Notes Off and the mode messages that imply it
+			if (nData1 == 0x78 || nData1 >= 0x7B)
+				AllNotesOff(nChannel);
+			break;
+
+		default:
+			break;
+	}
+}
+
+void CChannelActivity::Reset()
+{
+	for (u8 nChannel = 0; nChannel < Channels; ++nChannel)
+		AllNotesOff(nChannel);
+}
+
+void CChannelActivity::NoteOn(u8 nChannel, u8 nNote, u8 nVelocity)
+{
+	// Retriggering a held note may lower the channel's maximum
+	if (m_NoteVelocities[nChannel][nNote])
+		NoteOff(nChannel, nNote);
+
+	m_NoteVelocities[nChannel][nNote] = nVelocity;
+	++m_nHeldNotes[nChannel];
+
+	if (nVelocity > m_MaxVelocities[nChannel])
+		m_MaxVelocities[nChannel] = nVelocity;
+}
+
+void CChannelActivity::NoteOff(u8 nChannel, u8 nNote)
+{
+	u8& nNoteVelocity = m_NoteVelocities[nChannel][nNote];
+	if (!nNoteVelocity)
+		return;
+
+	const u8 nVelocity = nNoteVelocity;
+	nNoteVelocity = 0;
+
+	if (--m_nHeldNotes[nChannel] == 0)
+	{
+		m_MaxVelocities[nChannel] = 0;
+		return;
+	}
+
+	// Only rescan the channel if the loudest note was released
+	if (nVelocity < m_MaxVelocities[nChannel])
+		return;
+
+	u8 nMaxVelocity = 0;
+	for (u8 nHeldVelocity : m_NoteVelocities[nChannel])
+		nMaxVelocity = Utility::Max(nMaxVelocity, nHeldVelocity);
+
+	m_MaxVelocities[nChannel] = nMaxVelocity;
+}
+
+void CChannelActivity::AllNotesOff(u8 nChannel)
+{
+	if (!m_nHeldNotes[nChannel])
+		return;
+
+	memset(m_NoteVelocities[nChannel], 0, Notes);
+	m_nHeldNotes[nChannel] = 0;
+	m_MaxVelocities[nChannel] = 0;
+}
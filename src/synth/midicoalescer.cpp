@@ -0,0 +1,182 @@
+//
+// midicoalescer.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/timer.h>
+#include <circle/util.h>
+
+#include "synth/midicoalescer.h"
+#include "synth/synthbase.h"
+
+CMIDICoalescer::CMIDICoalescer()
+	: m_pSynth(nullptr),
+	  m_nMaxWaitMicros(0),
+	  m_HeldMessages{0},
+	  m_HeldTimestamps{0},
+	  m_nHeldMessages(0),
+	  m_nHoldStartTicks(0)
+{
+}
+
+bool CMIDICoalescer::QueueShortMessage(u32 nMessage, u32 nTimestamp)
+{
+	assert(m_pSynth != nullptr);
+
+	// Held values must stay ahead of anything that came after them
+	if (IsCoalescible(nMessage) && (m_nHeldMessages || IsUnderPressure()))
+		return Hold(nMessage, nTimestamp);
+
+	if (!FlushHeld(true))
+		return false;
+
+	const u32 nStartTicks = CTimer::GetClockTicks();
+	while (!m_pSynth->QueueMIDIShortMessage(nMessage, nTimestamp))
+	{
+		if (!KeepWaiting(nStartTicks))
+			return false;
+	}
+
+	return true;
+}
+
+bool CMIDICoalescer::QueueShortMessages(const u32* pMessages, const u32* pTimestamps, size_t nCount)
+{
+	assert(m_pSynth != nullptr);
+
+	// Queue as much as possible in one go while there's plenty of room
+	size_t nQueued = 0;
+	if (!m_nHeldMessages && !IsUnderPressure())
+		nQueued = m_pSynth->QueueMIDIShortMessages(pMessages, pTimestamps, nCount);
+
+	// Once one message has waited a whole block in vain, the synth has stalled; don't wait again for each of the rest
+	for (size_t i = nQueued; i < nCount; ++i)
+	{
+		if (!QueueShortMessage(pMessages[i], pTimestamps[i]))
+			return false;
+	}
+
+	return true;
+}
+
+bool CMIDICoalescer::QueueSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp, u8 nBank)
+{
+	assert(m_pSynth != nullptr);
+
+	if (nSize > CMIDICommandQueue::MaxSysExSize || !FlushHeld(true))
+		return false;
+
+	const u32 nStartTicks = CTimer::GetClockTicks();
+	while (!m_pSynth->QueueMIDISysExMessage(pData, nSize, nTimestamp, nBank))
+	{
+		if (!KeepWaiting(nStartTicks))
+			return false;
+	}
+
+	return true;
+}
+
+void CMIDICoalescer::Update()
+{
+	if (m_nHeldMessages && (!IsUnderPressure() || CTimer::GetClockTicks() - m_nHoldStartTicks >= MaxHoldMicros))
+		FlushHeld(false);
+}
+
+bool CMIDICoalescer::IsCoalescible(u32 nMessage)
+{
+	switch (nMessage & 0xF0)
+	{
+		// Polyphonic aftertouch, channel pressure and pitch bend
+		case 0xA0:
+		case 0xD0:
+		case 0xE0:
+			return true;
+
+		// Control change, except those that only make sense in sequence: pedals and other switches (merging an
+		// off and an on would leave notes held), RPN/NRPN selection and data entry, and channel mode messages
+		case 0xB0:
+		{
+			const u8 nController = nMessage >> 8 & 0x7F;
+			return nController != 6 && nController != 38 && (nController < 64 || nController > 69) && (nController < 96 || nController > 101) && nController < 120;
+		}
+
+		default:
+			return false;
+	}
+}
+
+bool CMIDICoalescer::IsUnderPressure() const
+{
+	return m_pSynth->GetMIDIQueueFreeSpace() < PressureFreeSpace;
+}
+
+bool CMIDICoalescer::Hold(u32 nMessage, u32 nTimestamp)
+{
+	// Same status, channel and channel set, and same controller or note unless it's channel pressure or pitch bend
+	const u8 nStatus = nMessage & 0xF0;
+	const u32 nKeyMask = nStatus == 0xD0 || nStatus == 0xE0 ? 0xFF0000FF : 0xFF00FFFF;
+
+	for (size_t i = 0; i < m_nHeldMessages; ++i)
+	{
+		if ((m_HeldMessages[i] & nKeyMask) == (nMessage & nKeyMask))
+		{
+			m_HeldMessages[i]   = nMessage;
+			m_HeldTimestamps[i] = nTimestamp;
+			return true;
+		}
+	}
+
+	if (m_nHeldMessages == MaxHeldMessages && !FlushHeld(true))
+		return false;
+
+	if (!m_nHeldMessages)
+		m_nHoldStartTicks = CTimer::GetClockTicks();
+
+	m_HeldMessages[m_nHeldMessages]   = nMessage;
+	m_HeldTimestamps[m_nHeldMessages] = nTimestamp;
+	++m_nHeldMessages;
+	return true;
+}
+
+bool CMIDICoalescer::FlushHeld(bool bWait)
+{
+	const u32 nStartTicks = CTimer::GetClockTicks();
+	size_t nFlushed = 0;
+
+	while (nFlushed < m_nHeldMessages)
+	{
+		nFlushed += m_pSynth->QueueMIDIShortMessages(m_HeldMessages + nFlushed, m_HeldTimestamps + nFlushed, m_nHeldMessages - nFlushed);
+		if (nFlushed < m_nHeldMessages && (!bWait || !KeepWaiting(nStartTicks)))
+			break;
+	}
+
+	// Keep whatever didn't fit, in order
+	m_nHeldMessages -= nFlushed;
+	memmove(m_HeldMessages, m_HeldMessages + nFlushed, m_nHeldMessages * sizeof(*m_HeldMessages));
+	memmove(m_HeldTimestamps, m_HeldTimestamps + nFlushed, m_nHeldMessages * sizeof(*m_HeldTimestamps));
+
+	return m_nHeldMessages == 0;
+}
+
+bool CMIDICoalescer::KeepWaiting(u32 nStartTicks) const
+{
+	return CTimer::GetClockTicks() - nStartTicks < m_nMaxWaitMicros;
+}
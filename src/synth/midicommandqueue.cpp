@@ -0,0 +1,185 @@
+//
+// midicommandqueue.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/util.h>
+
+#include "synth/midicommandqueue.h"
+#include "utility.h"
+
+CMIDICommandQueue::CMIDICommandQueue()
+	: m_nWriteIndex(0),
+	  m_nReadIndex(0),
+	  m_nPeekedSize(0),
+	  m_nDiscardIndex(0),
+	  m_nDiscardSequence(0),
+	  m_nLastDiscardSequence(0),
+	  m_Buffer{0}
+{
+}
+
+bool CMIDICommandQueue::EnqueueShortMessage(u32 nMessage, u32 nTimestamp)
+{
+	return Enqueue(0, nTimestamp, &nMessage, sizeof(nMessage));
+}
+
+bool CMIDICommandQueue::EnqueueSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp, u8 nBank)
+{
+	if (nSize == 0 || nSize > MaxSysExSize)
+		return false;
+
+	return Enqueue(nSize | nBank << 24, nTimestamp, pData, nSize);
+}
+
+size_t CMIDICommandQueue::EnqueueShortMessages(const u32* pMessages, const u32* pTimestamps, size_t nCount)
+{
+	constexpr u32 nRecordSize = GetRecordSize(sizeof(u32));
+	const u32 nStartIndex = m_nWriteIndex;
+	const u32 nReadIndex  = __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE);
+
+	// Enqueue as many as fit, and publish them to the consumer together
+	nCount = Utility::Min(nCount, static_cast<size_t>((BufferSize - (nStartIndex - nReadIndex)) / nRecordSize));
+
+	// Records are word-aligned, so a word never wraps around the end of the buffer
+	u32 nWriteIndex = nStartIndex;
+	for (size_t i = 0; i < nCount; ++i)
+	{
+		WriteWord(nWriteIndex, 0);
+		WriteWord(nWriteIndex + 4, pTimestamps[i]);
+		WriteWord(nWriteIndex + 8, pMessages[i]);
+		nWriteIndex += nRecordSize;
+	}
+
+	__atomic_store_n(&m_nWriteIndex, nWriteIndex, __ATOMIC_RELEASE);
+	return nCount;
+}
+
+void CMIDICommandQueue::Discard()
+{
+	// Everything written so far is stale; the consumer skips it on its next dequeue
+	__atomic_store_n(&m_nDiscardIndex, m_nWriteIndex, __ATOMIC_RELAXED);
+	__atomic_store_n(&m_nDiscardSequence, m_nDiscardSequence + 1, __ATOMIC_RELEASE);
+}
+
+bool CMIDICommandQueue::Peek(TCommand& Command, u8* pSysExBuffer)
+{
+	const u32 nWriteIndex = __atomic_load_n(&m_nWriteIndex, __ATOMIC_ACQUIRE);
+	u32 nReadIndex = m_nReadIndex;
+
+	const u32 nDiscardSequence = __atomic_load_n(&m_nDiscardSequence, __ATOMIC_ACQUIRE);
+	if (nDiscardSequence != m_nLastDiscardSequence)
+	{
+		const u32 nSkip = __atomic_load_n(&m_nDiscardIndex, __ATOMIC_RELAXED) - nReadIndex;
+
+		// Only skip ahead to a discard point we've already seen being written; otherwise retry next time
+		if (nSkip <= nWriteIndex - nReadIndex)
+		{
+			nReadIndex += nSkip;
+			m_nLastDiscardSequence = nDiscardSequence;
+		}
+		else if (nSkip > BufferSize)
+			m_nLastDiscardSequence = nDiscardSequence;
+	}
+
+	if (nReadIndex == nWriteIndex)
+	{
+		__atomic_store_n(&m_nReadIndex, nReadIndex, __ATOMIC_RELEASE);
+		return false;
+	}
+
+	u32 Header[2];
+	Read(nReadIndex, Header, HeaderSize);
+
+	const u32 nSysExSize = Header[0] & HeaderSizeMask;
+	Command.nTimestamp = Header[1];
+
+	if (nSysExSize)
+	{
+		const size_t nOffset = (nReadIndex + HeaderSize) & (BufferSize - 1);
+
+		Command.nMessage   = Header[0] & ~HeaderSizeMask;
+		Command.nSysExSize = nSysExSize;
+
+		// Only copy if the message wraps around the end of the buffer
+		if (nOffset + nSysExSize <= BufferSize)
+			Command.pSysExData = m_Buffer + nOffset;
+		else
+		{
+			Read(nReadIndex + HeaderSize, pSysExBuffer, nSysExSize);
+			Command.pSysExData = pSysExBuffer;
+		}
+	}
+	else
+	{
+		Read(nReadIndex + HeaderSize, &Command.nMessage, sizeof(Command.nMessage));
+		Command.nSysExSize = 0;
+		Command.pSysExData = nullptr;
+	}
+
+	// Publish any skipped records; this one is released by Pop()
+	__atomic_store_n(&m_nReadIndex, nReadIndex, __ATOMIC_RELEASE);
+	m_nPeekedSize = GetRecordSize(nSysExSize ? nSysExSize : sizeof(u32));
+	return true;
+}
+
+void CMIDICommandQueue::Pop()
+{
+	// Release the record back to the producer
+	__atomic_store_n(&m_nReadIndex, m_nReadIndex + m_nPeekedSize, __ATOMIC_RELEASE);
+	m_nPeekedSize = 0;
+}
+
+bool CMIDICommandQueue::Enqueue(u32 nSize, u32 nTimestamp, const void* pData, size_t nDataSize)
+{
+	const u32 Header[] = { nSize, nTimestamp };
+	const u32 nRecordSize = GetRecordSize(nDataSize);
+	const u32 nWriteIndex = m_nWriteIndex;
+	const u32 nReadIndex  = __atomic_load_n(&m_nReadIndex, __ATOMIC_ACQUIRE);
+
+	if (BufferSize - (nWriteIndex - nReadIndex) < nRecordSize)
+		return false;
+
+	Write(nWriteIndex, Header, HeaderSize);
+	Write(nWriteIndex + HeaderSize, pData, nDataSize);
+
+	// Publish the record to the consumer
+	__atomic_store_n(&m_nWriteIndex, nWriteIndex + nRecordSize, __ATOMIC_RELEASE);
+	return true;
+}
+
+void CMIDICommandQueue::Write(u32 nIndex, const void* pData, size_t nSize)
+{
+	const size_t nOffset = nIndex & (BufferSize - 1);
+	const size_t nFirst  = Utility::Min(nSize, BufferSize - nOffset);
+
+	// Copy in up to two segments to handle wraparound
+	memcpy(m_Buffer + nOffset, pData, nFirst);
+	memcpy(m_Buffer, static_cast<const u8*>(pData) + nFirst, nSize - nFirst);
+}
+
+void CMIDICommandQueue::Read(u32 nIndex, void* pOutData, size_t nSize) const
+{
+	const size_t nOffset = nIndex & (BufferSize - 1);
+	const size_t nFirst  = Utility::Min(nSize, BufferSize - nOffset);
+
+	memcpy(pOutData, m_Buffer + nOffset, nFirst);
+	memcpy(static_cast<u8*>(pOutData) + nFirst, m_Buffer, nSize - nFirst);
+}
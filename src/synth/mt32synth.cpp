@@ -21,7 +21,9 @@
 //
 
 #include <circle/logger.h>
+#include <circle/timer.h>
 
+#include "audio/sampleconverter.h"
 #include "config.h"
 #include "synth/mt32synth.h"
 #include "utility.h"
@@ -31,20 +33,47 @@ const char MT32SynthName[] = "mt32synth";
 constexpr size_t ROMOffsetVersionStringOld  = 0x4015;
 constexpr size_t ROMOffsetVersionString1_07 = 0x4011;
 constexpr size_t ROMOffsetVersionStringNew  = 0x2206;
+constexpr u32 MemoryAddressPartChannels    = 0x4000D;
 constexpr u32 MemoryAddressMasterVolume     = 0x40016;
 
+// Render load is evaluated over windows of this many frames
+constexpr u32 GovernorWindowFrames = 1024;
+
+// Quality steps down as soon as a window exceeds the high mark, and back up once load has stayed below the low mark for a while
+constexpr u32 GovernorHighLoadPercent = 75;
+constexpr u32 GovernorLowLoadPercent  = 40;
+constexpr u32 GovernorStepUpMillis    = 2000;
+
+// Converters are switched by fading the old one out and then the new one in, each over this many frames
+constexpr size_t HandoverFadeFrames = 64;
+
+const char* const ResamplerQualityNames[] = { "none", "fastest", "fast", "good", "best" };
+
 // SysEx commands for setting MIDI channel assignment (no SysEx framing, just 3-byte address and 9 channel values)
 const u8 CMT32Synth::StandardMIDIChannelsSysEx[] = { 0x10, 0x00, 0x0D, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09 };
 const u8 CMT32Synth::AlternateMIDIChannelsSysEx[] = { 0x10, 0x00, 0x0D, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x09 };
 
-CMT32Synth::CMT32Synth(unsigned nSampleRate, TResamplerQuality ResamplerQuality)
+CMT32Synth::CMT32Synth(unsigned nSampleRate, TResamplerQuality ResamplerQuality, bool bResamplerGovernor)
 	: CSynthBase(nSampleRate),
 
 	  m_pSynth(nullptr),
 
 	  m_ResamplerQuality(ResamplerQuality),
+	  m_ActiveResamplerQuality(ResamplerQuality),
 	  m_pSampleRateConverter(nullptr),
 
+	  m_bResamplerGovernor(bResamplerGovernor && ResamplerQuality > TResamplerQuality::Fastest),
+	  m_pSampleRateConverters{nullptr},
+	  m_pPreviousSampleRateConverter(nullptr),
+	  m_nHandoverPosition(0),
+	  m_nGovernorMicros(0),
+	  m_nGovernorFrames(0),
+	  m_nGovernorQuietWindows(0),
+	  m_nGovernorStepUpWindows(0),
+
+	  m_PartChannels{0},
+	  m_bPartChannelsChanged(true),
+
 	  m_CurrentROMSet(TMT32ROMSet::Any),
 	  m_pControlROMImage(nullptr),
 	  m_pPCMROMImage(nullptr)
@@ -53,11 +82,14 @@ CMT32Synth::CMT32Synth(unsigned nSampleRate, TResamplerQuality ResamplerQuality)
 
 CMT32Synth::~CMT32Synth()
 {
+	for (MT32Emu::SampleRateConverter* pSampleRateConverter : m_pSampleRateConverters)
+	{
+		if (pSampleRateConverter)
+			delete pSampleRateConverter;
+	}
+
 	if (m_pSynth)
 		delete m_pSynth;
-
-	if (m_pSampleRateConverter)
-		delete m_pSampleRateConverter;
 }
 
 bool CMT32Synth::Initialize()
@@ -78,10 +110,15 @@ bool CMT32Synth::Initialize()
 	if (!m_pSynth->open(*m_pControlROMImage, *m_pPCMROMImage))
 		return false;
 
-	if (m_ResamplerQuality != TResamplerQuality::None)
+	if (m_ResamplerQuality == TResamplerQuality::None)
+		return true;
+
+	// With the governor, every quality up to the configured one may be used
+	const size_t nLowestQuality = static_cast<size_t>(m_bResamplerGovernor ? TResamplerQuality::Fastest : m_ResamplerQuality);
+	for (size_t i = nLowestQuality; i <= static_cast<size_t>(m_ResamplerQuality); ++i)
 	{
 		auto quality = MT32Emu::SamplerateConversionQuality_GOOD;
-		switch (m_ResamplerQuality)
+		switch (static_cast<TResamplerQuality>(i))
 		{
 			case TResamplerQuality::Fastest:
 				quality = MT32Emu::SamplerateConversionQuality_FASTEST;
@@ -103,29 +140,40 @@ bool CMT32Synth::Initialize()
 				break;
 		}
 
-		m_pSampleRateConverter = new MT32Emu::SampleRateConverter(*m_pSynth, m_nSampleRate, quality);
+		m_pSampleRateConverters[i] = new MT32Emu::SampleRateConverter(*m_pSynth, m_nSampleRate, quality);
 	}
 
+	m_pSampleRateConverter = m_pSampleRateConverters[static_cast<size_t>(m_ResamplerQuality)];
+
+	m_nGovernorStepUpWindows = m_nSampleRate * GovernorStepUpMillis / 1000 / GovernorWindowFrames;
+
 	return true;
 }
 
-void CMT32Synth::HandleMIDIShortMessage(u32 nMessage)
+void CMT32Synth::HandleMIDIShortMessage(u32 nMessage, size_t nFrameOffset)
 {
-	// TODO: timestamping
-	m_pSynth->playMsg(nMessage);
+	m_pSynth->playMsg(nMessage, GetSynthTimestamp(nFrameOffset));
 }
 
-void CMT32Synth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
+void CMT32Synth::HandleMIDISysExMessage(const u8* pData, size_t nSize, u8 nBank, size_t nFrameOffset)
 {
-	// TODO: timestamping
-	m_pSynth->playSysex(pData, nSize);
+	m_pSynth->playSysex(pData, nSize, GetSynthTimestamp(nFrameOffset));
+
+	// May have reassigned part channels; mt32emu applies it during the next render
+	m_bPartChannelsChanged = true;
 }
 
 void CMT32Synth::AllSoundOff()
 {
+	m_Lock.Acquire();
+
 	// Stop all sound immediately; mt32emu treats CC 0x7C like "All Sound Off", ignoring pedal
 	for (uint8_t i = 0; i < 8; ++i)
 		m_pSynth->playMsgOnPart(i, 0x0B, 0x7C, 0);
+
+	m_ChannelActivity.Reset();
+
+	m_Lock.Release();
 }
 
 void CMT32Synth::SetMasterVolume(u8 nVolume)
@@ -134,53 +182,177 @@ void CMT32Synth::SetMasterVolume(u8 nVolume)
 	m_pSynth->writeSysex(0x10, SetVolumeSysEx, sizeof(SetVolumeSysEx));
 }
 
-size_t CMT32Synth::Render(s16* pOutBuffer, size_t nFrames)
+void CMT32Synth::RenderSubBlock(s16* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
-	if (m_pSampleRateConverter)
-		m_pSampleRateConverter->getOutputSamples(pOutBuffer, nFrames);
-	else
+	RenderResampled(pOutBuffer, nFrames);
+
+	if (m_bPartChannelsChanged)
+		UpdatePartChannels();
+}
+
+void CMT32Synth::RenderSubBlock(s32* pOutBuffer, size_t nFrames)
+{
+	// Take float from the resampler, rather than widening its 16-bit output, so 24-bit devices get the extra precision
+	float FloatBuffer[MIDISubBlockFrames * 2];
+	RenderSubBlock(FloatBuffer, nFrames);
+	SampleConverter::FloatToPCM(pOutBuffer, FloatBuffer, nFrames * 2);
+}
+
+void CMT32Synth::RenderSubBlock(float* pOutBuffer, size_t nFrames)
+{
+	RenderResampled(pOutBuffer, nFrames);
+
+	if (m_bPartChannelsChanged)
+		UpdatePartChannels();
+}
+
+u32 CMT32Synth::GetSynthTimestamp(size_t nFrameOffset) const
+{
+	// mt32emu plays queued messages at an exact sample of its own (32kHz) timeline
+	const double nSynthOffset = m_pSampleRateConverter ? m_pSampleRateConverter->convertOutputToSynthTimestamp(nFrameOffset) : nFrameOffset;
+	return m_pSynth->getInternalRenderedSampleCount() + static_cast<u32>(nSynthOffset);
+}
+
+template <class T>
+void CMT32Synth::RenderResampled(T* pOutBuffer, size_t nFrames)
+{
+	if (!m_pSampleRateConverter)
+	{
 		m_pSynth->render(pOutBuffer, nFrames);
-	m_Lock.Release();
+		return;
+	}
+
+	// Timed against the wall clock rather than in CPU cycles, so that a throttled clock shows up as extra load
+	const u32 nStartTicks = CTimer::GetClockTicks();
+
+	if (m_pPreviousSampleRateConverter)
+		RenderHandover(pOutBuffer, nFrames);
+	else
+		m_pSampleRateConverter->getOutputSamples(pOutBuffer, nFrames);
 
-	return nFrames;
+	if (m_bResamplerGovernor)
+		UpdateResamplerGovernor(CTimer::GetClockTicks() - nStartTicks, nFrames);
 }
 
-size_t CMT32Synth::Render(float* pOutBuffer, size_t nFrames)
+// Each converter pulls from the synth itself, so rendering both for the same frames would advance the synth twice;
+// instead every frame comes from one converter: the old one fades out, then the new one fades in, which also hides
+// the stale filter state it kept from when it was last used. The fades have a fixed length, spanning calls as needed
+template <class T>
+void CMT32Synth::RenderHandover(T* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
-	if (m_pSampleRateConverter)
+	while (nFrames && m_pPreviousSampleRateConverter)
+	{
+		const bool bFadeOut         = m_nHandoverPosition < HandoverFadeFrames;
+		const size_t nFadePosition  = bFadeOut ? m_nHandoverPosition : m_nHandoverPosition - HandoverFadeFrames;
+		const size_t nSegmentFrames = Utility::Min(nFrames, HandoverFadeFrames - nFadePosition);
+
+		MT32Emu::SampleRateConverter* pConverter = bFadeOut ? m_pPreviousSampleRateConverter : m_pSampleRateConverter;
+		pConverter->getOutputSamples(pOutBuffer, nSegmentFrames);
+
+		for (size_t i = 0; i < nSegmentFrames; ++i)
+		{
+			const float nGain = static_cast<float>(bFadeOut ? HandoverFadeFrames - nFadePosition - i : nFadePosition + i) / HandoverFadeFrames;
+			pOutBuffer[i * 2]     = pOutBuffer[i * 2] * nGain;
+			pOutBuffer[i * 2 + 1] = pOutBuffer[i * 2 + 1] * nGain;
+		}
+
+		pOutBuffer += nSegmentFrames * 2;
+		nFrames -= nSegmentFrames;
+		m_nHandoverPosition += nSegmentFrames;
+
+		if (m_nHandoverPosition == HandoverFadeFrames * 2)
+			m_pPreviousSampleRateConverter = nullptr;
+	}
+
+	if (nFrames)
 		m_pSampleRateConverter->getOutputSamples(pOutBuffer, nFrames);
+}
+
+void CMT32Synth::UpdatePartChannels()
+{
+	m_pSynth->readMemory(MemoryAddressPartChannels, PartCount, m_PartChannels);
+	m_bPartChannelsChanged = false;
+}
+
+void CMT32Synth::UpdateResamplerGovernor(u32 nMicros, size_t nFrames)
+{
+	m_nGovernorMicros += nMicros;
+	m_nGovernorFrames += nFrames;
+
+	if (m_nGovernorFrames < GovernorWindowFrames)
+		return;
+
+	// Render time as a percentage of the time the window's frames take to play
+	const u32 nLoadPercent = static_cast<u64>(m_nGovernorMicros) * m_nSampleRate / 10000 / m_nGovernorFrames;
+	m_nGovernorMicros = 0;
+	m_nGovernorFrames = 0;
+
+	if (nLoadPercent >= GovernorHighLoadPercent)
+	{
+		m_nGovernorQuietWindows = 0;
+		if (m_ActiveResamplerQuality > TResamplerQuality::Fastest)
+			SetActiveResamplerQuality(static_cast<TResamplerQuality>(static_cast<size_t>(m_ActiveResamplerQuality) - 1));
+	}
+	else if (nLoadPercent <= GovernorLowLoadPercent && m_ActiveResamplerQuality < m_ResamplerQuality)
+	{
+		if (++m_nGovernorQuietWindows >= m_nGovernorStepUpWindows)
+		{
+			m_nGovernorQuietWindows = 0;
+			SetActiveResamplerQuality(static_cast<TResamplerQuality>(static_cast<size_t>(m_ActiveResamplerQuality) + 1));
+		}
+	}
 	else
-		m_pSynth->render(pOutBuffer, nFrames);
-	m_Lock.Release();
+		m_nGovernorQuietWindows = 0;
+}
 
-	return nFrames;
+// Called on the audio core; the change is published with the synth state and logged by the UI core
+void CMT32Synth::SetActiveResamplerQuality(TResamplerQuality Quality)
+{
+	// Windows are much longer than a handover, so one is always finished before the next starts
+	m_pPreviousSampleRateConverter = m_pSampleRateConverter;
+	m_pSampleRateConverter = m_pSampleRateConverters[static_cast<size_t>(Quality)];
+	m_ActiveResamplerQuality = Quality;
+	m_nHandoverPosition = 0;
 }
 
-u8 CMT32Synth::GetChannelVelocities(u8* pOutVelocities, size_t nMaxChannels)
+const char* CMT32Synth::GetResamplerQualityName(TResamplerQuality Quality)
 {
-	u8 Keys[MT32Emu::DEFAULT_MAX_PARTIALS];
-	u8 Velocities[MT32Emu::DEFAULT_MAX_PARTIALS];
-	u32 nPartStates = m_pSynth->getPartStates();
-	nMaxChannels = Utility::Min(nMaxChannels, static_cast<size_t>(9));
+	return ResamplerQualityNames[static_cast<size_t>(Quality)];
+}
 
-	// Initialize output array
-	memset(pOutVelocities, 0, nMaxChannels);
+u32 CMT32Synth::GetActiveVoiceCount()
+{
+	// The synth is opened with the default number of partials
+	MT32Emu::PartialState PartialStates[MT32Emu::DEFAULT_MAX_PARTIALS];
+	m_pSynth->getPartialStates(PartialStates);
 
-	for (u8 nPart = 0; nPart < nMaxChannels; ++nPart)
+	u32 nActivePartials = 0;
+	for (auto State : PartialStates)
 	{
-		// No active partials on this part; skip
-		if (!(nPartStates & 1 << nPart))
-			continue;
-
-		// Store maximum velocity for this part
-		u32 nPlayingNotes = m_pSynth->getPlayingNotes(nPart, Keys, Velocities);
-		for (u8 nNote = 0; nNote < nPlayingNotes; ++nNote)
-			pOutVelocities[nPart] = Utility::Max(pOutVelocities[nPart], Velocities[nNote]);
+		if (State != MT32Emu::PartialState_INACTIVE)
+			++nActivePartials;
 	}
 
-	return nMaxChannels;
+	return nActivePartials;
+}
+
+void CMT32Synth::UpdateState(TSynthState& State)
+{
+	State.bActive       = m_pSynth->isActive();
+	State.nActiveVoices = GetActiveVoiceCount();
+	State.nMasterVolume = GetMasterVolume();
+	State.nPartStates   = m_pSynth->getPartStates();
+	State.ROMSet        = m_CurrentROMSet;
+
+	State.nResamplerQuality = static_cast<u8>(m_ActiveResamplerQuality);
+
+	// Report the held notes on the MIDI channel assigned to each part; 16 means the part is disabled
+	State.nChannels = PartCount;
+	for (u8 nPart = 0; nPart < PartCount; ++nPart)
+	{
+		const u8 nChannel = m_PartChannels[nPart];
+		State.ChannelVelocities[nPart] = nChannel < CChannelActivity::Channels ? m_ChannelActivity.GetVelocity(nChannel) : 0;
+	}
 }
 
 void CMT32Synth::ReportStatus() const
@@ -195,6 +367,8 @@ void CMT32Synth::SetMIDIChannels(TMIDIChannels Channels)
 		m_pSynth->writeSysex(0x10, StandardMIDIChannelsSysEx, sizeof(StandardMIDIChannelsSysEx));
 	else
 		m_pSynth->writeSysex(0x10, AlternateMIDIChannelsSysEx, sizeof(AlternateMIDIChannelsSysEx));
+
+	m_bPartChannelsChanged = true;
 }
 
 bool CMT32Synth::SwitchROMSet(TMT32ROMSet ROMSet)
@@ -222,6 +396,8 @@ bool CMT32Synth::SwitchROMSet(TMT32ROMSet ROMSet)
 	m_Lock.Acquire();
 	m_pSynth->close();
 	assert(m_pSynth->open(*pControlROMImage, *pPCMROMImage));
+	m_ChannelActivity.Reset();
+	m_bPartChannelsChanged = true;
 	m_Lock.Release();
 
 	m_pControlROMImage = pControlROMImage;
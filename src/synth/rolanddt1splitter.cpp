@@ -0,0 +1,124 @@
+//
+// rolanddt1splitter.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2021 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/util.h>
+
+#include "synth/rolanddt1splitter.h"
+#include "synth/rolandsysex.h"
+
+CRolandDT1Splitter::CRolandDT1Splitter(TMessageHandler pHandler, void* pUser)
+	: m_pHandler(pHandler),
+	  m_pUser(pUser),
+	  m_bSplitting(false),
+	  m_nAddress(0),
+	  m_nSum(0),
+	  m_nDataBytes(0),
+	  m_Message{0}
+{
+}
+
+bool CRolandDT1Splitter::OnSysExFragment(const u8* pData, size_t nSize, CMIDIParser::TSysExFragment Fragment)
+{
+	switch (Fragment)
+	{
+		case CMIDIParser::TSysExFragment::Start:
+			m_bSplitting = nSize >= HeaderSize &&
+			               pData[1] == static_cast<u8>(TManufacturerID::Roland) &&
+			               pData[3] == static_cast<u8>(TRolandModelID::MT32) &&
+			               pData[4] == static_cast<u8>(TRolandCommandID::DT1);
+			if (!m_bSplitting)
+				return false;
+
+			// MT-32 addresses are 7 bits per byte
+			memcpy(m_Message, pData, HeaderSize);
+			m_nAddress   = pData[5] << 14 | pData[6] << 7 | pData[7];
+			m_nSum       = pData[5] + pData[6] + pData[7];
+			m_nDataBytes = 0;
+			AddBytes(pData + HeaderSize, nSize - HeaderSize);
+			return true;
+
+		case CMIDIParser::TSysExFragment::Continue:
+			if (m_bSplitting)
+				AddBytes(pData, nSize);
+			return m_bSplitting;
+
+		case CMIDIParser::TSysExFragment::End:
+		{
+			if (!m_bSplitting)
+				return false;
+
+			// Everything but the F7
+			AddBytes(pData, nSize - 1);
+			m_bSplitting = false;
+
+			// The last byte held back is the checksum, which makes the sum of the address, data and checksum a multiple of 128
+			if (m_nDataBytes == 0 || (m_nSum & 0x7F))
+				return false;
+
+			if (m_nDataBytes > 1)
+				Emit(m_nDataBytes - 1);
+
+			return true;
+		}
+
+		case CMIDIParser::TSysExFragment::Abort:
+		default:
+			m_bSplitting = false;
+			return false;
+	}
+}
+
+void CRolandDT1Splitter::AddBytes(const u8* pData, size_t nSize)
+{
+	for (size_t i = 0; i < nSize; ++i)
+	{
+		// Keep one byte back
+		if (m_nDataBytes == MaxDataBytes + 1)
+		{
+			const u8 nHeldByte = m_Message[HeaderSize + MaxDataBytes];
+			Emit(MaxDataBytes);
+			m_Message[HeaderSize] = nHeldByte;
+			m_nDataBytes = 1;
+		}
+
+		m_Message[HeaderSize + m_nDataBytes++] = pData[i];
+		m_nSum += pData[i];
+	}
+}
+
+void CRolandDT1Splitter::Emit(size_t nDataBytes)
+{
+	m_Message[5] = (m_nAddress >> 14) & 0x7F;
+	m_Message[6] = (m_nAddress >> 7) & 0x7F;
+	m_Message[7] = m_nAddress & 0x7F;
+
+	u8 nSum = 0;
+	for (size_t i = 5; i < HeaderSize + nDataBytes; ++i)
+		nSum += m_Message[i];
+
+	m_Message[HeaderSize + nDataBytes]     = (128 - (nSum & 0x7F)) & 0x7F;
+	m_Message[HeaderSize + nDataBytes + 1] = 0xF7;
+
+	m_pHandler(m_Message, HeaderSize + nDataBytes + 2, m_pUser);
+	m_nAddress += nDataBytes;
+}
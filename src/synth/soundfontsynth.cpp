@@ -22,9 +22,13 @@
 
 #include <fatfs/ff.h>
 #include <circle/logger.h>
+#include <circle/spinlock.h>
+#include <circle/synchronize.h>
 #include <circle/timer.h>
 
+#include "audio/sampleconverter.h"
 #include "config.h"
+#include "coreworker.h"
 #include "synth/gmsysex.h"
 #include "synth/rolandsysex.h"
 #include "synth/soundfontsynth.h"
@@ -34,6 +38,20 @@
 const char SoundFontSynthName[] = "soundfontsynth";
 const char SoundFontPath[] = "soundfonts";
 
+// Render load is evaluated over windows of this many frames
+constexpr u32 GovernorWindowFrames = 512;
+
+// The voice cap is cut in proportion to the overload as soon as a window exceeds the high mark, aiming for the target,
+// and grows back gradually once load has stayed below the low mark for a while
+constexpr u32 GovernorHighLoadPercent   = 85;
+constexpr u32 GovernorTargetLoadPercent = 70;
+constexpr u32 GovernorLowLoadPercent    = 55;
+constexpr u32 GovernorStepUpMillis      = 500;
+constexpr u32 GovernorMinVoiceCap       = 16;
+
+// Culled voices are released with a very short (~15ms) envelope release to avoid clicks
+constexpr float CullReleaseTimecents = -7200.0f;
+
 extern "C"
 {
 	// Replacements for fluid_sys.c functions
@@ -65,6 +83,87 @@ extern "C"
 	void fluid_msleep(unsigned int msecs) { CTimer::SimpleMsDelay(msecs); }
 	double fluid_utime() { return static_cast<double>(CTimer::GetClockTicks()); }
 
+	// Threading primitives for FluidSynth's parallel voice mixer
+	// Its one extra render thread runs as a job on the core worker
+	struct _fluid_thread_t
+	{
+		void* (*pFunction)(void* pData);
+		void* pData;
+	};
+
+	struct _fluid_cond_mutex_t
+	{
+		_fluid_cond_mutex_t() : Lock(TASK_LEVEL) {}
+		CSpinLock Lock;
+	};
+
+	// Waiters sleep until the sequence number changes; spurious wakeups are allowed by the API
+	struct _fluid_cond_t
+	{
+		u32 nSequence;
+	};
+
+	_fluid_thread_t* new_fluid_thread(const char* name, void* (*func)(void* data), void* data, int prio_level, int detach)
+	{
+		CCoreWorker* const pWorker = CCoreWorker::Get();
+		if (!pWorker)
+			return nullptr;
+
+		_fluid_thread_t* pThread = new _fluid_thread_t{func, data};
+		const auto ThreadJob = [](void* pParam)
+		{
+			_fluid_thread_t* pThread = static_cast<_fluid_thread_t*>(pParam);
+			pThread->pFunction(pThread->pData);
+		};
+
+		if (!pWorker->Submit(ThreadJob, pThread))
+		{
+			CLogger::Get()->Write(SoundFontSynthName, LogError, "No free core for thread '%s'", name);
+			delete pThread;
+			return nullptr;
+		}
+
+		return pThread;
+	}
+
+	void delete_fluid_thread(_fluid_thread_t* thread) { delete thread; }
+	void fluid_thread_self_set_prio(int prio_level) {}
+
+	int fluid_thread_join(_fluid_thread_t* thread)
+	{
+		CCoreWorker::Get()->Join();
+		return FLUID_OK;
+	}
+
+	_fluid_cond_mutex_t* new_fluid_cond_mutex() { return new _fluid_cond_mutex_t; }
+	void delete_fluid_cond_mutex(_fluid_cond_mutex_t* m) { delete m; }
+	void fluid_cond_mutex_lock(_fluid_cond_mutex_t* m) { m->Lock.Acquire(); }
+	void fluid_cond_mutex_unlock(_fluid_cond_mutex_t* m) { m->Lock.Release(); }
+
+	_fluid_cond_t* new_fluid_cond() { return new _fluid_cond_t{0}; }
+	void delete_fluid_cond(_fluid_cond_t* cond) { delete cond; }
+
+	void fluid_cond_broadcast(_fluid_cond_t* cond)
+	{
+		__atomic_add_fetch(&cond->nSequence, 1, __ATOMIC_RELEASE);
+		DataSyncBarrier();
+		SendEvent();
+	}
+
+	void fluid_cond_signal(_fluid_cond_t* cond) { fluid_cond_broadcast(cond); }
+
+	void fluid_cond_wait(_fluid_cond_t* cond, _fluid_cond_mutex_t* m)
+	{
+		// Sample the sequence while still holding the mutex so a signal can't be missed
+		const u32 nSequence = __atomic_load_n(&cond->nSequence, __ATOMIC_ACQUIRE);
+		m->Lock.Release();
+
+		while (__atomic_load_n(&cond->nSequence, __ATOMIC_ACQUIRE) == nSequence)
+			WaitForEvent();
+
+		m->Lock.Acquire();
+	}
+
 	// Replacements for fluid_sfont.c functions
 	// These were found to be much faster than FluidSynth's default approach of going through libc
 	void* default_fopen(const char* path)
@@ -125,9 +224,12 @@ extern "C"
 
 		return f_lseek(pFile, ofs) == FR_OK ? FLUID_OK : FLUID_FAILED;
 	}
+
+	// Internal to FluidSynth; unlike a note-off, moves a voice to its release phase even if sustained
+	void fluid_voice_release(fluid_voice_t* voice);
 }
 
-CSoundFontSynth::CSoundFontSynth(unsigned nSampleRate, float nGain, u32 nPolyphony)
+CSoundFontSynth::CSoundFontSynth(unsigned nSampleRate, float nGain, u32 nPolyphony, unsigned int nCPUCores, bool bPolyphonyGovernor, unsigned int nMIDIChannels)
 	: CSynthBase(nSampleRate),
 
 	  m_pSettings(nullptr),
@@ -137,7 +239,22 @@ CSoundFontSynth::CSoundFontSynth(unsigned nSampleRate, float nGain, u32 nPolypho
 	  m_nCurrentGain(nGain),
 
 	  m_nPolyphony(nPolyphony),
-	  m_nCurrentSoundFontIndex(0)
+	  m_nCPUCores(nCPUCores),
+	  m_nMIDIChannels(nMIDIChannels),
+	  m_nCurrentSoundFontIndex(0),
+
+	  m_bPolyphonyGovernor(bPolyphonyGovernor),
+	  m_nGovernorMicros(0),
+	  m_nGovernorFrames(0),
+	  m_nGovernorQuietWindows(0),
+	  m_nGovernorStepUpWindows(0),
+	  m_nVoiceCap(nPolyphony),
+	  m_nCulledVoices(0),
+
+	  m_pVoiceList(nullptr),
+	  m_pVoicePriorities(nullptr),
+	  m_pCulledVoiceList(nullptr),
+	  m_nCulledVoiceListSize(0)
 {
 }
 
@@ -148,6 +265,10 @@ CSoundFontSynth::~CSoundFontSynth()
 
 	if (m_pSettings)
 		delete_fluid_settings(m_pSettings);
+
+	delete[] m_pVoiceList;
+	delete[] m_pVoicePriorities;
+	delete[] m_pCulledVoiceList;
 }
 
 void CSoundFontSynth::FluidSynthLogCallback(int nLevel, const char* pMessage, void* pUser)
@@ -188,28 +309,41 @@ bool CSoundFontSynth::Initialize()
 
 	fluid_settings_setnum(m_pSettings, "synth.sample-rate", static_cast<double>(m_nSampleRate));
 	fluid_settings_setint(m_pSettings, "synth.threadsafe-api", false);
+	fluid_settings_setint(m_pSettings, "synth.midi-channels", m_nMIDIChannels);
+
+	// With 2 cores, voice rendering is split between the audio core and the spare core
+	fluid_settings_setint(m_pSettings, "synth.cpu-cores", m_nCPUCores);
+
+	m_nGovernorStepUpWindows = m_nSampleRate * GovernorStepUpMillis / 1000 / GovernorWindowFrames;
+
+	if (m_bPolyphonyGovernor)
+	{
+		// Null-terminated
+		m_pVoiceList       = new fluid_voice_t*[m_nPolyphony + 1];
+		m_pVoicePriorities = new u64[m_nPolyphony];
+		m_pCulledVoiceList = new TCulledVoice[m_nPolyphony];
+	}
 
 	return Reinitialize(pSoundFontPath);
 }
 
-void CSoundFontSynth::HandleMIDIShortMessage(u32 nMessage)
+// FluidSynth has no timestamped input, so messages take effect at the start of their sub-block
+void CSoundFontSynth::HandleMIDIShortMessage(u32 nMessage, size_t nFrameOffset)
 {
 	const u8 nStatus  = nMessage & 0xFF;
-	const u8 nChannel = nMessage & 0x0F;
 	const u8 nData1   = (nMessage >> 8) & 0xFF;
 	const u8 nData2   = (nMessage >> 16) & 0xFF;
 
+	// The top byte selects a set of 16 channels beyond the first
+	const u8 nChannel = (nMessage & 0x0F) + (nMessage >> 24) * 16;
+
 	// Handle system real-time messages
 	if (nStatus == 0xFF)
 	{
-		m_Lock.Acquire();
-		fluid_synth_system_reset(m_pSynth);
-		m_Lock.Release();
+		ResetChannels(nMessage >> 24);
 		return;
 	}
 
-	m_Lock.Acquire();
-
 	// Handle channel messages
 	switch (nStatus & 0xF0)
 	{
@@ -248,11 +382,9 @@ void CSoundFontSynth::HandleMIDIShortMessage(u32 nMessage)
 			fluid_synth_pitch_bend(m_pSynth, nChannel, (nData2 << 7) | nData1);
 			break;
 	}
-
-	m_Lock.Release();
 }
 
-void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
+void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize, u8 nBank, size_t nFrameOffset)
 {
 	// GM Mode On
 	if (nSize == sizeof(TGMModeOnSysExMessage))
@@ -260,9 +392,7 @@ void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
 		const auto& GMModeOnMessage = reinterpret_cast<const TGMModeOnSysExMessage&>(*pData);
 		if (GMModeOnMessage.IsValid())
 		{
-			m_Lock.Acquire();
-			fluid_synth_system_reset(m_pSynth);
-			m_Lock.Release();
+			ResetChannels(nBank);
 			return;
 		}
 	}
@@ -275,9 +405,7 @@ void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
 		const auto& SystemModeSetMessage = reinterpret_cast<const TRolandSystemModeSetSysExMessage&>(*pData);
 		if (GSResetMessage.IsValid() || SystemModeSetMessage.IsValid())
 		{
-			m_Lock.Acquire();
-			fluid_synth_system_reset(m_pSynth);
-			m_Lock.Release();
+			ResetChannels(nBank);
 			return;
 		}
 
@@ -285,16 +413,14 @@ void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
 		const auto& UseForRhythmPartMessage = reinterpret_cast<const TRolandUseForRhythmPartSysExMessage&>(*pData);
 		if (UseForRhythmPartMessage.IsValid())
 		{
-			const u8 nChannel = (UseForRhythmPartMessage.GetAddress() >> 8) & 0x0F;
+			const u8 nChannel = ((UseForRhythmPartMessage.GetAddress() >> 8) & 0x0F) + nBank * 16;
 			const u8 nMode    = *UseForRhythmPartMessage.GetData();
 
-			if (nMode > 0x02)
+			if (nMode > 0x02 || nChannel >= m_nMIDIChannels)
 				return;
 
-			m_Lock.Acquire();
 			fluid_synth_set_channel_type(m_pSynth, nChannel, nMode == 0 ? CHANNEL_TYPE_MELODIC : CHANNEL_TYPE_DRUM);
 			fluid_synth_program_change(m_pSynth, nChannel, 0);
-			m_Lock.Release();
 			return;
 		}
 	}
@@ -322,10 +448,44 @@ void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
 		}
 	}
 
+	// FluidSynth's own SysEx parser only addresses the first 16 channels, so it can't handle the other routes' SysEx
+	if (nBank)
+		return;
+
 	// No special handling; forward to FluidSynth SysEx parser, excluding leading 0xF0 and trailing 0xF7
-	m_Lock.Acquire();
 	fluid_synth_sysex(m_pSynth, reinterpret_cast<const char*>(pData + 1), nSize - 1, nullptr, nullptr, nullptr, false);
-	m_Lock.Release();
+}
+
+// GM/GS reset or System Reset; with more than 16 channels, only the set of 16 the message was routed to is reset
+void CSoundFontSynth::ResetChannels(u8 nBank)
+{
+	m_ChannelActivity.Reset();
+
+	if (m_nMIDIChannels <= 16)
+	{
+		fluid_synth_system_reset(m_pSynth);
+		return;
+	}
+
+	const u8 nFirstChannel = nBank * 16;
+	for (u8 i = 0; i < 16; ++i)
+	{
+		const u8 nChannel = nFirstChannel + i;
+
+		fluid_synth_all_sounds_off(m_pSynth, nChannel);
+		fluid_synth_set_channel_type(m_pSynth, nChannel, i == 9 ? CHANNEL_TYPE_DRUM : CHANNEL_TYPE_MELODIC);
+		fluid_synth_cc(m_pSynth, nChannel, 0, 0);
+		fluid_synth_cc(m_pSynth, nChannel, 32, 0);
+		fluid_synth_program_change(m_pSynth, nChannel, 0);
+
+		// Reset All Controllers leaves volume, pan and effect sends alone, so restore their GM/GS defaults too
+		fluid_synth_cc(m_pSynth, nChannel, 121, 0);
+		fluid_synth_cc(m_pSynth, nChannel, 7, 100);
+		fluid_synth_cc(m_pSynth, nChannel, 10, 64);
+		fluid_synth_cc(m_pSynth, nChannel, 91, 40);
+		fluid_synth_cc(m_pSynth, nChannel, 93, 0);
+		fluid_synth_pitch_wheel_sens(m_pSynth, nChannel, 2);
+	}
 }
 
 bool CSoundFontSynth::IsActive()
@@ -337,10 +497,20 @@ bool CSoundFontSynth::IsActive()
 	return nVoices > 0;
 }
 
+u32 CSoundFontSynth::GetActiveVoiceCount()
+{
+	m_Lock.Acquire();
+	const int nVoices = fluid_synth_get_active_voice_count(m_pSynth);
+	m_Lock.Release();
+
+	return nVoices;
+}
+
 void CSoundFontSynth::AllSoundOff()
 {
 	m_Lock.Acquire();
 	fluid_synth_all_sounds_off(m_pSynth, -1);
+	m_ChannelActivity.Reset();
 	m_Lock.Release();
 }
 
@@ -352,52 +522,176 @@ void CSoundFontSynth::SetMasterVolume(u8 nVolume)
 	m_Lock.Release();
 }
 
-size_t CSoundFontSynth::Render(float* pOutBuffer, size_t nFrames)
+// Renders are timed against the wall clock rather than in CPU cycles, so that a throttled clock shows up as extra load
+void CSoundFontSynth::RenderSubBlock(float* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
+	const u32 nStartTicks = CTimer::GetClockTicks();
+
+	if (m_bPolyphonyGovernor)
+		EnforceVoiceCap();
+
 	assert(fluid_synth_write_float(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
-	m_Lock.Release();
-	return nFrames;
+
+	if (m_bPolyphonyGovernor)
+		UpdatePolyphonyGovernor(CTimer::GetClockTicks() - nStartTicks, nFrames);
 }
 
-size_t CSoundFontSynth::Render(s16* pOutBuffer, size_t nFrames)
+void CSoundFontSynth::RenderSubBlock(s16* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
+	const u32 nStartTicks = CTimer::GetClockTicks();
+
+	if (m_bPolyphonyGovernor)
+		EnforceVoiceCap();
+
 	assert(fluid_synth_write_s16(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
-	m_Lock.Release();
-	return nFrames;
+
+	if (m_bPolyphonyGovernor)
+		UpdatePolyphonyGovernor(CTimer::GetClockTicks() - nStartTicks, nFrames);
 }
 
-u8 CSoundFontSynth::GetChannelVelocities(u8* pOutVelocities, size_t nMaxChannels)
+void CSoundFontSynth::RenderSubBlock(s32* pOutBuffer, size_t nFrames)
 {
-	nMaxChannels = Utility::Min(nMaxChannels, static_cast<size_t>(16));
+	// Sub-blocks are at most MIDISubBlockFrames long, so a small scratch buffer avoids aliasing the output as float
+	float FloatBuffer[MIDISubBlockFrames * 2];
+	RenderSubBlock(FloatBuffer, nFrames);
+	SampleConverter::FloatToPCM(pOutBuffer, FloatBuffer, nFrames * 2);
+}
 
-	m_Lock.Acquire();
+void CSoundFontSynth::EnforceVoiceCap()
+{
+	const u32 nActiveVoices = fluid_synth_get_active_voice_count(m_pSynth);
+	const u32 nVoiceCap     = m_nVoiceCap;
+
+	if (nActiveVoices <= nVoiceCap)
+		return;
+
+	fluid_voice_t** const Voices = m_pVoiceList;
+	u64* const Priorities        = m_pVoicePriorities;
+	memset(Voices, 0, (m_nPolyphony + 1) * sizeof(*Voices));
 
-	const size_t nVoices = fluid_synth_get_polyphony(m_pSynth);
+	fluid_synth_get_voicelist(m_pSynth, Voices, m_nPolyphony, -1);
 
-	// Null-terminated
-	fluid_voice_t* Voices[nVoices + 1];
-	fluid_voice_t** pCurrentVoice = Voices;
+	// Rank candidates by state (released, sustained, then held), then velocity, then age
+	size_t nCandidates = 0;
+	u32 nDyingVoices   = 0;
+	for (fluid_voice_t** pCurrentVoice = Voices; *pCurrentVoice; ++pCurrentVoice)
+	{
+		fluid_voice_t* pVoice = *pCurrentVoice;
+
+		// Already culled and fading out; these are moved to the front of the culled list as they're found
+		if (IsCulledVoice(pVoice, fluid_voice_get_id(pVoice), nDyingVoices))
+		{
+			++nDyingVoices;
+			continue;
+		}
+
+		u64 nState;
+		if (fluid_voice_is_on(pVoice))
+			nState = 2;
+		else if (fluid_voice_is_sustained(pVoice) || fluid_voice_is_sostenuto(pVoice))
+			nState = 1;
+		else
+			nState = 0;
+
+		Voices[nCandidates]       = pVoice;
+		Priorities[nCandidates++] = nState << 40 | static_cast<u64>(fluid_voice_get_actual_velocity(pVoice)) << 32 | fluid_voice_get_id(pVoice);
+	}
 
-	// Initialize output array
-	memset(Voices, 0, (nVoices + 1) * sizeof(*Voices));
-	memset(pOutVelocities, 0, nMaxChannels);
+	// Culled voices that weren't found have finished
+	m_nCulledVoiceListSize = nDyingVoices;
 
-	fluid_synth_get_voicelist(m_pSynth, Voices, nVoices, -1);
+	if (nActiveVoices <= nVoiceCap + nDyingVoices)
+		return;
 
-	while (*pCurrentVoice)
+	// Only a handful of voices are normally culled at once, so a selection scan per voice is cheapest
+	for (u32 nExcess = Utility::Min(nActiveVoices - nVoiceCap - nDyingVoices, static_cast<u32>(nCandidates)); nExcess; --nExcess)
 	{
-		const u8 nChannel = fluid_voice_get_channel(*pCurrentVoice);
-		const u8 nVelocity = fluid_voice_is_on(*pCurrentVoice) ? fluid_voice_get_actual_velocity(*pCurrentVoice) : 0;
+		size_t nLowest = 0;
+		for (size_t i = 1; i < nCandidates; ++i)
+		{
+			if (Priorities[i] < Priorities[nLowest])
+				nLowest = i;
+		}
+
+		fluid_voice_t* pVoice = Voices[nLowest];
+		fluid_voice_gen_set(pVoice, GEN_VOLENVRELEASE, CullReleaseTimecents);
+		fluid_voice_update_param(pVoice, GEN_VOLENVRELEASE);
+		fluid_voice_release(pVoice);
 
-		pOutVelocities[nChannel] = Utility::Max(pOutVelocities[nChannel], nVelocity);
-		++pCurrentVoice;
+		// Dying and candidate voices are all in the voice list, so this never grows past the polyphony
+		m_pCulledVoiceList[m_nCulledVoiceListSize++] = { pVoice, fluid_voice_get_id(pVoice) };
+
+		Priorities[nLowest] = ~0ull;
+		++m_nCulledVoices;
 	}
+}
 
-	m_Lock.Release();
+bool CSoundFontSynth::IsCulledVoice(fluid_voice_t* pVoice, unsigned int nID, size_t nFirst)
+{
+	// Entries before nFirst have already been matched to other voices
+	for (size_t i = nFirst; i < m_nCulledVoiceListSize; ++i)
+	{
+		if (m_pCulledVoiceList[i].pVoice == pVoice && m_pCulledVoiceList[i].nID == nID)
+		{
+			Utility::Swap(m_pCulledVoiceList[i], m_pCulledVoiceList[nFirst]);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CSoundFontSynth::UpdatePolyphonyGovernor(u32 nMicros, size_t nFrames)
+{
+	m_nGovernorMicros += nMicros;
+	m_nGovernorFrames += nFrames;
+
+	if (m_nGovernorFrames < GovernorWindowFrames)
+		return;
+
+	// Render time as a percentage of the time the window's frames take to play
+	const u32 nLoadPercent = static_cast<u64>(m_nGovernorMicros) * m_nSampleRate / 10000 / m_nGovernorFrames;
+	m_nGovernorMicros = 0;
+	m_nGovernorFrames = 0;
 
-	return nMaxChannels;
+	if (nLoadPercent >= GovernorHighLoadPercent)
+	{
+		m_nGovernorQuietWindows = 0;
+
+		// Render time scales roughly with the voice count
+		const u32 nActiveVoices = Utility::Min(static_cast<u32>(fluid_synth_get_active_voice_count(m_pSynth)), m_nVoiceCap);
+		const u32 nVoiceCap     = Utility::Max(nActiveVoices * GovernorTargetLoadPercent / nLoadPercent, GovernorMinVoiceCap);
+
+		// Published with the synth state and logged by the UI core
+		if (nVoiceCap < m_nVoiceCap)
+			m_nVoiceCap = nVoiceCap;
+	}
+	else if (nLoadPercent <= GovernorLowLoadPercent && m_nVoiceCap < m_nPolyphony)
+	{
+		if (++m_nGovernorQuietWindows >= m_nGovernorStepUpWindows)
+		{
+			m_nGovernorQuietWindows = 0;
+			m_nVoiceCap = Utility::Min(m_nVoiceCap + m_nVoiceCap / 8 + 1, m_nPolyphony);
+		}
+	}
+	else
+		m_nGovernorQuietWindows = 0;
+}
+
+void CSoundFontSynth::UpdateState(TSynthState& State)
+{
+	const int nVoices = fluid_synth_get_active_voice_count(m_pSynth);
+
+	State.bActive         = nVoices > 0;
+	State.nActiveVoices   = nVoices;
+	State.nMasterVolume   = m_nCurrentGain / m_nInitialGain * 100.0f + 0.5f;
+	State.nSoundFontIndex = m_nCurrentSoundFontIndex;
+	State.nVoiceCap       = m_nVoiceCap;
+	State.nCulledVoices   = m_nCulledVoices;
+
+	State.nChannels = CChannelActivity::Channels;
+	for (u8 nChannel = 0; nChannel < CChannelActivity::Channels; ++nChannel)
+		State.ChannelVelocities[nChannel] = m_ChannelActivity.GetVelocity(nChannel);
 }
 
 void CSoundFontSynth::ReportStatus() const
@@ -464,6 +758,9 @@ bool CSoundFontSynth::Reinitialize(const char* pSoundFontPath)
 
 	fluid_synth_set_gain(m_pSynth, m_nCurrentGain);
 	fluid_synth_set_polyphony(m_pSynth, m_nPolyphony);
+	m_nVoiceCap = m_nPolyphony;
+	m_nCulledVoiceListSize = 0;
+	m_ChannelActivity.Reset();
 
 	m_Lock.Release();
 